@@ -0,0 +1,252 @@
+#include "AssetLoader.h"
+#include "Display.h"
+#include "Mesh.h"
+
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Background asset loading
+///////////////////////////////////////////////////////////////////////////////
+// load_mesh_async() adds the mesh to the scene right away, without faces and
+// with the 1x1 placeholder texture, and queues its files. Loader threads
+// parse the OBJ and decode the PNG into a mesh and a texture nobody else
+// sees yet and hand each one over when it is done. apply_loaded_assets()
+// puts them into the scene between frames, while no geometry is in flight:
+// a mesh shows up in the frame after its OBJ is parsed and gets its own
+// texture in the frame after its PNG is decoded. So the first frame does
+// not wait for any file, however large.
+//
+// The request queue has no limit, so load_mesh_async() never blocks the
+// main thread. The loaded assets need no limit either: each request hands
+// over two of them, and the main thread takes them all every frame.
+///////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    int mesh_index;
+    std::string obj_filename;
+    std::string png_filename;
+    int load_flags;
+} asset_request_t;
+
+typedef struct {
+    int mesh_index;
+    mesh_t* geometry;           // the parsed OBJ, or NULL
+    lodepng_texture_t* texture; // the decoded PNG, or NULL
+} loaded_asset_t;
+
+static std::mutex request_lock;
+static std::condition_variable request_added;
+static std::deque<asset_request_t> asset_requests;
+static bool requests_closed = false; // under request_lock, loaders leave once the queue is empty
+static std::vector<std::thread> loaders;
+static std::atomic<bool> stopping(false);
+static bool loader_running = false;
+
+static std::mutex loaded_lock;
+static std::condition_variable asset_loaded;
+static std::vector<loaded_asset_t> loaded_assets;
+
+// Assets requested and not in the scene yet, only touched by the main thread
+static int pending_assets = 0;
+static uint64_t loading_start_time = 0;
+
+static void hand_over(const loaded_asset_t& asset)
+{
+    {
+        std::lock_guard<std::mutex> guard(loaded_lock);
+        loaded_assets.push_back(asset);
+    }
+    asset_loaded.notify_one();
+}
+
+// Returns false once the requests are closed and all taken
+static bool pop_request(asset_request_t* request)
+{
+    std::unique_lock<std::mutex> guard(request_lock);
+    request_added.wait(guard, [] { return requests_closed || !asset_requests.empty(); });
+    if (asset_requests.empty())
+    {
+        return false;
+    }
+    *request = asset_requests.front();
+    asset_requests.pop_front();
+    return true;
+}
+
+static void loader_main(void)
+{
+    asset_request_t request;
+    while (pop_request(&request))
+    {
+        // Requests still queued at shutdown are dropped unloaded
+        if (stopping)
+        {
+            hand_over({ request.mesh_index, NULL, NULL });
+            hand_over({ request.mesh_index, NULL, NULL });
+            continue;
+        }
+
+        // Geometry first: the mesh can be drawn untextured while its PNG decodes
+        mesh_t* geometry = new mesh_t();
+        load_mesh_obj_data(geometry, request.obj_filename.c_str(), request.load_flags);
+        hand_over({ request.mesh_index, geometry, NULL });
+
+        lodepng_texture_t* texture = load_png_texture(request.png_filename.c_str(), request.load_flags);
+        hand_over({ request.mesh_index, NULL, texture });
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start the loader threads, 0 picks half of the hardware threads
+///////////////////////////////////////////////////////////////////////////////
+void start_asset_loader(int num_loaders)
+{
+    if (loader_running)
+    {
+        return;
+    }
+
+    if (num_loaders <= 0)
+    {
+        num_loaders = (int)std::thread::hardware_concurrency() / 2;
+    }
+    if (num_loaders <= 0)
+    {
+        num_loaders = 1;
+    }
+
+    asset_requests.clear();
+    requests_closed = false;
+    stopping = false;
+    for (int i = 0; i < num_loaders; i++)
+    {
+        loaders.emplace_back(loader_main);
+    }
+    loader_running = true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Add a mesh to the scene and load its files in the background. Returns the
+// mesh index, or -1 if there is no room for another mesh. Without a running
+// loader it loads the mesh right here.
+///////////////////////////////////////////////////////////////////////////////
+int load_mesh_async(const char* obj_filename, const char* png_filename, vec3_t scale, vec3_t translation, vec3_t rotation, int load_flags)
+{
+    if (!loader_running)
+    {
+        load_mesh(obj_filename, png_filename, scale, translation, rotation, load_flags);
+        return get_num_meshes() - 1;
+    }
+
+    int mesh_index = add_mesh(scale, translation, rotation);
+    if (mesh_index < 0)
+    {
+        fprintf(stderr, "Error loading %s: too many meshes\n", obj_filename);
+        return -1;
+    }
+
+    if (pending_assets == 0)
+    {
+        loading_start_time = SDL_GetPerformanceCounter();
+    }
+    pending_assets += 2;
+
+    {
+        std::lock_guard<std::mutex> guard(request_lock);
+        asset_requests.push_back({ mesh_index, obj_filename, png_filename, load_flags });
+    }
+    request_added.notify_one();
+    return mesh_index;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Put the assets loaded so far into the scene. Call it between frames only.
+///////////////////////////////////////////////////////////////////////////////
+void apply_loaded_assets(void)
+{
+    if (pending_assets == 0)
+    {
+        return;
+    }
+
+    std::vector<loaded_asset_t> loaded;
+    {
+        std::lock_guard<std::mutex> guard(loaded_lock);
+        loaded.swap(loaded_assets);
+    }
+
+    for (size_t i = 0; i < loaded.size(); i++)
+    {
+        if (loaded[i].geometry != NULL)
+        {
+            set_mesh_geometry(loaded[i].mesh_index, loaded[i].geometry);
+            delete loaded[i].geometry;
+        }
+        if (loaded[i].texture != NULL)
+        {
+            set_mesh_texture(loaded[i].mesh_index, loaded[i].texture);
+        }
+    }
+
+    pending_assets -= (int)loaded.size();
+    if (pending_assets == 0 && !stopping)
+    {
+        double load_ms = (double)(SDL_GetPerformanceCounter() - loading_start_time) * 1000.0 / SDL_GetPerformanceFrequency();
+        printf("Loaded the assets in %.1f ms\n", load_ms);
+    }
+}
+
+bool is_loading_assets(void)
+{
+    return pending_assets > 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Block until every requested asset is in the scene, for runs that must not
+// show a placeholder, like recorded sequences. Call it between frames only.
+///////////////////////////////////////////////////////////////////////////////
+void wait_for_loaded_assets(void)
+{
+    while (pending_assets > 0)
+    {
+        {
+            std::unique_lock<std::mutex> guard(loaded_lock);
+            asset_loaded.wait(guard, [] { return !loaded_assets.empty(); });
+        }
+        apply_loaded_assets();
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Drop the requests not started yet, wait for the loads in progress and put
+// what they loaded into the scene, so free_meshes() frees it
+///////////////////////////////////////////////////////////////////////////////
+void stop_asset_loader(void)
+{
+    if (!loader_running)
+    {
+        return;
+    }
+
+    stopping = true;
+    {
+        std::lock_guard<std::mutex> guard(request_lock);
+        requests_closed = true;
+    }
+    request_added.notify_all();
+    for (size_t i = 0; i < loaders.size(); i++)
+    {
+        loaders[i].join();
+    }
+    loaders.clear();
+
+    apply_loaded_assets();
+    loader_running = false;
+}
@@ -0,0 +1,14 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <stdbool.h>
+#include "Vector.h"
+
+void start_asset_loader(int num_loaders);
+int load_mesh_async(const char* obj_filename, const char* png_filename, vec3_t scale, vec3_t translation, vec3_t rotation, int load_flags);
+void apply_loaded_assets(void);
+bool is_loading_assets(void);
+void wait_for_loaded_assets(void);
+void stop_asset_loader(void);
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+///////////////////////////////////////////////////////////////////////////////
+// Bounded queue between threads
+///////////////////////////////////////////////////////////////////////////////
+// bounded_queue_push() blocks while the queue is full and
+// bounded_queue_pop() while it is empty, so a producer that is faster than
+// its consumers is held back to their pace instead of piling up memory.
+// bounded_queue_close() wakes everybody up: pushes then fail, and pops
+// return what is left before they fail too.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct bounded_queue_t {
+    std::mutex lock;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<T> items;
+    size_t capacity = 1;
+    bool closed = false;
+};
+
+template <typename T>
+void bounded_queue_init(bounded_queue_t<T>* queue, size_t capacity)
+{
+    std::lock_guard<std::mutex> guard(queue->lock);
+    queue->items.clear();
+    queue->capacity = (capacity > 0) ? capacity : 1;
+    queue->closed = false;
+}
+
+template <typename T>
+bool bounded_queue_push(bounded_queue_t<T>* queue, const T& item)
+{
+    std::unique_lock<std::mutex> guard(queue->lock);
+    queue->not_full.wait(guard, [queue] { return queue->closed || queue->items.size() < queue->capacity; });
+    if (queue->closed)
+    {
+        return false;
+    }
+    queue->items.push_back(item);
+    guard.unlock();
+    queue->not_empty.notify_one();
+    return true;
+}
+
+template <typename T>
+bool bounded_queue_pop(bounded_queue_t<T>* queue, T* item)
+{
+    std::unique_lock<std::mutex> guard(queue->lock);
+    queue->not_empty.wait(guard, [queue] { return queue->closed || !queue->items.empty(); });
+    if (queue->items.empty())
+    {
+        return false;
+    }
+    *item = queue->items.front();
+    queue->items.pop_front();
+    guard.unlock();
+    queue->not_full.notify_one();
+    return true;
+}
+
+template <typename T>
+void bounded_queue_close(bounded_queue_t<T>* queue)
+{
+    {
+        std::lock_guard<std::mutex> guard(queue->lock);
+        queue->closed = true;
+    }
+    queue->not_empty.notify_all();
+    queue->not_full.notify_all();
+}
+
+#endif
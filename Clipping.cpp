@@ -4,6 +4,8 @@
 #define NUM_PLANES 6
 plane_t frustum_planes[NUM_PLANES];
 
+static clip_stats_t clip_stats = { 0, 0, 0 };
+
 ///////////////////////////////////////////////////////////////////////////////
 // Frustum planes are defined by a point and a normal vector
 ///////////////////////////////////////////////////////////////////////////////
@@ -203,4 +205,160 @@ void clip_polygon(polygon_t* polygon)
     clip_polygon_against_plane(polygon, BOTTOM_FRUSTUM_PLANE);
     clip_polygon_against_plane(polygon, NEAR_FRUSTUM_PLANE);
     clip_polygon_against_plane(polygon, FAR_FRUSTUM_PLANE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Compute the 6-bit outcode of a camera space vertex
+///////////////////////////////////////////////////////////////////////////////
+// A bit is set for every frustum plane the vertex is NOT strictly inside of.
+// The test is the same dot product used by clip_polygon_against_plane(), so
+// a vertex with outcode 0 is kept untouched by the clipper, and a triangle
+// whose three vertices share a bit is removed by it completely.
+///////////////////////////////////////////////////////////////////////////////
+int compute_outcode(vec3_t v)
+{
+    int outcode = 0;
+    for (int plane = 0; plane < NUM_PLANES; plane++)
+    {
+        float dot = vec3_dot(vec3_sub(v, frustum_planes[plane].point), frustum_planes[plane].normal);
+        if (dot <= 0)
+        {
+            outcode |= 1 << plane;
+        }
+    }
+    return outcode;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Decide if a triangle can skip clipping, be discarded, or needs clipping
+///////////////////////////////////////////////////////////////////////////////
+//  OR  == 0 : all vertices inside all planes   -> trivially accepted
+//  AND != 0 : all vertices outside one plane   -> trivially rejected
+//  otherwise: the triangle crosses some plane  -> clip_polygon()
+//
+// The counts go to the caller's stats, so every geometry worker can keep
+// its own and hand them to add_clip_stats() once it is done.
+///////////////////////////////////////////////////////////////////////////////
+int classify_triangle_outcodes(int outcode_a, int outcode_b, int outcode_c, clip_stats_t* stats)
+{
+    if ((outcode_a | outcode_b | outcode_c) == 0)
+    {
+        stats->trivially_accepted++;
+        return CLIP_TRIVIAL_ACCEPT;
+    }
+    if ((outcode_a & outcode_b & outcode_c) != 0)
+    {
+        stats->trivially_rejected++;
+        return CLIP_TRIVIAL_REJECT;
+    }
+    stats->clipped++;
+    return CLIP_NEEDED;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Clip a screen space line to the rectangle [min_x, max_x] x [min_y, max_y]
+///////////////////////////////////////////////////////////////////////////////
+// Cohen-Sutherland: every endpoint gets a 4-bit outcode of the rectangle
+// edges it lies outside of. Lines with both outcodes 0 are kept as they are,
+// lines with both endpoints outside the same edge are dropped, and the rest
+// get the outside endpoint moved onto an edge until one of those two holds.
+// The intersections are computed in doubles and rounded, so endpoints far
+// off screen do not overflow. Returns false when nothing is left to draw.
+///////////////////////////////////////////////////////////////////////////////
+enum {
+    LINE_OUTCODE_LEFT = 1,
+    LINE_OUTCODE_RIGHT = 2,
+    LINE_OUTCODE_TOP = 4,
+    LINE_OUTCODE_BOTTOM = 8
+};
+
+static int compute_line_outcode(int x, int y, int min_x, int min_y, int max_x, int max_y)
+{
+    int outcode = 0;
+    if (x < min_x) outcode |= LINE_OUTCODE_LEFT;
+    else if (x > max_x) outcode |= LINE_OUTCODE_RIGHT;
+    if (y < min_y) outcode |= LINE_OUTCODE_TOP;
+    else if (y > max_y) outcode |= LINE_OUTCODE_BOTTOM;
+    return outcode;
+}
+
+// a + (b - a) * numerator / denominator, rounded to the nearest integer
+static int interpolate_line_coordinate(int a, int b, long long numerator, long long denominator)
+{
+    double t = (double)numerator / (double)denominator;
+    return (int)floor(a + ((double)b - a) * t + 0.5);
+}
+
+bool clip_line_to_rect(int* x0, int* y0, int* x1, int* y1, int min_x, int min_y, int max_x, int max_y)
+{
+    int outcode_0 = compute_line_outcode(*x0, *y0, min_x, min_y, max_x, max_y);
+    int outcode_1 = compute_line_outcode(*x1, *y1, min_x, min_y, max_x, max_y);
+
+    for (;;)
+    {
+        if ((outcode_0 | outcode_1) == 0)
+        {
+            return true;
+        }
+        if ((outcode_0 & outcode_1) != 0)
+        {
+            return false;
+        }
+
+        // Move the endpoint that is outside onto the edge it is outside of
+        int outcode = outcode_0 ? outcode_0 : outcode_1;
+        int x, y;
+        if (outcode & LINE_OUTCODE_TOP)
+        {
+            x = interpolate_line_coordinate(*x0, *x1, (long long)min_y - *y0, (long long)*y1 - *y0);
+            y = min_y;
+        }
+        else if (outcode & LINE_OUTCODE_BOTTOM)
+        {
+            x = interpolate_line_coordinate(*x0, *x1, (long long)max_y - *y0, (long long)*y1 - *y0);
+            y = max_y;
+        }
+        else if (outcode & LINE_OUTCODE_LEFT)
+        {
+            y = interpolate_line_coordinate(*y0, *y1, (long long)min_x - *x0, (long long)*x1 - *x0);
+            x = min_x;
+        }
+        else
+        {
+            y = interpolate_line_coordinate(*y0, *y1, (long long)max_x - *x0, (long long)*x1 - *x0);
+            x = max_x;
+        }
+
+        if (outcode == outcode_0)
+        {
+            *x0 = x;
+            *y0 = y;
+            outcode_0 = compute_line_outcode(x, y, min_x, min_y, max_x, max_y);
+        }
+        else
+        {
+            *x1 = x;
+            *y1 = y;
+            outcode_1 = compute_line_outcode(x, y, min_x, min_y, max_x, max_y);
+        }
+    }
+}
+
+void reset_clip_stats(void)
+{
+    clip_stats.trivially_accepted = 0;
+    clip_stats.trivially_rejected = 0;
+    clip_stats.clipped = 0;
+}
+
+void add_clip_stats(const clip_stats_t* stats)
+{
+    clip_stats.trivially_accepted += stats->trivially_accepted;
+    clip_stats.trivially_rejected += stats->trivially_rejected;
+    clip_stats.clipped += stats->clipped;
+}
+
+clip_stats_t get_clip_stats(void)
+{
+    return clip_stats;
 }
\ No newline at end of file
@@ -16,11 +16,36 @@ enum {
     FAR_FRUSTUM_PLANE
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Outcode bits: one bit per frustum plane the vertex lies outside of
+///////////////////////////////////////////////////////////////////////////////
+enum {
+    OUTCODE_LEFT = 1 << LEFT_FRUSTUM_PLANE,
+    OUTCODE_RIGHT = 1 << RIGHT_FRUSTUM_PLANE,
+    OUTCODE_TOP = 1 << TOP_FRUSTUM_PLANE,
+    OUTCODE_BOTTOM = 1 << BOTTOM_FRUSTUM_PLANE,
+    OUTCODE_NEAR = 1 << NEAR_FRUSTUM_PLANE,
+    OUTCODE_FAR = 1 << FAR_FRUSTUM_PLANE
+};
+
+// Result of the trivial accept/reject test of a triangle
+enum {
+    CLIP_TRIVIAL_ACCEPT,
+    CLIP_TRIVIAL_REJECT,
+    CLIP_NEEDED
+};
+
 typedef struct {
     vec3_t point;
     vec3_t normal;
 } plane_t;
 
+typedef struct {
+    int trivially_accepted;
+    int trivially_rejected;
+    int clipped;
+} clip_stats_t;
+
 void init_frustum_planes(float fov_x, float fov_y, float z_near, float z_far);
 
 typedef struct {
@@ -33,4 +58,13 @@ polygon_t polygon_from_triangle(vec3_t v0, vec3_t v1, vec3_t v2, tex2_t t0, tex2
 void triangles_from_polygon(polygon_t* polygon, triangle_t triangles[], int* num_triangles);
 void clip_polygon(polygon_t* polygon);
 
+int compute_outcode(vec3_t v);
+int classify_triangle_outcodes(int outcode_a, int outcode_b, int outcode_c, clip_stats_t* stats);
+
+bool clip_line_to_rect(int* x0, int* y0, int* x1, int* y1, int min_x, int min_y, int max_x, int max_y);
+
+void reset_clip_stats(void);
+void add_clip_stats(const clip_stats_t* stats);
+clip_stats_t get_clip_stats(void);
+
 #endif
@@ -1,10 +1,82 @@
 #include "Display.h"
+#include "Clipping.h"
+#include "Simd.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
 
 static SDL_Window* window = NULL;
 static SDL_Renderer* renderer = NULL;
 
-static uint32_t* color_buffer = NULL;
-static float* z_buffer = NULL;
+///////////////////////////////////////////////////////////////////////////////
+// Triple-buffered color buffers
+///////////////////////////////////////////////////////////////////////////////
+// SDL renderers and the event pump may only be used from the main thread,
+// so the frames are drawn on a render thread and the main thread presents
+// them. One buffer is drawn into, one is being shown, and the third holds
+// the latest finished frame. Finishing a frame swaps the drawn buffer with
+// the latest one; the main thread swaps the shown buffer with the latest
+// one when it is newer than what it showed. A swap is an index exchange
+// under present_lock, so neither side ever waits for the other to upload
+// or draw: frames that are finished faster than they can be shown are
+// dropped, never queued.
+///////////////////////////////////////////////////////////////////////////////
+#define NUM_COLOR_BUFFERS 3
+#define PRESENT_EVENT_PUMP_MS 2 // longest wait between two event pumps of the main thread
+
+static uint32_t* color_buffers[NUM_COLOR_BUFFERS] = { NULL, NULL, NULL };
+static uint32_t* color_buffer = NULL; // the buffer being drawn into
+static int draw_buffer_index = 0;
+
+static std::mutex present_lock;
+static std::condition_variable frame_finished;
+static int latest_buffer_index = 1;   // under present_lock
+static bool latest_buffer_fresh = false; // under present_lock, the latest buffer has not been shown yet
+static bool frames_done = false;      // under present_lock, the render thread has returned
+
+static uint8_t* z_buffer = NULL; // framebuffer_pixels values of the current depth format
+
+///////////////////////////////////////////////////////////////////////////////
+// Tiled layout
+///////////////////////////////////////////////////////////////////////////////
+// The color buffers and the z-buffer are stored as square tiles of
+// FRAMEBUFFER_TILE_SIZE pixels, one tile after the other, row by row; the
+// pixels inside a tile are row-major. A triangle then touches few cache
+// lines and pages, and a tile row of color is exactly one cache line. The
+// buffers are padded to whole tiles. A color buffer is turned back into rows
+// only when it is uploaded or read back.
+//
+// Lazy clears: each tile has a clear state per color buffer and one for
+// the z-buffer. A lazy clear only marks the tiles that
+// were drawn into as pending, and a pending tile is cleared when something
+// first touches it. Before a frame is handed over to be shown the pending
+// color tiles nobody touched get their clear color; tiles that still hold
+// it from the last time this buffer was used are left alone. An untouched
+// tile thus costs a flag write instead of a clear.
+///////////////////////////////////////////////////////////////////////////////
+static int clear_method = CLEAR_EAGER;
+static bool depth_tested_overlays = true; // wireframe and vertex points hidden behind faces are not drawn
+static int depth_mode = DEPTH_STANDARD;
+static int depth_format = DEPTH_FORMAT_FLOAT32;
+static float depth_near = 0.1f;
+static float depth_far = 100.0f;
+static depth_stats_t depth_stats = { 0, 0 };
+
+// Bytes per z-buffer value of each depth_format
+static const int depth_format_bytes[NUM_DEPTH_FORMATS] = { 4, 3, 2 };
+static int tiles_x = 0;
+static int tiles_y = 0;
+static int framebuffer_pixels = 0; // tiles_x * tiles_y * FRAMEBUFFER_TILE_PIXELS
+static uint8_t* color_tile_states[NUM_COLOR_BUFFERS] = { NULL, NULL, NULL };
+static uint32_t color_buffer_clear_colors[NUM_COLOR_BUFFERS] = { 0, 0, 0 };
+static uint8_t* color_tile_state = NULL; // the tile states of the buffer being drawn into
+static uint8_t* z_tile_state = NULL;
+
+static void allocate_z_buffer(void);
 
 static SDL_Texture* color_buffer_texture = NULL;
 static int window_width = 320;
@@ -23,6 +95,111 @@ int get_window_height(void)
     return window_height;
 }
 
+static inline int get_tile_index(int x, int y)
+{
+    return (y >> FRAMEBUFFER_TILE_SHIFT) * tiles_x + (x >> FRAMEBUFFER_TILE_SHIFT);
+}
+
+// Index of pixel (x,y) in the tiled buffers
+static inline int get_pixel_offset(int x, int y)
+{
+    return get_tiled_pixel_offset(tiles_x, x, y);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy a tiled color buffer into rows of window_width pixels, pitch bytes apart
+///////////////////////////////////////////////////////////////////////////////
+static void linearize_color_buffer(const uint32_t* tiled, uint32_t* rows, int pitch)
+{
+    for (int y = 0; y < window_height; y++)
+    {
+        uint32_t* row = (uint32_t*)((uint8_t*)rows + (size_t)y * pitch);
+        const uint32_t* tile_row = tiled + get_pixel_offset(0, y);
+        for (int x = 0; x < window_width; x += FRAMEBUFFER_TILE_SIZE)
+        {
+            int count = (window_width - x < FRAMEBUFFER_TILE_SIZE) ? window_width - x : FRAMEBUFFER_TILE_SIZE;
+            memcpy(row + x, tile_row, count * sizeof(uint32_t));
+            tile_row += FRAMEBUFFER_TILE_PIXELS;
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Upload a finished frame, turning the tiles back into rows on the way, and
+// show it. Main thread only.
+///////////////////////////////////////////////////////////////////////////////
+static void present_color_buffer(const uint32_t* tiled)
+{
+    void* pixels;
+    int pitch;
+    if (SDL_LockTexture(color_buffer_texture, NULL, &pixels, &pitch) == 0)
+    {
+        linearize_color_buffer(tiled, (uint32_t*)pixels, pitch);
+        SDL_UnlockTexture(color_buffer_texture);
+    }
+    SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Run frame_loop on a render thread and, on this one, which has to be the
+// main thread, pump the SDL events and show the frames it finishes until it
+// returns. The render thread takes its events with SDL_PeepEvents().
+///////////////////////////////////////////////////////////////////////////////
+void run_present_loop(void (*frame_loop)(void))
+{
+    {
+        std::lock_guard<std::mutex> guard(present_lock);
+        frames_done = false;
+    }
+    std::thread render_thread([frame_loop] {
+        frame_loop();
+        {
+            std::lock_guard<std::mutex> guard(present_lock);
+            frames_done = true;
+        }
+        frame_finished.notify_one();
+    });
+
+    int present_buffer_index = 2;
+    for (;;)
+    {
+        SDL_PumpEvents();
+
+        bool fresh = false;
+        bool done = false;
+        {
+            // Wake up for a new frame, or after a while to keep the events flowing
+            std::unique_lock<std::mutex> guard(present_lock);
+            frame_finished.wait_for(guard, std::chrono::milliseconds(PRESENT_EVENT_PUMP_MS), [] {
+                return latest_buffer_fresh || frames_done;
+            });
+            fresh = latest_buffer_fresh;
+            done = frames_done;
+            if (fresh)
+            {
+                int shown = present_buffer_index;
+                present_buffer_index = latest_buffer_index;
+                latest_buffer_index = shown;
+                latest_buffer_fresh = false;
+            }
+        }
+
+        // The render thread does not draw into this buffer until it is swapped back
+        if (fresh)
+        {
+            present_color_buffer(color_buffers[present_buffer_index]);
+        }
+        // The last finished frame is still shown before leaving
+        if (done && !fresh)
+        {
+            break;
+        }
+    }
+
+    render_thread.join();
+}
+
 bool initialize_window(void)
 {
     if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
@@ -58,6 +235,26 @@ bool initialize_window(void)
         return false;
     }
 
+    // Allocate the required memory in bytes to hold the color buffers and the z-buffer, and their tile states
+    tiles_x = (window_width + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+    tiles_y = (window_height + FRAMEBUFFER_TILE_SIZE - 1) / FRAMEBUFFER_TILE_SIZE;
+    framebuffer_pixels = tiles_x * tiles_y * FRAMEBUFFER_TILE_PIXELS;
+    for (int i = 0; i < NUM_COLOR_BUFFERS; i++)
+    {
+        color_buffers[i] = (uint32_t*)simd_aligned_alloc(sizeof(uint32_t) * framebuffer_pixels);
+        simd_fill_u32(color_buffers[i], 0, framebuffer_pixels);
+        color_tile_states[i] = (uint8_t*)malloc(tiles_x * tiles_y);
+        memset(color_tile_states[i], TILE_CLEAN, tiles_x * tiles_y);
+        color_buffer_clear_colors[i] = 0;
+    }
+    draw_buffer_index = 0;
+    color_buffer = color_buffers[draw_buffer_index];
+    color_tile_state = color_tile_states[draw_buffer_index];
+    latest_buffer_index = 1;
+    latest_buffer_fresh = false;
+    z_tile_state = (uint8_t*)malloc(tiles_x * tiles_y);
+    allocate_z_buffer();
+
     // Create a SDL renderer
     renderer = SDL_CreateRenderer(window, -1, 0);
     if (!renderer)
@@ -66,10 +263,6 @@ bool initialize_window(void)
         return false;
     }
 
-    // Allocate the required memory in bytes to hold the color buffer and the z-buffer
-    color_buffer = (uint32_t*)malloc(sizeof(uint32_t) * window_width * window_height);
-    z_buffer = (float*)malloc(sizeof(float) * (window_width + 1) * window_height);
-
     // Creating a SDL texture that is used to display the color buffer
     color_buffer_texture = SDL_CreateTexture(
         renderer,
@@ -97,6 +290,178 @@ bool should_cull_backface(void)
     return cull_method == CULL_BACKFACE;
 }
 
+void set_clear_method(int method)
+{
+    clear_method = method;
+}
+
+int get_clear_method(void)
+{
+    return clear_method;
+}
+
+void set_depth_tested_overlays(bool enabled)
+{
+    depth_tested_overlays = enabled;
+}
+
+bool get_depth_tested_overlays(void)
+{
+    return depth_tested_overlays;
+}
+
+void set_depth_mode(int mode)
+{
+    if (mode != depth_mode && z_tile_state != NULL)
+    {
+        // Clean tiles hold the other mode's clear value
+        memset(z_tile_state, TILE_PENDING, tiles_x * tiles_y);
+    }
+    depth_mode = mode;
+}
+
+int get_depth_mode(void)
+{
+    return depth_mode;
+}
+
+void set_depth_format(int format)
+{
+    if (format == depth_format)
+    {
+        return;
+    }
+    depth_format = format;
+    if (z_buffer != NULL)
+    {
+        allocate_z_buffer();
+    }
+}
+
+int get_depth_format(void)
+{
+    return depth_format;
+}
+
+const char* get_depth_format_name(int format)
+{
+    static const char* names[NUM_DEPTH_FORMATS] = { "float32", "unorm24", "unorm16" };
+    return names[format];
+}
+
+// The unorm formats store 1/w remapped to [0, 1] over this range
+void set_depth_range(float znear, float zfar)
+{
+    depth_near = znear;
+    depth_far = zfar;
+}
+
+void get_depth_range(float* znear, float* zfar)
+{
+    *znear = depth_near;
+    *zfar = depth_far;
+}
+
+void reset_depth_stats(void)
+{
+    depth_stats = { 0, 0 };
+}
+
+depth_stats_t get_depth_stats(void)
+{
+    return depth_stats;
+}
+
+static inline float get_z_clear_value(void)
+{
+    return (depth_mode == DEPTH_REVERSED_Z) ? 0.0f : 1.0f;
+}
+
+// Cleared unorm values are all zero bits (reversed-Z) or all one bits (the farthest value)
+static inline uint8_t get_z_clear_byte(void)
+{
+    return (depth_mode == DEPTH_REVERSED_Z) ? 0x00 : 0xFF;
+}
+
+static void fill_tile(uint32_t* buffer, int tile, uint32_t value)
+{
+    uint32_t* pixels = buffer + tile * FRAMEBUFFER_TILE_PIXELS;
+    for (int i = 0; i < FRAMEBUFFER_TILE_PIXELS; i++)
+    {
+        pixels[i] = value;
+    }
+}
+
+// First write to a tile since the last clear: clear it now if the clear was deferred
+static void touch_tile(uint8_t* state, int tile, uint32_t* buffer, uint32_t clear_value)
+{
+    if (*state == TILE_PENDING)
+    {
+        fill_tile(buffer, tile, clear_value);
+    }
+    *state = TILE_DIRTY;
+}
+
+// Lazy clear: only the tiles drawn into since their last clear need one
+static void mark_dirty_tiles_pending(uint8_t* states)
+{
+    for (int tile = 0; tile < tiles_x * tiles_y; tile++)
+    {
+        if (states[tile] == TILE_DIRTY)
+        {
+            states[tile] = TILE_PENDING;
+        }
+    }
+}
+
+static uint32_t get_z_clear_bits(void)
+{
+    if (depth_format != DEPTH_FORMAT_FLOAT32)
+    {
+        return get_z_clear_byte() * 0x01010101u;
+    }
+    float z_clear = get_z_clear_value();
+    uint32_t bits;
+    memcpy(&bits, &z_clear, sizeof(bits));
+    return bits;
+}
+
+static void fill_z_tile(int tile)
+{
+    int bytes = depth_format_bytes[depth_format];
+    if (depth_format == DEPTH_FORMAT_FLOAT32)
+    {
+        fill_tile((uint32_t*)z_buffer, tile, get_z_clear_bits());
+    }
+    else
+    {
+        memset(z_buffer + tile * FRAMEBUFFER_TILE_PIXELS * bytes, get_z_clear_byte(), FRAMEBUFFER_TILE_PIXELS * bytes);
+    }
+    depth_stats.bytes_written += FRAMEBUFFER_TILE_PIXELS * bytes;
+}
+
+static void touch_z_tile(int tile)
+{
+    if (z_tile_state[tile] == TILE_PENDING)
+    {
+        fill_z_tile(tile);
+    }
+    z_tile_state[tile] = TILE_DIRTY;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// (Re)allocate the z-buffer for the current depth format. Padded to whole
+// 32-bit words so the fill never has to deal with a partial last word.
+///////////////////////////////////////////////////////////////////////////////
+static void allocate_z_buffer(void)
+{
+    simd_aligned_free(z_buffer);
+    size_t words = ((size_t)framebuffer_pixels * depth_format_bytes[depth_format] + 3) / 4;
+    z_buffer = (uint8_t*)simd_aligned_alloc(words * 4);
+    memset(z_tile_state, TILE_PENDING, tiles_x * tiles_y);
+    clear_z_buffer();
+}
+
 bool should_render_textured_triangles(void)
 {
     return (
@@ -136,38 +501,70 @@ void draw_grid(void)
     {
         for (int x = 0; x < window_width; x += 10) 
         {
-            color_buffer[(window_width * y) + x] = 0xFF444444;
+            draw_pixel(x, y, 0xFF444444);
         }
     }
 }
 
+// Write a pixel known to be on the screen
+static inline void plot_pixel(int x, int y, uint32_t color)
+{
+    int tile = get_tile_index(x, y);
+    if (color_tile_state[tile] != TILE_DIRTY)
+    {
+        touch_tile(&color_tile_state[tile], tile, color_buffer, color_buffer_clear_colors[draw_buffer_index]);
+    }
+    color_buffer[get_pixel_offset(x, y)] = color;
+}
+
 void draw_pixel(int x, int y, uint32_t color)
 {
     if (x < 0 || x >= window_width || y < 0 || y >= window_height) 
     {
         return;
     }
-    color_buffer[(window_width * y) + x] = color;
+    plot_pixel(x, y, color);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Draw a line with Bresenham's algorithm
+///////////////////////////////////////////////////////////////////////////////
+// The line is clipped to the screen first, so lines of geometry off screen
+// cost nothing and the loop needs no bounds checks. The error term is
+// integer: per pixel one add, one compare and a step along the minor axis
+// when the error crosses zero.
+///////////////////////////////////////////////////////////////////////////////
 void draw_line(int x0, int y0, int x1, int y1, uint32_t color)
 {
-    int delta_x = (x1 - x0);
-    int delta_y = (y1 - y0);
-
-    int longest_side_length = (abs(delta_x) >= abs(delta_y)) ? abs(delta_x) : abs(delta_y);
-
-    float x_inc = (float)delta_x / (float)longest_side_length;
-    float y_inc = (float)delta_y / (float)longest_side_length;
+    if (!clip_line_to_rect(&x0, &y0, &x1, &y1, 0, 0, window_width - 1, window_height - 1))
+    {
+        return;
+    }
 
-    float current_x = x0;
-    float current_y = y0;
+    int delta_x = abs(x1 - x0);
+    int delta_y = -abs(y1 - y0);
+    int step_x = (x0 < x1) ? 1 : -1;
+    int step_y = (y0 < y1) ? 1 : -1;
+    int error = delta_x + delta_y;
 
-    for (int i = 0; i <= longest_side_length; i++) 
+    for (;;)
     {
-        draw_pixel(round(current_x), round(current_y), color);
-        current_x += x_inc;
-        current_y += y_inc;
+        plot_pixel(x0, y0, color);
+        if (x0 == x1 && y0 == y1)
+        {
+            break;
+        }
+        int error_2 = 2 * error;
+        if (error_2 >= delta_y)
+        {
+            error += delta_y;
+            x0 += step_x;
+        }
+        if (error_2 <= delta_x)
+        {
+            error += delta_x;
+            y0 += step_y;
+        }
     }
 }
 
@@ -184,40 +581,99 @@ void draw_rect(int x, int y, int width, int height, uint32_t color)
     }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Hand the finished frame over to the main thread and continue drawing in
+// the buffer it gives back. Does not wait for the upload or for vsync.
+///////////////////////////////////////////////////////////////////////////////
+// Tiles left pending by a lazy clear still need the clear color before the frame leaves the renderer
+static void resolve_pending_color_tiles(void)
+{
+    for (int tile = 0; tile < tiles_x * tiles_y; tile++)
+    {
+        if (color_tile_state[tile] == TILE_PENDING)
+        {
+            fill_tile(color_buffer, tile, color_buffer_clear_colors[draw_buffer_index]);
+            color_tile_state[tile] = TILE_CLEAN;
+        }
+    }
+}
+
 void render_color_buffer(void)
 {
-    SDL_UpdateTexture(
-        color_buffer_texture,
-        NULL,
-        color_buffer,
-        (int)(window_width * sizeof(uint32_t))
-    );
-    SDL_RenderCopy(renderer, color_buffer_texture, NULL, NULL);
-    SDL_RenderPresent(renderer);
+    resolve_pending_color_tiles();
+
+    {
+        std::lock_guard<std::mutex> guard(present_lock);
+        int finished = draw_buffer_index;
+        draw_buffer_index = latest_buffer_index;
+        latest_buffer_index = finished;
+        latest_buffer_fresh = true;
+    }
+    frame_finished.notify_one();
+
+    color_buffer = color_buffers[draw_buffer_index];
+    color_tile_state = color_tile_states[draw_buffer_index];
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copy the frame drawn so far into rows of get_window_width() pixels, pitch
+// bytes apart, without going through SDL. Call it before render_color_buffer().
+///////////////////////////////////////////////////////////////////////////////
+void read_color_buffer(uint32_t* rows, int pitch)
+{
+    resolve_pending_color_tiles();
+    linearize_color_buffer(color_buffer, rows, pitch);
 }
 
 void clear_color_buffer(uint32_t color)
 {
-    for (int i = 0; i < window_width * window_height; i++) 
+    uint32_t* clear_color = &color_buffer_clear_colors[draw_buffer_index];
+    if (clear_method == CLEAR_LAZY)
     {
-        color_buffer[i] = color;
+        if (color == *clear_color)
+        {
+            mark_dirty_tiles_pending(color_tile_state);
+        }
+        else
+        {
+            // Clean tiles hold the old clear color
+            memset(color_tile_state, TILE_PENDING, tiles_x * tiles_y);
+            *clear_color = color;
+        }
+        return;
     }
+
+    simd_fill_u32(color_buffer, color, framebuffer_pixels);
+    memset(color_tile_state, TILE_CLEAN, tiles_x * tiles_y);
+    *clear_color = color;
 }
 
 void clear_z_buffer(void) {
-    for (int i = 0; i < (window_width + 1) * window_height; i++)
+    if (clear_method == CLEAR_LAZY)
     {
-        z_buffer[i] = 1.0;
+        mark_dirty_tiles_pending(z_tile_state);
+        return;
     }
+
+    size_t bytes = (size_t)framebuffer_pixels * depth_format_bytes[depth_format];
+    simd_fill_u32((uint32_t*)z_buffer, get_z_clear_bits(), (bytes + 3) / 4);
+    memset(z_tile_state, TILE_CLEAN, tiles_x * tiles_y);
+    depth_stats.bytes_written += bytes;
 }
 
 float get_zbuffer_at(int x, int y)
 {
     if (x < 0 || x >= window_width || y < 0 || y >= window_height)
     {
-        return 1.0;
+        return get_z_clear_value();
     }
-    return z_buffer[(window_width * y) + x];
+    if (z_tile_state[get_tile_index(x, y)] == TILE_PENDING)
+    {
+        // Not cleared yet, but reads as cleared
+        return get_z_clear_value();
+    }
+    depth_stats.bytes_read += sizeof(float);
+    return ((float*)z_buffer)[get_pixel_offset(x, y)];
 }
 
 void update_zbuffer_at(int x, int y, float value)
@@ -226,14 +682,117 @@ void update_zbuffer_at(int x, int y, float value)
     {
         return;
     }
-    z_buffer[(window_width * y) + x] = value;
+    int tile = get_tile_index(x, y);
+    if (z_tile_state[tile] != TILE_DIRTY)
+    {
+        touch_z_tile(tile);
+    }
+    depth_stats.bytes_written += sizeof(float);
+    ((float*)z_buffer)[get_pixel_offset(x, y)] = value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Unsigned normalized depth, out of the tiles' raster path
+///////////////////////////////////////////////////////////////////////////////
+template <int format>
+uint32_t get_zbuffer_unorm_at(int x, int y)
+{
+    const int bytes = depth_format_info<format>::bytes;
+    const uint32_t clear_value = (depth_mode == DEPTH_REVERSED_Z) ? 0 : (1u << (bytes * 8)) - 1;
+
+    if (x < 0 || x >= window_width || y < 0 || y >= window_height)
+    {
+        return clear_value;
+    }
+    if (z_tile_state[get_tile_index(x, y)] == TILE_PENDING)
+    {
+        return clear_value;
+    }
+    depth_stats.bytes_read += bytes;
+    return load_depth_value<format>(z_buffer + get_pixel_offset(x, y) * bytes);
+}
+
+template <int format>
+void update_zbuffer_unorm_at(int x, int y, uint32_t value)
+{
+    const int bytes = depth_format_info<format>::bytes;
+
+    if (x < 0 || x >= window_width || y < 0 || y >= window_height)
+    {
+        return;
+    }
+    int tile = get_tile_index(x, y);
+    if (z_tile_state[tile] != TILE_DIRTY)
+    {
+        touch_z_tile(tile);
+    }
+    depth_stats.bytes_written += bytes;
+    store_depth_value<format>(z_buffer + get_pixel_offset(x, y) * bytes, value);
+}
+
+template uint32_t get_zbuffer_unorm_at<DEPTH_FORMAT_UNORM24>(int x, int y);
+template uint32_t get_zbuffer_unorm_at<DEPTH_FORMAT_UNORM16>(int x, int y);
+template void update_zbuffer_unorm_at<DEPTH_FORMAT_UNORM24>(int x, int y, uint32_t value);
+template void update_zbuffer_unorm_at<DEPTH_FORMAT_UNORM16>(int x, int y, uint32_t value);
+
+///////////////////////////////////////////////////////////////////////////////
+// Raster target: the buffers being drawn into, handed out once per triangle
+///////////////////////////////////////////////////////////////////////////////
+raster_target_t begin_raster_target(void)
+{
+    raster_target_t target;
+    target.color = color_buffer;
+    target.depth = z_buffer;
+    target.color_tile_state = color_tile_state;
+    target.z_tile_state = z_tile_state;
+    target.tiles_x = tiles_x;
+    target.width = window_width;
+    target.height = window_height;
+    target.depth_tests = 0;
+    target.depth_writes = 0;
+    return target;
+}
+
+void end_raster_target(const raster_target_t* target)
+{
+    int bytes = depth_format_bytes[depth_format];
+    depth_stats.bytes_read += target->depth_tests * bytes;
+    depth_stats.bytes_written += target->depth_writes * bytes;
+}
+
+// Called by prepare_raster_tile() for a tile whose color or depth is not drawn into yet
+void prepare_raster_tile_slow(int tile)
+{
+    if (color_tile_state[tile] != TILE_DIRTY)
+    {
+        touch_tile(&color_tile_state[tile], tile, color_buffer, color_buffer_clear_colors[draw_buffer_index]);
+    }
+    if (z_tile_state[tile] != TILE_DIRTY)
+    {
+        touch_z_tile(tile);
+    }
 }
 
 void destroy_window(void)
 {
-    free(color_buffer);
-    free(z_buffer);
+    SDL_DestroyTexture(color_buffer_texture);
     SDL_DestroyRenderer(renderer);
+    color_buffer_texture = NULL;
+    renderer = NULL;
+
+    for (int i = 0; i < NUM_COLOR_BUFFERS; i++)
+    {
+        simd_aligned_free(color_buffers[i]);
+        free(color_tile_states[i]);
+        color_buffers[i] = NULL;
+        color_tile_states[i] = NULL;
+    }
+    color_buffer = NULL;
+    color_tile_state = NULL;
+    simd_aligned_free(z_buffer);
+    free(z_tile_state);
+    z_buffer = NULL;
+    z_tile_state = NULL;
     SDL_DestroyWindow(window);
     SDL_Quit();
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <SDL.h>
 
 #undef main // To maae C++ work fine
@@ -16,6 +17,29 @@ enum cull_method {
     CULL_BACKFACE
 };
 
+enum clear_method {
+    CLEAR_EAGER, // clear the whole buffers every frame
+    CLEAR_LAZY   // clear each tile when it is first drawn to
+};
+
+enum depth_mode {
+    DEPTH_STANDARD,  // store 1 - 1/w, clear to 1, nearer is smaller
+    DEPTH_REVERSED_Z // store 1/w, clear to 0, nearer is bigger
+};
+
+enum depth_format {
+    DEPTH_FORMAT_FLOAT32, // 32-bit float, the depth as computed
+    DEPTH_FORMAT_UNORM24, // 24-bit unsigned normalized, packed in 3 bytes
+    DEPTH_FORMAT_UNORM16, // 16-bit unsigned normalized
+    NUM_DEPTH_FORMATS
+};
+
+// Z-buffer memory traffic since the last reset
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} depth_stats_t;
+
 enum render_method {
     RENDER_WIRE,
     RENDER_WIRE_VERTEX,
@@ -26,12 +50,26 @@ enum render_method {
 };
 
 bool initialize_window(void);
+void run_present_loop(void (*frame_loop)(void));
 int get_window_width(void);
 int get_window_height(void);
 
 void set_render_method(int method);
 void set_cull_method(int method);
 bool should_cull_backface(void);
+void set_clear_method(int method);
+int get_clear_method(void);
+void set_depth_tested_overlays(bool enabled);
+bool get_depth_tested_overlays(void);
+void set_depth_mode(int mode);
+int get_depth_mode(void);
+void set_depth_format(int format);
+int get_depth_format(void);
+const char* get_depth_format_name(int format);
+void set_depth_range(float znear, float zfar);
+void get_depth_range(float* znear, float* zfar);
+void reset_depth_stats(void);
+depth_stats_t get_depth_stats(void);
 
 bool should_render_textured_triangles(void);
 bool should_render_wireframe(void);
@@ -44,11 +82,143 @@ void draw_line(int x0, int y0, int x1, int y1, uint32_t color);
 void draw_rect(int x, int y, int width, int height, uint32_t color);
 
 void render_color_buffer(void);
+void read_color_buffer(uint32_t* rows, int pitch);
 void clear_color_buffer(uint32_t color);
 void clear_z_buffer(void);
 
+///////////////////////////////////////////////////////////////////////////////
+// Safe per-pixel access, bounds checked, for the overlays (grid, wireframe,
+// vertex points)
+///////////////////////////////////////////////////////////////////////////////
+// DEPTH_FORMAT_FLOAT32
 float get_zbuffer_at(int x, int y);
 void update_zbuffer_at(int x, int y, float value);
+
+// DEPTH_FORMAT_UNORM24 and DEPTH_FORMAT_UNORM16, instantiated for those two
+template <int format> uint32_t get_zbuffer_unorm_at(int x, int y);
+template <int format> void update_zbuffer_unorm_at(int x, int y, uint32_t value);
+
+///////////////////////////////////////////////////////////////////////////////
+// Raster target: direct access to the buffers being drawn into, for the
+// inner loops of the rasterizers
+///////////////////////////////////////////////////////////////////////////////
+// The color and z-buffers are stored as square tiles, one after the other,
+// with the pixels of a tile row-major: a tile row is a run of
+// FRAMEBUFFER_TILE_SIZE consecutive pixels, and the next row of the tile is
+// FRAMEBUFFER_TILE_SIZE pixels further. Nothing is bounds checked: callers
+// clip to [0, width) x [0, height) once per triangle, and call
+// prepare_raster_tile() for a tile before writing to it (it applies the
+// lazy clear). end_raster_target() adds the depth traffic to the stats.
+///////////////////////////////////////////////////////////////////////////////
+#define FRAMEBUFFER_TILE_SIZE 16
+#define FRAMEBUFFER_TILE_SHIFT 4 // log2(FRAMEBUFFER_TILE_SIZE)
+#define FRAMEBUFFER_TILE_PIXELS (FRAMEBUFFER_TILE_SIZE * FRAMEBUFFER_TILE_SIZE)
+
+enum tile_state {
+    TILE_CLEAN,   // holds the clear value
+    TILE_PENDING, // must be cleared before it is used
+    TILE_DIRTY    // drawn into since the last clear
+};
+
+typedef struct {
+    uint32_t* color;
+    uint8_t* depth; // values of the current depth format
+    uint8_t* color_tile_state;
+    uint8_t* z_tile_state;
+    int tiles_x;
+    int width;
+    int height;
+    uint64_t depth_tests;
+    uint64_t depth_writes;
+} raster_target_t;
+
+raster_target_t begin_raster_target(void);
+void end_raster_target(const raster_target_t* target);
+void prepare_raster_tile_slow(int tile);
+
+// Index of pixel (x,y) in the tiled buffers
+static inline int get_tiled_pixel_offset(int tiles_x, int x, int y)
+{
+    int tile = (y >> FRAMEBUFFER_TILE_SHIFT) * tiles_x + (x >> FRAMEBUFFER_TILE_SHIFT);
+    return (tile << (2 * FRAMEBUFFER_TILE_SHIFT))
+        + ((y & (FRAMEBUFFER_TILE_SIZE - 1)) << FRAMEBUFFER_TILE_SHIFT)
+        + (x & (FRAMEBUFFER_TILE_SIZE - 1));
+}
+
+static inline void prepare_raster_tile(const raster_target_t* target, int tile)
+{
+    if (target->color_tile_state[tile] != TILE_DIRTY || target->z_tile_state[tile] != TILE_DIRTY)
+    {
+        prepare_raster_tile_slow(tile);
+    }
+}
+
+// Depth values as stored: float, or unsigned normalized in 2 or 3 little endian bytes
+template <int format>
+struct depth_format_info;
+
+template <>
+struct depth_format_info<DEPTH_FORMAT_FLOAT32>
+{
+    typedef float value_t;
+    static const int bytes = 4;
+};
+
+template <>
+struct depth_format_info<DEPTH_FORMAT_UNORM24>
+{
+    typedef uint32_t value_t;
+    static const int bytes = 3;
+};
+
+template <>
+struct depth_format_info<DEPTH_FORMAT_UNORM16>
+{
+    typedef uint32_t value_t;
+    static const int bytes = 2;
+};
+
+template <int format>
+static inline typename depth_format_info<format>::value_t load_depth_value(const uint8_t* p)
+{
+    if constexpr (format == DEPTH_FORMAT_UNORM24)
+    {
+        return p[0] | (p[1] << 8) | (p[2] << 16);
+    }
+    else if constexpr (format == DEPTH_FORMAT_UNORM16)
+    {
+        uint16_t value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+    else
+    {
+        float value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+}
+
+template <int format>
+static inline void store_depth_value(uint8_t* p, typename depth_format_info<format>::value_t value)
+{
+    if constexpr (format == DEPTH_FORMAT_UNORM24)
+    {
+        p[0] = (uint8_t)value;
+        p[1] = (uint8_t)(value >> 8);
+        p[2] = (uint8_t)(value >> 16);
+    }
+    else if constexpr (format == DEPTH_FORMAT_UNORM16)
+    {
+        uint16_t v = (uint16_t)value;
+        memcpy(p, &v, sizeof(v));
+    }
+    else
+    {
+        memcpy(p, &value, sizeof(value));
+    }
+}
+
 void destroy_window(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,233 @@
+#include "FrameRecorder.h"
+#include "BoundedQueue.h"
+#include "Display.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Frame recording
+///////////////////////////////////////////////////////////////////////////////
+// record_frame() copies the finished frame out of the color buffer into a
+// free frame buffer and queues it; a pool of encoder threads turns the
+// queued frames into PNG files. The frame buffers go round between two
+// bounded queues (free and queued), so nothing is allocated per frame, and
+// when the encoders fall behind, record_frame() waits for a free buffer:
+// the rendering slows down to the encoding speed instead of queueing up
+// frames without limit. The files are named by frame number, so the
+// encoders may finish them in any order.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int index;
+    uint32_t* pixels; // width * height, row-major ARGB
+} recorded_frame_t;
+
+typedef struct {
+    int frames;
+    uint64_t bytes;
+    uint64_t encode_time; // performance counter ticks, all encoders
+} recording_stats_t;
+
+static frame_recorder_settings_t recorder_settings;
+static bool recording = false;
+static int recorded_width = 0;
+static int recorded_height = 0;
+static int next_frame_index = 0;
+
+static bounded_queue_t<recorded_frame_t> queued_frames;
+static bounded_queue_t<uint32_t*> free_frame_buffers;
+static std::vector<uint32_t*> frame_buffers;
+static std::vector<std::thread> encoders;
+
+static std::mutex stats_lock;
+static recording_stats_t recording_stats = { 0, 0, 0 };
+
+void init_frame_recorder_settings(frame_recorder_settings_t* settings)
+{
+    settings->directory = ".";
+    settings->num_encoders = 0;
+    settings->queue_length = 4;
+    settings->filter_strategy = LFS_MINSUM;
+    lodepng_compress_settings_init(&settings->compress);
+}
+
+static unsigned encode_frame(const recorded_frame_t* frame, unsigned char* rgb, const char* filename, size_t* png_size)
+{
+    // The color buffer is ARGB with an opaque alpha, the PNG gets RGB
+    size_t num_pixels = (size_t)recorded_width * recorded_height;
+    for (size_t i = 0; i < num_pixels; i++)
+    {
+        uint32_t color = frame->pixels[i];
+        rgb[i * 3 + 0] = (unsigned char)(color >> 16);
+        rgb[i * 3 + 1] = (unsigned char)(color >> 8);
+        rgb[i * 3 + 2] = (unsigned char)color;
+    }
+
+    LodePNGState state;
+    lodepng_state_init(&state);
+    state.info_raw.colortype = LCT_RGB;
+    state.info_raw.bitdepth = 8;
+    state.info_png.color.colortype = LCT_RGB;
+    state.info_png.color.bitdepth = 8;
+    state.encoder.auto_convert = 0; // the color statistics would cost a pass over every frame
+    state.encoder.filter_strategy = recorder_settings.filter_strategy;
+    state.encoder.zlibsettings = recorder_settings.compress;
+
+    unsigned char* png = NULL;
+    *png_size = 0;
+    unsigned error = lodepng_encode(&png, png_size, rgb, recorded_width, recorded_height, &state);
+    if (!error)
+    {
+        error = lodepng_save_file(png, *png_size, filename);
+    }
+
+    free(png);
+    lodepng_state_cleanup(&state);
+    return error;
+}
+
+static void encoder_main(void)
+{
+    std::vector<unsigned char> rgb((size_t)recorded_width * recorded_height * 3);
+    char filename[1024];
+
+    recorded_frame_t frame;
+    while (bounded_queue_pop(&queued_frames, &frame))
+    {
+        snprintf(filename, sizeof(filename), "%s/frame_%05d.png", recorder_settings.directory, frame.index);
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        size_t png_size;
+        unsigned error = encode_frame(&frame, rgb.data(), filename, &png_size);
+        uint64_t encode_time = SDL_GetPerformanceCounter() - start;
+
+        bounded_queue_push(&free_frame_buffers, frame.pixels);
+
+        if (error)
+        {
+            fprintf(stderr, "Error writing %s: %s\n", filename, lodepng_error_text(error));
+            continue;
+        }
+        std::lock_guard<std::mutex> guard(stats_lock);
+        recording_stats.frames++;
+        recording_stats.bytes += png_size;
+        recording_stats.encode_time += encode_time;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start writing every frame passed to record_frame() as a PNG file
+///////////////////////////////////////////////////////////////////////////////
+bool start_frame_recording(const frame_recorder_settings_t* settings)
+{
+    if (recording)
+    {
+        stop_frame_recording();
+    }
+
+    recorder_settings = *settings;
+    recorded_width = get_window_width();
+    recorded_height = get_window_height();
+    next_frame_index = 0;
+    recording_stats = { 0, 0, 0 };
+
+    int num_encoders = settings->num_encoders;
+    if (num_encoders <= 0)
+    {
+        num_encoders = (int)std::thread::hardware_concurrency() / 2;
+    }
+    if (num_encoders <= 0)
+    {
+        num_encoders = 1;
+    }
+    int queue_length = (settings->queue_length > 0) ? settings->queue_length : 1;
+
+    // Enough buffers for a full queue and one frame in every encoder
+    int num_buffers = queue_length + num_encoders;
+    bounded_queue_init(&queued_frames, queue_length);
+    bounded_queue_init(&free_frame_buffers, num_buffers);
+    for (int i = 0; i < num_buffers; i++)
+    {
+        uint32_t* pixels = (uint32_t*)malloc((size_t)recorded_width * recorded_height * sizeof(uint32_t));
+        if (!pixels)
+        {
+            fprintf(stderr, "Error allocating the frame recording buffers.\n");
+            for (size_t j = 0; j < frame_buffers.size(); j++)
+            {
+                free(frame_buffers[j]);
+            }
+            frame_buffers.clear();
+            return false;
+        }
+        frame_buffers.push_back(pixels);
+        bounded_queue_push(&free_frame_buffers, pixels);
+    }
+
+    for (int i = 0; i < num_encoders; i++)
+    {
+        encoders.emplace_back(encoder_main);
+    }
+
+    printf("Recording frames to %s with %d encoder threads\n", settings->directory, num_encoders);
+    recording = true;
+    return true;
+}
+
+bool is_recording_frames(void)
+{
+    return recording;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Queue the frame drawn so far for encoding. Call it before
+// render_color_buffer(); blocks while all frame buffers are in use.
+///////////////////////////////////////////////////////////////////////////////
+void record_frame(void)
+{
+    if (!recording)
+    {
+        return;
+    }
+
+    recorded_frame_t frame;
+    if (!bounded_queue_pop(&free_frame_buffers, &frame.pixels))
+    {
+        return;
+    }
+    frame.index = next_frame_index++;
+    read_color_buffer(frame.pixels, recorded_width * sizeof(uint32_t));
+    bounded_queue_push(&queued_frames, frame);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Wait until every queued frame is written, then stop the encoders
+///////////////////////////////////////////////////////////////////////////////
+void stop_frame_recording(void)
+{
+    if (!recording)
+    {
+        return;
+    }
+
+    bounded_queue_close(&queued_frames);
+    for (size_t i = 0; i < encoders.size(); i++)
+    {
+        encoders[i].join();
+    }
+    encoders.clear();
+    bounded_queue_close(&free_frame_buffers);
+
+    for (size_t i = 0; i < frame_buffers.size(); i++)
+    {
+        free(frame_buffers[i]);
+    }
+    frame_buffers.clear();
+    recording = false;
+
+    double encode_ms = recording_stats.frames > 0 ?
+        (double)recording_stats.encode_time * 1000.0 / SDL_GetPerformanceFrequency() / recording_stats.frames : 0.0;
+    printf("Recorded %d frames, %.2f MB, %.2f ms to encode a frame\n",
+        recording_stats.frames, recording_stats.bytes / (1024.0 * 1024.0), encode_ms);
+}
@@ -0,0 +1,22 @@
+#ifndef FRAME_RECORDER_H
+#define FRAME_RECORDER_H
+
+#include <stdbool.h>
+#include "lodepng.h"
+
+typedef struct {
+    const char* directory;                 // frames go to <directory>/frame_00000.png, ...
+    int num_encoders;                      // encoder threads, 0 picks half of the hardware threads
+    int queue_length;                      // frames waiting for an encoder before rendering blocks
+    LodePNGFilterStrategy filter_strategy; // per scanline PNG filter choice
+    LodePNGCompressSettings compress;      // deflate settings: window size, matching, block type
+} frame_recorder_settings_t;
+
+void init_frame_recorder_settings(frame_recorder_settings_t* settings);
+
+bool start_frame_recording(const frame_recorder_settings_t* settings);
+bool is_recording_frames(void);
+void record_frame(void);
+void stop_frame_recording(void);
+
+#endif
@@ -9,18 +9,24 @@
 #include "Light.h"
 #include "lodepng.h"
 #include "Texture.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "AssetLoader.h"
+#include "TextureAtlas.h"
+#include "Wireframe.h"
+#include "FrameRecorder.h"
+#include "VideoStream.h"
+#include "PngBenchmark.h"
+
+#include <string.h>
+#include <algorithm>
 
 bool is_running = false;
 
-#define MAX_TRIANGLES_PER_MESH 10000
-triangle_t static_triangles_to_render[MAX_TRIANGLES_PER_MESH];
-int num_static_triangles_to_render = 0;
-
 ///////////////////////////////////////////////////////////////////////////////
 // Declaration of our global transformation matrices
 ///////////////////////////////////////////////////////////////////////////////
 vec3_t origin = { 0, 0, 0 };
-mat4_t world_matrix;
 mat4_t proj_matrix;
 mat4_t view_matrix;
 
@@ -29,8 +35,86 @@ mat4_t view_matrix;
 uint32_t previous_frame_time = 0;
 float delta_time = 0;
 
+///////////////////////////////////////////////////////////////////////////////
+// Frame pipelining
+///////////////////////////////////////////////////////////////////////////////
+// In pipelined mode the geometry of frame N+1 is built on a background
+// thread while the main thread rasterizes frame N, so a frame costs about
+// max(geometry, raster) instead of their sum, for one more frame between
+// the input and the picture. The two triangle lists swap roles every frame.
+// Input, camera and meshes are only changed between frames, when no
+// geometry is in flight.
+///////////////////////////////////////////////////////////////////////////////
+static bool pipelined_frames = false;
+static bool show_frame_stats = false; // print the frame stats line once per second
+static std::vector<triangle_t> triangle_lists[2];
+static uint64_t triangle_list_input_time[2]; // when the input a list was built from was sampled
+static int raster_list = 0; // the list rasterized this frame, the geometry fills the other one when pipelined
+
+typedef struct {
+    int frames;
+    uint64_t frame_time;   // update and render, without the wait for the target frame time
+    uint64_t latency;      // input sampled -> frame handed over to be shown
+    uint32_t report_ticks;
+    clip_stats_t clips;    // summed over the frames, of the lists that were built
+} frame_stats_t;
+
+static frame_stats_t frame_stats = {};
+
+// Start counting the stats anew from ticks
+static void reset_frame_stats(uint32_t ticks)
+{
+    frame_stats = {};
+    frame_stats.report_ticks = ticks;
+}
+
+static uint64_t frame_start_time = 0;
+
+// Render-to-file mode, set up from the command line
+static frame_recorder_settings_t record_settings;
+static bool record_requested = false;
+static int frames_to_record = 0; // stop after that many frames, 0 records until the window is closed
+static int recorded_frames = 0;
+static const char* stream_path = NULL; // raw video stream, "-" for stdout
+static int stream_format = VIDEO_STREAM_Y4M;
+
+// PNG decoding benchmark instead of the renderer
+static const char* bench_png_path = NULL;
+static int bench_iterations = 20;
+
+// Extra mesh_load_flags for the scene, from the command line
+static int scene_load_flags = MESH_LOAD_DEFAULT;
+
+// Pack the small textures into an atlas once the scene is loaded
+static bool atlas_requested = false;
+static texture_atlas_settings_t atlas_settings;
+
+static const float fov_y = M_PI / 3.0; // the same as 180/3, or 60deg
+static const float znear = 0.1;
+static const float zfar = 100.0;
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the projection matrix for the current depth mode
+///////////////////////////////////////////////////////////////////////////////
+void init_projection(void)
+{
+    float aspect_y = (float)get_window_height() / (float)get_window_width();
+    if (get_depth_mode() == DEPTH_REVERSED_Z)
+    {
+        proj_matrix = mat4_make_perspective_reversed_z(fov_y, aspect_y, znear, zfar);
+    }
+    else
+    {
+        proj_matrix = mat4_make_perspective(fov_y, aspect_y, znear, zfar);
+    }
+}
+
 void setup(void)
 {
+    // Start the workers of the geometry stage and the asset loaders
+    init_thread_pool(0);
+    start_asset_loader(0);
+
     // Initialize render mode and triangle culling method
     set_render_method(RENDER_WIRE);
     set_cull_method(CULL_BACKFACE);
@@ -38,16 +122,13 @@ void setup(void)
     // Initialize the scene light direction
     init_light(vec3_new(0, 0, 1));
 
-    // Initialize the perspective projection matrix
-    float aspect_y = (float)get_window_height() / (float)get_window_width();
-    float aspect_x = (float)get_window_width() / (float)get_window_height();
-    float fov_y = M_PI / 3.0; // the same as 180/3, or 60deg
-    float fov_x = atan(tan(fov_y / 2) * aspect_x) * 2;
-    float znear = 0.1;
-    float zfar = 100.0;
-    proj_matrix = mat4_make_perspective(fov_y, aspect_y, znear, zfar);
+    // Initialize the perspective projection matrix and the depth range the compact z-buffer formats cover
+    init_projection();
+    set_depth_range(znear, zfar);
 
     // Initialize frustum planes with a point and a normal
+    float aspect_x = (float)get_window_width() / (float)get_window_height();
+    float fov_x = atan(tan(fov_y / 2) * aspect_x) * 2;
     init_frustum_planes(fov_x, fov_y, znear, zfar);
 
     //sphere
@@ -68,10 +149,18 @@ void setup(void)
     const char* efaPng = "D:\\3dscene\\efa.png";
     const char* f117Png = "D:\\3dscene\\f117.png";
 
-    load_mesh(runwayObj, runwayPng, vec3_new(1, 1, 1), vec3_new(0, -1.5, +23), vec3_new(0, 0, 0));
-    load_mesh(f22Obj, f22Png, vec3_new(1, 1, 1), vec3_new(0, -1.3, +5), vec3_new(0, -M_PI / 2, 0));
-    load_mesh(efaObj, efaPng, vec3_new(1, 1, 1), vec3_new(-2, -1.3, +9), vec3_new(0, -M_PI / 2, 0));
-    load_mesh(f117Obj, f117Png, vec3_new(1, 1, 1), vec3_new(+2, -1.3, +9), vec3_new(0, -M_PI / 2, 0));
+    int load_flags = MESH_LOAD_SOA | MESH_LOAD_OPTIMIZE_VERTEX_CACHE | scene_load_flags;
+    load_mesh_async(runwayObj, runwayPng, vec3_new(1, 1, 1), vec3_new(0, -1.5, +23), vec3_new(0, 0, 0), load_flags);
+    load_mesh_async(f22Obj, f22Png, vec3_new(1, 1, 1), vec3_new(0, -1.3, +5), vec3_new(0, -M_PI / 2, 0), load_flags);
+    load_mesh_async(efaObj, efaPng, vec3_new(1, 1, 1), vec3_new(-2, -1.3, +9), vec3_new(0, -M_PI / 2, 0), load_flags);
+    load_mesh_async(f117Obj, f117Png, vec3_new(1, 1, 1), vec3_new(+2, -1.3, +9), vec3_new(0, -M_PI / 2, 0), load_flags);
+
+    // Rendering starts with placeholders while the files load, except for a
+    // recorded sequence, where every frame should show the whole scene
+    if (is_recording_frames())
+    {
+        wait_for_loaded_assets();
+    }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -79,8 +168,9 @@ void setup(void)
 ///////////////////////////////////////////////////////////////////////////////
 void process_input(void)
 {
+    // The main thread pumps the events, this is the render thread
     SDL_Event event;
-    while (SDL_PollEvent(&event)) 
+    while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) > 0)
     {
         switch (event.type)
     	{
@@ -123,6 +213,48 @@ void process_input(void)
                 set_render_method(RENDER_TEXTURED_WIRE);
                 break;
             }
+            if (event.key.keysym.sym == SDLK_p)
+            {
+                // Toggle overlapping the next frame's geometry with this frame's rasterization
+                pipelined_frames = !pipelined_frames;
+                reset_frame_stats(SDL_GetTicks());
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_f)
+            {
+                // Toggle printing the frame stats, counted from the moment they are shown
+                show_frame_stats = !show_frame_stats;
+                reset_frame_stats(SDL_GetTicks());
+                reset_depth_stats();
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_l)
+            {
+                // Toggle clearing each framebuffer tile only when it is first drawn to
+                set_clear_method(get_clear_method() == CLEAR_LAZY ? CLEAR_EAGER : CLEAR_LAZY);
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_r)
+            {
+                // Toggle the reversed-Z depth buffer
+                set_depth_mode(get_depth_mode() == DEPTH_REVERSED_Z ? DEPTH_STANDARD : DEPTH_REVERSED_Z);
+                init_projection();
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_b)
+            {
+                // Cycle the z-buffer formats: float32, unorm24, unorm16
+                set_depth_format((get_depth_format() + 1) % NUM_DEPTH_FORMATS);
+                reset_frame_stats(SDL_GetTicks());
+                reset_depth_stats();
+                break;
+            }
+            if (event.key.keysym.sym == SDLK_o)
+            {
+                // Toggle hiding the wireframe and vertex points behind the faces
+                set_depth_tested_overlays(!get_depth_tested_overlays());
+                break;
+            }
             if (event.key.keysym.sym == SDLK_c)
             {
                 set_cull_method(CULL_BACKFACE);
@@ -197,6 +329,170 @@ float setTransformation(float value)
     return value * delta_time;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Per-vertex results of the batched transforms, one set per mesh
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    mat4_t world_view_matrix;      // model space -> camera space
+    mat4_t world_view_proj_matrix; // model space -> clip space
+    float* camera_x; // camera space position
+    float* camera_y;
+    float* camera_z;
+    float* screen_x; // screen space position after projection, divide and viewport
+    float* screen_y;
+    float* screen_z;
+    float* screen_w;
+    int* outcodes;
+    int capacity;
+} transformed_vertices_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// A range of vertices or faces of one mesh: the unit of work of the geometry
+// stage handed to the thread pool
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int mesh_index;
+    int begin;
+    int end;
+} geometry_task_t;
+
+#define VERTICES_PER_TASK 4096
+#define FACES_PER_TASK 1024
+
+static std::vector<transformed_vertices_t> transformed_meshes;
+static std::vector<geometry_task_t> vertex_tasks;
+static std::vector<geometry_task_t> face_tasks;
+
+// Every face task writes to its own triangle list and stats, joined in task order afterwards
+static std::vector<std::vector<triangle_t>> face_task_triangles;
+static std::vector<clip_stats_t> face_task_clip_stats;
+
+static void free_transformed_vertices(transformed_vertices_t* transformed)
+{
+    simd_aligned_free(transformed->camera_x);
+    simd_aligned_free(transformed->camera_y);
+    simd_aligned_free(transformed->camera_z);
+    simd_aligned_free(transformed->screen_x);
+    simd_aligned_free(transformed->screen_y);
+    simd_aligned_free(transformed->screen_z);
+    simd_aligned_free(transformed->screen_w);
+    simd_aligned_free(transformed->outcodes);
+    *transformed = {};
+}
+
+static void reserve_transformed_vertices(transformed_vertices_t* transformed, int count)
+{
+    if (count <= transformed->capacity)
+    {
+        return;
+    }
+    free_transformed_vertices(transformed);
+    transformed->camera_x = (float*)simd_aligned_alloc(sizeof(float) * count);
+    transformed->camera_y = (float*)simd_aligned_alloc(sizeof(float) * count);
+    transformed->camera_z = (float*)simd_aligned_alloc(sizeof(float) * count);
+    transformed->screen_x = (float*)simd_aligned_alloc(sizeof(float) * count);
+    transformed->screen_y = (float*)simd_aligned_alloc(sizeof(float) * count);
+    transformed->screen_z = (float*)simd_aligned_alloc(sizeof(float) * count);
+    transformed->screen_w = (float*)simd_aligned_alloc(sizeof(float) * count);
+    transformed->outcodes = (int*)simd_aligned_alloc(sizeof(int) * count);
+    transformed->capacity = count;
+}
+
+static void free_geometry_buffers(void)
+{
+    for (size_t i = 0; i < transformed_meshes.size(); i++)
+    {
+        free_transformed_vertices(&transformed_meshes[i]);
+    }
+    transformed_meshes.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Project a clipped camera space vertex all the way to screen space
+///////////////////////////////////////////////////////////////////////////////
+static vec4_t project_to_screen(vec4_t point)
+{
+    // Project the current vertex using a perspective projection matrix
+    vec4_t projected_point = mat4_mul_vec4(proj_matrix, point);
+
+    // Perform perspective divide
+    if (projected_point.w != 0) {
+        projected_point.x /= projected_point.w;
+        projected_point.y /= projected_point.w;
+        projected_point.z /= projected_point.w;
+    }
+
+    // SCALE into the view
+    projected_point.x *= (get_window_width() / 2.0);
+    projected_point.y *= (get_window_height() / 2.0);
+
+    // Flip vertically since the y values of the 3D mesh grow bottom->up and in screen space y values grow top->down
+    projected_point.y *= -1;
+
+    // TRANSLATE the projected points to the middle of the screen
+    projected_point.x += (get_window_width() / 2.0);
+    projected_point.y += (get_window_height() / 2.0);
+
+    return projected_point;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build the matrices that take this mesh to camera space and to clip space
+///////////////////////////////////////////////////////////////////////////////
+static void prepare_mesh_transforms(mesh_t* mesh, transformed_vertices_t* transformed)
+{
+    // Create scale, rotation, and translation matrices that will be used to multiply the mesh vertices 
+    mat4_t scale_matrix = mat4_make_scale(mesh->scale.x, mesh->scale.y, mesh->scale.z);
+    mat4_t translation_matrix = mat4_make_translation(mesh->translation.x, mesh->translation.y, mesh->translation.z);
+    mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh->rotation.x);
+    mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh->rotation.y);
+    mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh->rotation.z);
+
+    // ORDER OF OPERATIONS MATTERS! It HAS to go in order: Scale -> Rotate -> Translate.
+    // This is because MATRIX operations are NOT COMMUTATIVE (A*B!=B*A): [T]*[R]*[S]*v
+    //
+    // Create a Single World Matrix combining scale, rotation, and translation matrices
+    mat4_t world_matrix = mat4_identity();
+    world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
+    world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
+    world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
+
+    // Combine world and view to go straight to camera space, and add projection for screen space
+    transformed->world_view_matrix = mat4_mul_mat4(view_matrix, world_matrix);
+    transformed->world_view_proj_matrix = mat4_mul_mat4(proj_matrix, transformed->world_view_matrix);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Transform a range of mesh vertices, several at a time, once per frame
+///////////////////////////////////////////////////////////////////////////////
+static void transform_vertices_task(void* /*context*/, int task_index, int /*worker_index*/)
+{
+    const geometry_task_t* task = &vertex_tasks[task_index];
+    const position_stream_t* positions = &get_mesh(task->mesh_index)->positions;
+    transformed_vertices_t* transformed = &transformed_meshes[task->mesh_index];
+
+    int first = task->begin;
+    int count = task->end - task->begin;
+
+    mat4_mul_points_batch(
+        &transformed->world_view_matrix, positions->x + first, positions->y + first, positions->z + first, count,
+        transformed->camera_x + first, transformed->camera_y + first, transformed->camera_z + first
+    );
+    mat4_project_points_batch(
+        &transformed->world_view_proj_matrix, positions->x + first, positions->y + first, positions->z + first, count,
+        get_window_width() / 2.0f, get_window_height() / 2.0f,
+        transformed->screen_x + first, transformed->screen_y + first, transformed->screen_z + first, transformed->screen_w + first
+    );
+
+    // Remember which frustum planes each vertex is outside of
+    for (int v = task->begin; v < task->end; v++)
+    {
+        transformed->outcodes[v] = compute_outcode(vec3_new(transformed->camera_x[v], transformed->camera_y[v], transformed->camera_z[v]));
+    }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Process the graphics pipeline stages for all the mesh triangles
 ///////////////////////////////////////////////////////////////////////////////
@@ -222,60 +518,22 @@ float setTransformation(float value)
 //                        `--> | Screen space |  <-- ready to render
 //                             +--------------+
 ///////////////////////////////////////////////////////////////////////////////
-void process_graphics_pipeline_stages(mesh_t* mesh)
-{
-    // Create scale, rotation, and translation matrices that will be used to multiply the mesh vertices 
-    mat4_t scale_matrix = mat4_make_scale(mesh->scale.x, mesh->scale.y, mesh->scale.z);
-    mat4_t translation_matrix = mat4_make_translation(mesh->translation.x, mesh->translation.y, mesh->translation.z);
-    mat4_t rotation_matrix_x = mat4_make_rotation_x(mesh->rotation.x);
-    mat4_t rotation_matrix_y = mat4_make_rotation_y(mesh->rotation.y);
-    mat4_t rotation_matrix_z = mat4_make_rotation_z(mesh->rotation.z);
-
-    // Update camera look at target to create view matrix
-    vec3_t target = get_camera_lookat_target();
-    vec3_t up_direction = vec3_new(0, 1, 0);
-    view_matrix = mat4_look_at(get_camera_position(), target, up_direction);
-
-    // Loop all triangle faces of our mesh
-    for (size_t i = 0; i < mesh->faces.size(); i++)
+void process_graphics_pipeline_stages(
+    mesh_t* mesh, const transformed_vertices_t* transformed, int first_face, int last_face,
+    std::vector<triangle_t>* triangles, clip_stats_t* clip_stats
+) {
+    // Loop the triangle faces of this range of the mesh
+    for (int i = first_face; i < last_face; i++)
     {
-        face_t mesh_face = mesh->faces[i];
+        // Only the indices are needed until the face survives culling
+        int vertex_indices[3];
+        get_mesh_face_indices(mesh, i, vertex_indices);
 
-        vec3_t face_vertices[3];
-        face_vertices[0] = mesh->vertices[mesh_face.a - 1];
-        face_vertices[1] = mesh->vertices[mesh_face.b - 1];
-        face_vertices[2] = mesh->vertices[mesh_face.c - 1];
-
-        //////////////////////////////////////////////////////////////////////////////////
-        // Apply transformations (sclaing, factoring and rotations)
-        ///////////////////////////////////////////////////////////////////////////////////
         vec4_t transformed_vertices[3];
-
-        // Loop all three vertices of this current face and apply transformations
         for (int j = 0; j < 3; j++)
         {
-            vec4_t transformed_vertex = vec4_from_vec3(face_vertices[j]);
-
-            // ORDER OF OPERATIONS MATTERS! It HAS to go in order: Scale -> Rotate -> Translate.
-            // This is because MATRIX operations are NOT COMMUTATIVE (A*B!=B*A): [T]*[R]*[S]*v
-            //
-            // Create a Single World Matrix combining scale, rotation, and translation matrices
-            world_matrix = mat4_identity();
-            world_matrix = mat4_mul_mat4(scale_matrix, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_z, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_y, world_matrix);
-            world_matrix = mat4_mul_mat4(rotation_matrix_x, world_matrix);
-            world_matrix = mat4_mul_mat4(translation_matrix, world_matrix);
-
-            // Use a World Matrix to make SCALING, ROTATION and TRANSLATION in combination.
-            // Multiply the world matrix by the original vector.
-            transformed_vertex = mat4_mul_vec4(world_matrix, transformed_vertex);
-
-            // Multiply the view matrix by the vector to transform the scene to camera space
-            transformed_vertex = mat4_mul_vec4(view_matrix, transformed_vertex);
-
-            // Save transformed vertex in the array of transformed vertices
-            transformed_vertices[j] = transformed_vertex;
+            int v = vertex_indices[j];
+            transformed_vertices[j] = { transformed->camera_x[v], transformed->camera_y[v], transformed->camera_z[v], 1.0 };
         }
 
         //////////////////////////////////////////////////////////////////////////////////
@@ -302,6 +560,49 @@ void process_graphics_pipeline_stages(mesh_t* mesh)
             }
         }
 
+        // Use the vertex outcodes to skip or discard the triangle without clipping it
+        int clip_result = classify_triangle_outcodes(
+            transformed->outcodes[vertex_indices[0]],
+            transformed->outcodes[vertex_indices[1]],
+            transformed->outcodes[vertex_indices[2]],
+            clip_stats
+        );
+
+        if (clip_result == CLIP_TRIVIAL_REJECT)
+        {
+            continue;
+        }
+
+        // Calculate DOT PRODUCT: the shade intensity based on how aliged is the face normal and the opposite of the light direction.
+        // Why opposite? Because the VIEWER (we're) sees the reflected light coming FROM the object, not into it.
+        // But we calculate DOT PRODUCT with light directed TO the object. So, finally, we need to use the opposite value.
+        float light_intensity_factor = -vec3_dot(face_normal, get_light_direction());
+
+        // Calculate the triangle color based on the light angle
+        uint32_t triangle_color = light_apply_intensity(get_mesh_face_color(mesh, i), light_intensity_factor);
+
+        tex2_t face_texcoords[3];
+        get_mesh_face_texcoords(mesh, i, face_texcoords);
+
+        if (clip_result == CLIP_TRIVIAL_ACCEPT)
+        {
+            // Fully inside the frustum: the batched projection already has the screen positions
+            triangle_t projected_triangle_to_render;
+            for (int j = 0; j < 3; j++)
+            {
+                int v = vertex_indices[j];
+                projected_triangle_to_render.points[j] = { transformed->screen_x[v], transformed->screen_y[v], transformed->screen_z[v], transformed->screen_w[v] };
+            }
+            projected_triangle_to_render.texcoords[0] = face_texcoords[0];
+            projected_triangle_to_render.texcoords[1] = face_texcoords[1];
+            projected_triangle_to_render.texcoords[2] = face_texcoords[2];
+            projected_triangle_to_render.color = triangle_color;
+            projected_triangle_to_render.texture = mesh->texture;
+
+            triangles->push_back(projected_triangle_to_render);
+            continue;
+        }
+
         ///////////////////////////////////////////////////////////////////////////////////////////////
         // CLIPPING
         ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -311,9 +612,9 @@ void process_graphics_pipeline_stages(mesh_t* mesh)
             vec3_from_vec4(transformed_vertices[0]),
             vec3_from_vec4(transformed_vertices[1]),
             vec3_from_vec4(transformed_vertices[2]),
-            mesh_face.a_uv,
-            mesh_face.b_uv,
-            mesh_face.c_uv
+            face_texcoords[0],
+            face_texcoords[1],
+            face_texcoords[2]
         );
 
         // Clip the polygon and returns a new polygon with potential new vertices
@@ -339,38 +640,9 @@ void process_graphics_pipeline_stages(mesh_t* mesh)
             // Loop all three vertices of this current face and apply transformations
             for (int j = 0; j < 3; j++)
             {
-                // Project the current vertex using a perspective projection matrix
-                projected_points[j] = mat4_mul_vec4(proj_matrix, triangle_after_clipping.points[j]);
-                //projected_points[j] = mat4_mul_vec4_project(proj_matrix, transformed_vertices[j]);
-                //projected_points[j] = project_v2(vec3_from_vec4(transformed_vertices[j]));
-
-                // Perform perspective divide
-                if (projected_points[j].w != 0) {
-                    projected_points[j].x /= projected_points[j].w;
-                    projected_points[j].y /= projected_points[j].w;
-                    projected_points[j].z /= projected_points[j].w;
-                }
-
-                // SCALE into the view
-                projected_points[j].x *= (get_window_width() / 2.0);
-                projected_points[j].y *= (get_window_height() / 2.0);
-
-                // Flip vertically since the y values of the 3D mesh grow bottom->up and in screen space y values grow top->down
-                projected_points[j].y *= -1;
-
-                // TRANSLATE the projected points to the middle of the screen
-                projected_points[j].x += (get_window_width() / 2.0);
-                projected_points[j].y += (get_window_height() / 2.0);
+                projected_points[j] = project_to_screen(triangle_after_clipping.points[j]);
             }
 
-            // Calculate DOT PRODUCT: the shade intensity based on how aliged is the face normal and the opposite of the light direction.
-            // Why opposite? Because the VIEWER (we're) sees the reflected light coming FROM the object, not into it.
-            // But we calculate DOT PRODUCT with light directed TO the object. So, finally, we need to use the opposite value.
-            float light_intensity_factor = -vec3_dot(face_normal, get_light_direction());
-
-            // Calculate the triangle color based on the light angle
-            uint32_t triangle_color = light_apply_intensity(mesh_face.color, light_intensity_factor);
-
             triangle_t projected_triangle_to_render = {
                 .points = {
                     { projected_points[0].x, projected_points[0].y, projected_points[0].z, projected_points[0].w },
@@ -386,20 +658,127 @@ void process_graphics_pipeline_stages(mesh_t* mesh)
                 .texture = mesh->texture
             };
 
-            if (num_static_triangles_to_render < MAX_TRIANGLES_PER_MESH)
+            triangles->push_back(projected_triangle_to_render);
+        }
+    }
+}
+
+static void process_faces_task(void* /*context*/, int task_index, int /*worker_index*/)
+{
+    const geometry_task_t* task = &face_tasks[task_index];
+
+    std::vector<triangle_t>* triangles = &face_task_triangles[task_index];
+    clip_stats_t* clip_stats = &face_task_clip_stats[task_index];
+    triangles->clear();
+    *clip_stats = { 0, 0, 0 };
+
+    process_graphics_pipeline_stages(
+        get_mesh(task->mesh_index), &transformed_meshes[task->mesh_index], task->begin, task->end,
+        triangles, clip_stats
+    );
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Triangle order for texturing
+///////////////////////////////////////////////////////////////////////////////
+// The geometry stage puts out the triangles mesh after mesh, so the
+// rasterizer switches textures as often as meshes overlap on screen and
+// goes back and forth over the framebuffer. Textured frames sort the list
+// by the screen region a triangle starts in (4x4 framebuffer tiles), then
+// by texture, in the order textures first appear, then by the original
+// order: each region is drawn texture by texture. The z-buffer keeps the
+// picture the same, but for fragments of exactly the same depth.
+//
+// There are few (region, texture) buckets, so it is a counting sort: one
+// pass finds the bucket of every triangle and counts them, and a second
+// one copies every triangle once, straight to its place.
+///////////////////////////////////////////////////////////////////////////////
+#define SORT_REGION_SHIFT (FRAMEBUFFER_TILE_SHIFT + 2)
+
+static std::vector<uint32_t> triangle_buckets; // the region of each triangle, then region * textures + texture rank
+static std::vector<uint32_t> triangle_texture_ranks;
+static std::vector<uint32_t> bucket_offsets;
+static std::vector<const lodepng_texture_t*> sorted_textures;
+static std::vector<triangle_t> sorted_triangles;
+
+static void sort_triangles_by_texture(std::vector<triangle_t>* triangles)
+{
+    size_t count = triangles->size();
+    int regions_x = (get_window_width() >> SORT_REGION_SHIFT) + 1;
+    int regions_y = (get_window_height() >> SORT_REGION_SHIFT) + 1;
+    int max_x = get_window_width() - 1;
+    int max_y = get_window_height() - 1;
+
+    triangle_buckets.resize(count);
+    triangle_texture_ranks.resize(count);
+    sorted_textures.clear();
+    const lodepng_texture_t* last_texture = NULL;
+    uint32_t texture_rank = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const triangle_t* triangle = &(*triangles)[i];
+        float min_x = fminf(fminf(triangle->points[0].x, triangle->points[1].x), triangle->points[2].x);
+        float min_y = fminf(fminf(triangle->points[0].y, triangle->points[1].y), triangle->points[2].y);
+        int x = (min_x < 0) ? 0 : (min_x > max_x) ? max_x : (int)min_x;
+        int y = (min_y < 0) ? 0 : (min_y > max_y) ? max_y : (int)min_y;
+
+        if (triangle->texture != last_texture || i == 0)
+        {
+            last_texture = triangle->texture;
+            texture_rank = (uint32_t)(std::find(sorted_textures.begin(), sorted_textures.end(), last_texture) - sorted_textures.begin());
+            if (texture_rank == sorted_textures.size())
             {
-                static_triangles_to_render[num_static_triangles_to_render++] = projected_triangle_to_render;
+                sorted_textures.push_back(last_texture);
             }
         }
+        triangle_buckets[i] = (uint32_t)((y >> SORT_REGION_SHIFT) * regions_x + (x >> SORT_REGION_SHIFT));
+        triangle_texture_ranks[i] = texture_rank;
     }
+
+    // Count the triangles of every bucket, then turn the counts into where each bucket starts
+    uint32_t num_textures = (uint32_t)sorted_textures.size();
+    bucket_offsets.assign((size_t)regions_x * regions_y * num_textures, 0);
+    for (size_t i = 0; i < count; i++)
+    {
+        triangle_buckets[i] = triangle_buckets[i] * num_textures + triangle_texture_ranks[i];
+        bucket_offsets[triangle_buckets[i]]++;
+    }
+    uint32_t offset = 0;
+    for (size_t b = 0; b < bucket_offsets.size(); b++)
+    {
+        uint32_t bucket_count = bucket_offsets[b];
+        bucket_offsets[b] = offset;
+        offset += bucket_count;
+    }
+
+    // Going through the list in order keeps the original order within a bucket
+    sorted_triangles.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        sorted_triangles[bucket_offsets[triangle_buckets[i]]++] = (*triangles)[i];
+    }
+    triangles->swap(sorted_triangles);
 }
 
-void updateShape(void)
+///////////////////////////////////////////////////////////////////////////////
+// Run the geometry stage of every mesh on the thread pool
+///////////////////////////////////////////////////////////////////////////////
+// Vertices and faces are cut into fixed-size ranges. All vertex ranges run
+// first, then all face ranges. Each face range fills its own triangle list,
+// and the lists are joined in range order, so the triangles come out in the
+// same order as a serial loop over the meshes would produce them (textured
+// frames are sorted afterwards, see above).
+///////////////////////////////////////////////////////////////////////////////
+void updateShape(std::vector<triangle_t>* triangles)
 {
-    num_static_triangles_to_render = 0;
+    int num_meshes = get_num_meshes();
+    transformed_meshes.resize(num_meshes);
+    vertex_tasks.clear();
+    face_tasks.clear();
 
     // Loop all the meshes of our scene
-    for (int mesh_index = 0; mesh_index < get_num_meshes(); mesh_index++)
+    for (int mesh_index = 0; mesh_index < num_meshes; mesh_index++)
     {
         mesh_t* mesh = get_mesh(mesh_index);
 
@@ -408,26 +787,93 @@ void updateShape(void)
         // rotate_mesh_y(mesh_index, mesh->rotation_velocity.y * delta_time);
         // rotate_mesh_z(mesh_index, mesh->rotation_velocity.z * delta_time);
 
-        // Process graphics pipeline stages for each mesh
-        process_graphics_pipeline_stages(mesh);
+        prepare_mesh_transforms(mesh, &transformed_meshes[mesh_index]);
+        reserve_transformed_vertices(&transformed_meshes[mesh_index], mesh->positions.count);
+
+        for (int begin = 0; begin < mesh->positions.count; begin += VERTICES_PER_TASK)
+        {
+            int end = (begin + VERTICES_PER_TASK < mesh->positions.count) ? begin + VERTICES_PER_TASK : mesh->positions.count;
+            vertex_tasks.push_back({ mesh_index, begin, end });
+        }
+
+        int num_faces = get_mesh_num_faces(mesh);
+        for (int begin = 0; begin < num_faces; begin += FACES_PER_TASK)
+        {
+            int end = (begin + FACES_PER_TASK < num_faces) ? begin + FACES_PER_TASK : num_faces;
+            face_tasks.push_back({ mesh_index, begin, end });
+        }
+    }
+
+    thread_pool_parallel_for((int)vertex_tasks.size(), transform_vertices_task, NULL);
+
+    if (face_task_triangles.size() < face_tasks.size())
+    {
+        face_task_triangles.resize(face_tasks.size());
+        face_task_clip_stats.resize(face_tasks.size());
+    }
+    thread_pool_parallel_for((int)face_tasks.size(), process_faces_task, NULL);
+
+    triangles->clear();
+    reset_clip_stats();
+    for (size_t t = 0; t < face_tasks.size(); t++)
+    {
+        triangles->insert(triangles->end(), face_task_triangles[t].begin(), face_task_triangles[t].end());
+        add_clip_stats(&face_task_clip_stats[t]);
+    }
+
+    if (should_render_textured_triangles())
+    {
+        sort_triangles_by_texture(triangles);
     }
 }
 
+static void build_triangle_list_task(void* context)
+{
+    updateShape((std::vector<triangle_t>*)context);
+}
+
 void update(void)
 {
     keepStableFps();
+    frame_start_time = SDL_GetPerformanceCounter();
+
+    // No geometry is in flight here, so the meshes may change
+    free_retired_mesh_textures();
+    apply_loaded_assets();
+    if (atlas_requested && !is_loading_assets())
+    {
+        build_texture_atlas(&atlas_settings);
+        atlas_requested = false;
+    }
+
+    // Update camera look at target to create view matrix
+    vec3_t target = get_camera_lookat_target();
+    vec3_t up_direction = vec3_new(0, 1, 0);
+    view_matrix = mat4_look_at(get_camera_position(), target, up_direction);
 
-    updateShape();
+    if (pipelined_frames)
+    {
+        // Build the next frame while this one rasterizes the list built during the previous frame
+        int geometry_list = 1 - raster_list;
+        triangle_list_input_time[geometry_list] = frame_start_time;
+        start_background_task(build_triangle_list_task, &triangle_lists[geometry_list]);
+    }
+    else
+    {
+        triangle_list_input_time[raster_list] = frame_start_time;
+        updateShape(&triangle_lists[raster_list]);
+    }
 }
 
-void render_shape(void)
+void render_shape(const std::vector<triangle_t>* triangles)
 {
     // Draw cube mesh. Loop all projected triangles and render them
-    int trianglesNum = num_static_triangles_to_render;
+    int trianglesNum = (int)triangles->size();
 
+    // Fill pass
     for (int i = 0; i < trianglesNum; i++)
     {
-        triangle_t triangle = static_triangles_to_render[i];
+        triangle_t triangle = (*triangles)[i];
 
         if (should_render_filled_triangles())
         {
@@ -448,26 +894,61 @@ void render_shape(void)
                 triangle.texture
             );
         }
+    }
 
-        if (should_render_wireframe())
-        {
-            // Draw unfilled triangle
-            draw_triangle(
-                triangle.points[0].x, triangle.points[0].y, // vertex A
-                triangle.points[1].x, triangle.points[1].y, // vertex B
-                triangle.points[2].x, triangle.points[2].y, // vertex C
-                0xFFFFFFFF
-            );
-        }
+    // Overlay pass, after all the faces: with faces in the z-buffer the
+    // edges and points behind them are hidden
+    bool depth_tested = get_depth_tested_overlays() &&
+        (should_render_filled_triangles() || should_render_textured_triangles());
 
-        if (should_render_wire_vertex())
-        {
-            // Draw triangle vertex points
-            draw_rect(triangle.points[0].x, triangle.points[0].y, 3, 3, 0xFFFFFF00);
-            draw_rect(triangle.points[1].x, triangle.points[1].y, 3, 3, 0xFFFFFF00);
-            draw_rect(triangle.points[2].x, triangle.points[2].y, 3, 3, 0xFFFFFF00);
-        }
+    if (should_render_wireframe() && trianglesNum > 0)
+    {
+        // Draw unfilled triangles, every shared edge once
+        draw_wireframe(triangles->data(), trianglesNum, depth_tested, 0xFFFFFFFF);
+    }
+
+    if (should_render_wire_vertex() && trianglesNum > 0)
+    {
+        // Draw triangle vertex points
+        draw_wireframe_vertices(triangles->data(), trianglesNum, 3, depth_tested, 0xFFFFFF00);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Print the average frame time and input latency once per second
+///////////////////////////////////////////////////////////////////////////////
+static void report_frame_stats(void)
+{
+    uint32_t ticks = SDL_GetTicks();
+    if (ticks - frame_stats.report_ticks < 1000 || frame_stats.frames == 0)
+    {
+        return;
     }
+    if (!show_frame_stats)
+    {
+        // Keep the sums from growing while nothing is printed
+        reset_frame_stats(ticks);
+        reset_depth_stats();
+        return;
+    }
+
+    double ms_per_count = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    depth_stats_t depth = get_depth_stats();
+    printf(
+        "%s: %.2f ms per frame, %.2f ms input latency, %s z-buffer %.2f MB read %.2f MB written per frame, "
+        "%d accepted %d rejected %d clipped triangles per frame\n",
+        pipelined_frames ? "pipelined" : "serial",
+        frame_stats.frame_time * ms_per_count / frame_stats.frames,
+        frame_stats.latency * ms_per_count / frame_stats.frames,
+        get_depth_format_name(get_depth_format()),
+        depth.bytes_read / (1024.0 * 1024.0) / frame_stats.frames,
+        depth.bytes_written / (1024.0 * 1024.0) / frame_stats.frames,
+        frame_stats.clips.trivially_accepted / frame_stats.frames,
+        frame_stats.clips.trivially_rejected / frame_stats.frames,
+        frame_stats.clips.clipped / frame_stats.frames
+    );
+    reset_frame_stats(ticks);
+    reset_depth_stats();
 }
 
 void render(void)
@@ -480,28 +961,237 @@ void render(void)
     //draw_grid_dots();
     //draw_rect(300, 200, 300, 150, 0xFFFF00FF);
 
-    render_shape();
+    render_shape(&triangle_lists[raster_list]);
+
+    if (is_recording_frames() || is_streaming_video())
+    {
+        record_frame();
+        stream_video_frame();
+        if (++recorded_frames == frames_to_record)
+        {
+            is_running = false;
+        }
+    }
 
     render_color_buffer();
+
+    // The input time is zero only when the very first frame is already pipelined and has no geometry yet
+    uint64_t input_time = triangle_list_input_time[raster_list];
+    frame_stats.frames++;
+    frame_stats.latency += (input_time != 0) ? SDL_GetPerformanceCounter() - input_time : 0;
+
+    if (pipelined_frames)
+    {
+        // The next frame's geometry has to be complete before the lists swap and the input changes
+        wait_background_task();
+        raster_list = 1 - raster_list;
+    }
+    // The geometry of the frame is complete here in both modes
+    clip_stats_t clips = get_clip_stats();
+    frame_stats.clips.trivially_accepted += clips.trivially_accepted;
+    frame_stats.clips.trivially_rejected += clips.trivially_rejected;
+    frame_stats.clips.clipped += clips.clipped;
+    frame_stats.frame_time += SDL_GetPerformanceCounter() - frame_start_time;
+
+    report_frame_stats();
 }
 
 void free_resources(void)
 {
+    // Writes out the frames still queued
+    stop_frame_recording();
+    stop_video_stream();
+
+    // Also waits for the geometry still in flight
+    destroy_thread_pool();
+    stop_asset_loader();
+    free_geometry_buffers();
+    free_wireframe_buffers();
     free_meshes();
 }
 
-int main(void)
+///////////////////////////////////////////////////////////////////////////////
+// Command line
+///////////////////////////////////////////////////////////////////////////////
+//  --record <directory>      write every frame to <directory>/frame_NNNNN.png
+//  --record-frames <n>       quit after n recorded or streamed frames
+//  --png-encoders <n>        encoder threads (default: half the hardware threads)
+//  --png-queue <n>           frames waiting for the encoders before rendering blocks
+//  --png-filter <name>       zero, sub, up, average, paeth, minsum, entropy or brute-force
+//  --png-window <n>          deflate window, a power of two up to 32768
+//  --png-nicematch <n>       stop searching matches at that length, up to 258
+//  --png-lazy <0|1>          lazy matching
+//  --png-btype <0|1|2>       deflate block type: stored, fixed or dynamic Huffman
+//  --bench-png <file>        time inflate and decoding of the PNG file, then quit
+//  --bench-iterations <n>    runs per --bench-png figure, the fastest counts (default: 20)
+//  --stream <path>           write every frame to a raw video stream, - for stdout
+//  --stream-format <name>    y4m (YUV 4:2:0, the default) or rgba (headerless)
+//  --compress-textures <0|1> keep the textures BC1/BC3 compressed in memory
+//  --texture-atlas <0|1>     pack the small textures into shared pages once loaded
+///////////////////////////////////////////////////////////////////////////////
+static bool parse_filter_strategy(const char* name, LodePNGFilterStrategy* strategy)
 {
-    is_running = initialize_window();
+    static const struct {
+        const char* name;
+        LodePNGFilterStrategy strategy;
+    } strategies[] = {
+        { "zero", LFS_ZERO }, { "sub", LFS_ONE }, { "up", LFS_TWO }, { "average", LFS_THREE },
+        { "paeth", LFS_FOUR }, { "minsum", LFS_MINSUM }, { "entropy", LFS_ENTROPY }, { "brute-force", LFS_BRUTE_FORCE }
+    };
+    for (size_t i = 0; i < sizeof(strategies) / sizeof(strategies[0]); i++)
+    {
+        if (strcmp(name, strategies[i].name) == 0)
+        {
+            *strategy = strategies[i].strategy;
+            return true;
+        }
+    }
+    return false;
+}
 
-    setup();
+static bool parse_arguments(int argc, char* argv[])
+{
+    init_frame_recorder_settings(&record_settings);
+    init_texture_atlas_settings(&atlas_settings);
 
+    for (int i = 1; i < argc; i++)
+    {
+        const char* option = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (value == NULL)
+        {
+            fprintf(stderr, "Missing value for %s\n", option);
+            return false;
+        }
+        i++;
+
+        if (strcmp(option, "--record") == 0)
+        {
+            record_settings.directory = value;
+            record_requested = true;
+        }
+        else if (strcmp(option, "--record-frames") == 0)
+        {
+            frames_to_record = atoi(value);
+        }
+        else if (strcmp(option, "--png-encoders") == 0)
+        {
+            record_settings.num_encoders = atoi(value);
+        }
+        else if (strcmp(option, "--png-queue") == 0)
+        {
+            record_settings.queue_length = atoi(value);
+        }
+        else if (strcmp(option, "--png-filter") == 0)
+        {
+            if (!parse_filter_strategy(value, &record_settings.filter_strategy))
+            {
+                fprintf(stderr, "Unknown PNG filter %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(option, "--png-window") == 0)
+        {
+            record_settings.compress.windowsize = (unsigned)atoi(value);
+        }
+        else if (strcmp(option, "--png-nicematch") == 0)
+        {
+            record_settings.compress.nicematch = (unsigned)atoi(value);
+        }
+        else if (strcmp(option, "--png-lazy") == 0)
+        {
+            record_settings.compress.lazymatching = (unsigned)atoi(value);
+        }
+        else if (strcmp(option, "--png-btype") == 0)
+        {
+            record_settings.compress.btype = (unsigned)atoi(value);
+        }
+        else if (strcmp(option, "--bench-png") == 0)
+        {
+            bench_png_path = value;
+        }
+        else if (strcmp(option, "--bench-iterations") == 0)
+        {
+            bench_iterations = atoi(value);
+        }
+        else if (strcmp(option, "--stream") == 0)
+        {
+            stream_path = value;
+        }
+        else if (strcmp(option, "--stream-format") == 0)
+        {
+            if (strcmp(value, "y4m") == 0)
+            {
+                stream_format = VIDEO_STREAM_Y4M;
+            }
+            else if (strcmp(value, "rgba") == 0)
+            {
+                stream_format = VIDEO_STREAM_RGBA;
+            }
+            else
+            {
+                fprintf(stderr, "Unknown stream format %s\n", value);
+                return false;
+            }
+        }
+        else if (strcmp(option, "--texture-atlas") == 0)
+        {
+            atlas_requested = atoi(value) != 0;
+        }
+        else if (strcmp(option, "--compress-textures") == 0)
+        {
+            if (atoi(value) != 0)
+            {
+                scene_load_flags |= MESH_LOAD_COMPRESS_TEXTURE;
+            }
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", option);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void run_frames(void)
+{
     while (is_running)
     {
         process_input();
         update();
         render();
     }
+}
+
+int main(int argc, char* argv[])
+{
+    if (!parse_arguments(argc, argv))
+    {
+        return 1;
+    }
+
+    if (bench_png_path != NULL)
+    {
+        return run_png_benchmark(bench_png_path, bench_iterations) ? 0 : 1;
+    }
+
+    is_running = initialize_window();
+
+    // Before anything is printed: a stream to stdout moves the other output to stderr
+    if (stream_path != NULL && is_running)
+    {
+        is_running = start_video_stream(stream_path, stream_format, FPS);
+    }
+    if (record_requested && is_running)
+    {
+        is_running = start_frame_recording(&record_settings);
+    }
+
+    setup();
+
+    // The frames are drawn on a render thread, this one shows them
+    run_present_loop(run_frames);
 
     destroy_window();
     free_resources();
@@ -1,7 +1,12 @@
 #include "Matrix.h"
+#include "Simd.h"
 
 #include <math.h>
 
+#if defined(SIMD_X86)
+#include <immintrin.h>
+#endif
+
 mat4_t mat4_identity(void)
 {
     // | 1 0 0 0 |
@@ -126,6 +131,23 @@ mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar)
     return m;
 } 
 
+mat4_t mat4_make_perspective_reversed_z(float fov, float aspect, float znear, float zfar)
+{
+    // Same as above, but z/w goes from 1 at the near plane to 0 at the far plane,
+    // which puts the dense float values next to zero at the far distances.
+    // | (h/w)*1/tan(fov/2)             0              0                 0 |
+    // |                  0  1/tan(fov/2)              0                 0 |
+    // |                  0             0     zn/(zn-zf)  (-zf*zn)/(zn-zf) |
+    // |                  0             0              1                 0 |
+    mat4_t m = {{{ 0 }}};
+    m.m[0][0] = aspect * (1 / tan(fov / 2));
+    m.m[1][1] = 1 / tan(fov / 2);
+    m.m[2][2] = znear / (znear - zfar);
+    m.m[2][3] = (-zfar * znear) / (znear - zfar);
+    m.m[3][2] = 1.0;
+    return m;
+}
+
 vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v)
 {
     // multiply the projection matrix by our original vector
@@ -163,4 +185,339 @@ mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up)
 		}
     };
     return view_matrix;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Batched vertex transforms
+///////////////////////////////////////////////////////////////////////////////
+// The kernels below run the same math as mat4_mul_vec4() over many vertices
+// at once. Positions come in as three separate streams (x[], y[], z[]) so one
+// register holds the same component of 4, 8 or 16 vertices and every matrix
+// element is a broadcast. W is always 1 on input.
+//
+// mat4_mul_points_batch() expects an affine matrix (world, view, ...) and
+// writes x, y, z only.
+//
+// mat4_project_points_batch() fuses the full model-view-projection multiply,
+// the perspective divide, and the viewport transform:
+//
+//   clip   = MVP * (x, y, z, 1)
+//   ndc    = clip.xyz / clip.w              (skipped when clip.w == 0)
+//   screen = ( ndc.x * hw + hw,
+//             -ndc.y * hh + hh,             (y flipped, it grows downwards)
+//              ndc.z,
+//              clip.w )
+///////////////////////////////////////////////////////////////////////////////
+typedef void (*mul_points_fn)(
+    const mat4_t* m, const float* x, const float* y, const float* z, int count,
+    float* out_x, float* out_y, float* out_z
+);
+typedef void (*project_points_fn)(
+    const mat4_t* mvp, const float* x, const float* y, const float* z, int count,
+    float half_width, float half_height,
+    float* out_x, float* out_y, float* out_z, float* out_w
+);
+
+static void mat4_mul_points_scalar(
+    const mat4_t* m, const float* x, const float* y, const float* z, int count,
+    float* out_x, float* out_y, float* out_z
+) {
+    for (int i = 0; i < count; i++)
+    {
+        out_x[i] = m->m[0][0] * x[i] + m->m[0][1] * y[i] + m->m[0][2] * z[i] + m->m[0][3];
+        out_y[i] = m->m[1][0] * x[i] + m->m[1][1] * y[i] + m->m[1][2] * z[i] + m->m[1][3];
+        out_z[i] = m->m[2][0] * x[i] + m->m[2][1] * y[i] + m->m[2][2] * z[i] + m->m[2][3];
+    }
+}
+
+static void mat4_project_points_scalar(
+    const mat4_t* mvp, const float* x, const float* y, const float* z, int count,
+    float half_width, float half_height,
+    float* out_x, float* out_y, float* out_z, float* out_w
+) {
+    const mat4_t* m = mvp;
+    for (int i = 0; i < count; i++)
+    {
+        float cx = m->m[0][0] * x[i] + m->m[0][1] * y[i] + m->m[0][2] * z[i] + m->m[0][3];
+        float cy = m->m[1][0] * x[i] + m->m[1][1] * y[i] + m->m[1][2] * z[i] + m->m[1][3];
+        float cz = m->m[2][0] * x[i] + m->m[2][1] * y[i] + m->m[2][2] * z[i] + m->m[2][3];
+        float cw = m->m[3][0] * x[i] + m->m[3][1] * y[i] + m->m[3][2] * z[i] + m->m[3][3];
+
+        float inv_w = (cw != 0) ? 1 / cw : 1;
+
+        out_x[i] = cx * inv_w * half_width + half_width;
+        out_y[i] = half_height - cy * inv_w * half_height;
+        out_z[i] = cz * inv_w;
+        out_w[i] = cw;
+    }
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("sse2")
+static void mat4_mul_points_sse2(
+    const mat4_t* m, const float* x, const float* y, const float* z, int count,
+    float* out_x, float* out_y, float* out_z
+) {
+    __m128 r[3][4];
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            r[row][col] = _mm_set1_ps(m->m[row][col]);
+        }
+    }
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+
+        __m128 tx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[0][0], vx), _mm_mul_ps(r[0][1], vy)), _mm_add_ps(_mm_mul_ps(r[0][2], vz), r[0][3]));
+        __m128 ty = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[1][0], vx), _mm_mul_ps(r[1][1], vy)), _mm_add_ps(_mm_mul_ps(r[1][2], vz), r[1][3]));
+        __m128 tz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[2][0], vx), _mm_mul_ps(r[2][1], vy)), _mm_add_ps(_mm_mul_ps(r[2][2], vz), r[2][3]));
+
+        _mm_storeu_ps(out_x + i, tx);
+        _mm_storeu_ps(out_y + i, ty);
+        _mm_storeu_ps(out_z + i, tz);
+    }
+    mat4_mul_points_scalar(m, x + i, y + i, z + i, count - i, out_x + i, out_y + i, out_z + i);
+}
+
+SIMD_TARGET("sse2")
+static void mat4_project_points_sse2(
+    const mat4_t* mvp, const float* x, const float* y, const float* z, int count,
+    float half_width, float half_height,
+    float* out_x, float* out_y, float* out_z, float* out_w
+) {
+    __m128 r[4][4];
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            r[row][col] = _mm_set1_ps(mvp->m[row][col]);
+        }
+    }
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 hw = _mm_set1_ps(half_width);
+    const __m128 hh = _mm_set1_ps(half_height);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        __m128 vz = _mm_loadu_ps(z + i);
+
+        __m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[0][0], vx), _mm_mul_ps(r[0][1], vy)), _mm_add_ps(_mm_mul_ps(r[0][2], vz), r[0][3]));
+        __m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[1][0], vx), _mm_mul_ps(r[1][1], vy)), _mm_add_ps(_mm_mul_ps(r[1][2], vz), r[1][3]));
+        __m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[2][0], vx), _mm_mul_ps(r[2][1], vy)), _mm_add_ps(_mm_mul_ps(r[2][2], vz), r[2][3]));
+        __m128 cw = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[3][0], vx), _mm_mul_ps(r[3][1], vy)), _mm_add_ps(_mm_mul_ps(r[3][2], vz), r[3][3]));
+
+        // inv_w = (w != 0) ? 1 / w : 1
+        __m128 nonzero = _mm_cmpneq_ps(cw, zero);
+        __m128 inv_w = _mm_or_ps(_mm_and_ps(nonzero, _mm_div_ps(one, cw)), _mm_andnot_ps(nonzero, one));
+
+        _mm_storeu_ps(out_x + i, _mm_add_ps(_mm_mul_ps(_mm_mul_ps(cx, inv_w), hw), hw));
+        _mm_storeu_ps(out_y + i, _mm_sub_ps(hh, _mm_mul_ps(_mm_mul_ps(cy, inv_w), hh)));
+        _mm_storeu_ps(out_z + i, _mm_mul_ps(cz, inv_w));
+        _mm_storeu_ps(out_w + i, cw);
+    }
+    mat4_project_points_scalar(mvp, x + i, y + i, z + i, count - i, half_width, half_height, out_x + i, out_y + i, out_z + i, out_w + i);
+}
+
+SIMD_TARGET("avx2,fma")
+static void mat4_mul_points_avx2(
+    const mat4_t* m, const float* x, const float* y, const float* z, int count,
+    float* out_x, float* out_y, float* out_z
+) {
+    __m256 r[3][4];
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            r[row][col] = _mm256_set1_ps(m->m[row][col]);
+        }
+    }
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 vz = _mm256_loadu_ps(z + i);
+
+        __m256 tx = _mm256_fmadd_ps(r[0][0], vx, _mm256_fmadd_ps(r[0][1], vy, _mm256_fmadd_ps(r[0][2], vz, r[0][3])));
+        __m256 ty = _mm256_fmadd_ps(r[1][0], vx, _mm256_fmadd_ps(r[1][1], vy, _mm256_fmadd_ps(r[1][2], vz, r[1][3])));
+        __m256 tz = _mm256_fmadd_ps(r[2][0], vx, _mm256_fmadd_ps(r[2][1], vy, _mm256_fmadd_ps(r[2][2], vz, r[2][3])));
+
+        _mm256_storeu_ps(out_x + i, tx);
+        _mm256_storeu_ps(out_y + i, ty);
+        _mm256_storeu_ps(out_z + i, tz);
+    }
+    mat4_mul_points_scalar(m, x + i, y + i, z + i, count - i, out_x + i, out_y + i, out_z + i);
+}
+
+SIMD_TARGET("avx2,fma")
+static void mat4_project_points_avx2(
+    const mat4_t* mvp, const float* x, const float* y, const float* z, int count,
+    float half_width, float half_height,
+    float* out_x, float* out_y, float* out_z, float* out_w
+) {
+    __m256 r[4][4];
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            r[row][col] = _mm256_set1_ps(mvp->m[row][col]);
+        }
+    }
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 hw = _mm256_set1_ps(half_width);
+    const __m256 hh = _mm256_set1_ps(half_height);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        __m256 vz = _mm256_loadu_ps(z + i);
+
+        __m256 cx = _mm256_fmadd_ps(r[0][0], vx, _mm256_fmadd_ps(r[0][1], vy, _mm256_fmadd_ps(r[0][2], vz, r[0][3])));
+        __m256 cy = _mm256_fmadd_ps(r[1][0], vx, _mm256_fmadd_ps(r[1][1], vy, _mm256_fmadd_ps(r[1][2], vz, r[1][3])));
+        __m256 cz = _mm256_fmadd_ps(r[2][0], vx, _mm256_fmadd_ps(r[2][1], vy, _mm256_fmadd_ps(r[2][2], vz, r[2][3])));
+        __m256 cw = _mm256_fmadd_ps(r[3][0], vx, _mm256_fmadd_ps(r[3][1], vy, _mm256_fmadd_ps(r[3][2], vz, r[3][3])));
+
+        __m256 nonzero = _mm256_cmp_ps(cw, zero, _CMP_NEQ_UQ);
+        __m256 inv_w = _mm256_blendv_ps(one, _mm256_div_ps(one, cw), nonzero);
+
+        _mm256_storeu_ps(out_x + i, _mm256_fmadd_ps(_mm256_mul_ps(cx, inv_w), hw, hw));
+        _mm256_storeu_ps(out_y + i, _mm256_fnmadd_ps(_mm256_mul_ps(cy, inv_w), hh, hh));
+        _mm256_storeu_ps(out_z + i, _mm256_mul_ps(cz, inv_w));
+        _mm256_storeu_ps(out_w + i, cw);
+    }
+    mat4_project_points_scalar(mvp, x + i, y + i, z + i, count - i, half_width, half_height, out_x + i, out_y + i, out_z + i, out_w + i);
+}
+
+SIMD_TARGET("avx512f")
+static void mat4_mul_points_avx512(
+    const mat4_t* m, const float* x, const float* y, const float* z, int count,
+    float* out_x, float* out_y, float* out_z
+) {
+    __m512 r[3][4];
+    for (int row = 0; row < 3; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            r[row][col] = _mm512_set1_ps(m->m[row][col]);
+        }
+    }
+
+    // The last partial group of vertices is handled with masked loads and stores
+    for (int i = 0; i < count; i += 16)
+    {
+        int remaining = count - i;
+        __mmask16 mask = (remaining >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1);
+
+        __m512 vx = _mm512_maskz_loadu_ps(mask, x + i);
+        __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+        __m512 vz = _mm512_maskz_loadu_ps(mask, z + i);
+
+        __m512 tx = _mm512_fmadd_ps(r[0][0], vx, _mm512_fmadd_ps(r[0][1], vy, _mm512_fmadd_ps(r[0][2], vz, r[0][3])));
+        __m512 ty = _mm512_fmadd_ps(r[1][0], vx, _mm512_fmadd_ps(r[1][1], vy, _mm512_fmadd_ps(r[1][2], vz, r[1][3])));
+        __m512 tz = _mm512_fmadd_ps(r[2][0], vx, _mm512_fmadd_ps(r[2][1], vy, _mm512_fmadd_ps(r[2][2], vz, r[2][3])));
+
+        _mm512_mask_storeu_ps(out_x + i, mask, tx);
+        _mm512_mask_storeu_ps(out_y + i, mask, ty);
+        _mm512_mask_storeu_ps(out_z + i, mask, tz);
+    }
+}
+
+SIMD_TARGET("avx512f")
+static void mat4_project_points_avx512(
+    const mat4_t* mvp, const float* x, const float* y, const float* z, int count,
+    float half_width, float half_height,
+    float* out_x, float* out_y, float* out_z, float* out_w
+) {
+    __m512 r[4][4];
+    for (int row = 0; row < 4; row++)
+    {
+        for (int col = 0; col < 4; col++)
+        {
+            r[row][col] = _mm512_set1_ps(mvp->m[row][col]);
+        }
+    }
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 hw = _mm512_set1_ps(half_width);
+    const __m512 hh = _mm512_set1_ps(half_height);
+
+    for (int i = 0; i < count; i += 16)
+    {
+        int remaining = count - i;
+        __mmask16 mask = (remaining >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1);
+
+        __m512 vx = _mm512_maskz_loadu_ps(mask, x + i);
+        __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+        __m512 vz = _mm512_maskz_loadu_ps(mask, z + i);
+
+        __m512 cx = _mm512_fmadd_ps(r[0][0], vx, _mm512_fmadd_ps(r[0][1], vy, _mm512_fmadd_ps(r[0][2], vz, r[0][3])));
+        __m512 cy = _mm512_fmadd_ps(r[1][0], vx, _mm512_fmadd_ps(r[1][1], vy, _mm512_fmadd_ps(r[1][2], vz, r[1][3])));
+        __m512 cz = _mm512_fmadd_ps(r[2][0], vx, _mm512_fmadd_ps(r[2][1], vy, _mm512_fmadd_ps(r[2][2], vz, r[2][3])));
+        __m512 cw = _mm512_fmadd_ps(r[3][0], vx, _mm512_fmadd_ps(r[3][1], vy, _mm512_fmadd_ps(r[3][2], vz, r[3][3])));
+
+        __mmask16 nonzero = _mm512_cmp_ps_mask(cw, zero, _CMP_NEQ_UQ);
+        __m512 inv_w = _mm512_mask_div_ps(one, nonzero, one, cw);
+
+        _mm512_mask_storeu_ps(out_x + i, mask, _mm512_fmadd_ps(_mm512_mul_ps(cx, inv_w), hw, hw));
+        _mm512_mask_storeu_ps(out_y + i, mask, _mm512_fnmadd_ps(_mm512_mul_ps(cy, inv_w), hh, hh));
+        _mm512_mask_storeu_ps(out_z + i, mask, _mm512_mul_ps(cz, inv_w));
+        _mm512_mask_storeu_ps(out_w + i, mask, cw);
+    }
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Pick the widest kernel the CPU supports, once
+///////////////////////////////////////////////////////////////////////////////
+static mul_points_fn select_mul_points_kernel(void)
+{
+#if defined(SIMD_X86)
+    if (cpu_has_avx512f()) return mat4_mul_points_avx512;
+    if (cpu_has_avx2()) return mat4_mul_points_avx2;
+    if (cpu_has_sse2()) return mat4_mul_points_sse2;
+#endif
+    return mat4_mul_points_scalar;
+}
+
+static project_points_fn select_project_points_kernel(void)
+{
+#if defined(SIMD_X86)
+    if (cpu_has_avx512f()) return mat4_project_points_avx512;
+    if (cpu_has_avx2()) return mat4_project_points_avx2;
+    if (cpu_has_sse2()) return mat4_project_points_sse2;
+#endif
+    return mat4_project_points_scalar;
+}
+
+void mat4_mul_points_batch(
+    const mat4_t* m, const float* x, const float* y, const float* z, int count,
+    float* out_x, float* out_y, float* out_z
+) {
+    static const mul_points_fn kernel = select_mul_points_kernel();
+    kernel(m, x, y, z, count, out_x, out_y, out_z);
+}
+
+void mat4_project_points_batch(
+    const mat4_t* mvp, const float* x, const float* y, const float* z, int count,
+    float half_width, float half_height,
+    float* out_x, float* out_y, float* out_z, float* out_w
+) {
+    static const project_points_fn kernel = select_project_points_kernel();
+    kernel(mvp, x, y, z, count, half_width, half_height, out_x, out_y, out_z, out_w);
 }
\ No newline at end of file
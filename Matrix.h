@@ -15,8 +15,22 @@ mat4_t mat4_make_rotation_x(float angle);
 mat4_t mat4_make_rotation_y(float angle);
 mat4_t mat4_make_rotation_z(float angle);
 mat4_t mat4_make_perspective(float fov, float aspect, float znear, float zfar);
+mat4_t mat4_make_perspective_reversed_z(float fov, float aspect, float znear, float zfar);
 mat4_t mat4_mul_mat4(mat4_t a, mat4_t b);
 vec4_t mat4_mul_vec4_project(mat4_t mat_proj, vec4_t v);
 mat4_t mat4_look_at(vec3_t eye, vec3_t target, vec3_t up);
 
+////////////////////////////////////////////////////////////////////////////////
+// Batched transforms over structure-of-arrays position streams (x[], y[], z[])
+////////////////////////////////////////////////////////////////////////////////
+void mat4_mul_points_batch(
+    const mat4_t* m, const float* x, const float* y, const float* z, int count,
+    float* out_x, float* out_y, float* out_z
+);
+void mat4_project_points_batch(
+    const mat4_t* mvp, const float* x, const float* y, const float* z, int count,
+    float half_width, float half_height,
+    float* out_x, float* out_y, float* out_z, float* out_w
+);
+
 #endif
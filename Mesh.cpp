@@ -1,28 +1,214 @@
 ﻿#include <iostream>
+#include <new>
 #include <string>
 #include <cstdlib>
 #include <vector>
+#include <unordered_map>
 
 #include "Mesh.h"
+#include "Simd.h"
+#include "VertexCache.h"
 
 #define MAX_NUM_MESHES 10
+#define MAX_THREADED_TEXTURE_BYTES (16 * 1024 * 1024) // 2048x2048 RGBA
+#define MAX_TEXTURE_DIMENSION 16384 // 1GB RGBA
 static mesh_t meshes[MAX_NUM_MESHES];
 static int mesh_count = 0;
 
-void load_mesh(const char* obj_filename, const char* png_filename, vec3_t scale, vec3_t translation, vec3_t rotation)
+int add_mesh(vec3_t scale, vec3_t translation, vec3_t rotation)
 {
-    load_mesh_obj_data(&meshes[mesh_count], obj_filename);
-    load_mesh_png_data(&meshes[mesh_count], png_filename);
+    if (mesh_count == MAX_NUM_MESHES)
+    {
+        return -1;
+    }
+
+    mesh_t* mesh = &meshes[mesh_count];
+    mesh->layout = MESH_LAYOUT_AOS;
+    mesh->texture = get_placeholder_texture();
+    mesh->scale = scale;
+    mesh->translation = translation;
+    mesh->rotation = rotation;
+
+    return mesh_count++;
+}
+
+void load_mesh(const char* obj_filename, const char* png_filename, vec3_t scale, vec3_t translation, vec3_t rotation, int load_flags)
+{
+    int mesh_index = add_mesh(scale, translation, rotation);
+    if (mesh_index < 0)
+    {
+        fprintf(stderr, "Error loading %s: too many meshes\n", obj_filename);
+        return;
+    }
+
+    load_mesh_obj_data(&meshes[mesh_index], obj_filename, load_flags);
+    set_mesh_texture(mesh_index, load_png_texture(png_filename, load_flags));
+}
+
+static void allocate_position_stream(mesh_t* mesh, int count)
+{
+    mesh->positions.x = (float*)simd_aligned_alloc(sizeof(float) * count);
+    mesh->positions.y = (float*)simd_aligned_alloc(sizeof(float) * count);
+    mesh->positions.z = (float*)simd_aligned_alloc(sizeof(float) * count);
+    mesh->positions.count = count;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Split the loaded vertices into separate x, y, and z streams
+///////////////////////////////////////////////////////////////////////////////
+static void build_position_stream(mesh_t* mesh)
+{
+    int count = (int)mesh->vertices.size();
+
+    allocate_position_stream(mesh, count);
+
+    for (int i = 0; i < count; i++)
+    {
+        mesh->positions.x[i] = mesh->vertices[i].x;
+        mesh->positions.y[i] = mesh->vertices[i].y;
+        mesh->positions.z[i] = mesh->vertices[i].z;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Build a GPU-style indexed vertex buffer out of the OBJ face corners
+///////////////////////////////////////////////////////////////////////////////
+// OBJ faces index positions and texture coordinates separately. Every unique
+// (position index, texcoord index) pair becomes one vertex of the buffer with
+// its own position and UV, and the faces turn into a 32-bit index buffer.
+// Corners shared between faces then map to the same vertex, so it is stored
+// and transformed once no matter how many faces use it.
+//
+//   corners: (1/1) (2/2) (3/3)  (1/1) (3/3) (4/4)
+//   vertices:  0     1     2                  3
+//   indices:   0 1 2   0 2 3
+///////////////////////////////////////////////////////////////////////////////
+static void build_indexed_vertex_buffer(
+    mesh_t* mesh,
+    const std::vector<vec3_t>& obj_positions,
+    const std::vector<tex2_t>& obj_texcoords,
+    const std::vector<int>& corners // (position index, texcoord index) pairs, 1-based as in the OBJ
+) {
+    int num_corners = (int)corners.size() / 2;
+    int num_faces = num_corners / 3;
+
+    std::unordered_map<uint64_t, uint32_t> vertex_lookup;
+    vertex_lookup.reserve(num_corners);
+
+    std::vector<uint32_t> first_corner_of_vertex;
+    first_corner_of_vertex.reserve(num_corners);
+
+    mesh->face_streams.indices = (uint32_t*)simd_aligned_alloc(sizeof(uint32_t) * 3 * num_faces);
+    mesh->face_streams.colors = (uint32_t*)simd_aligned_alloc(sizeof(uint32_t) * num_faces);
+    mesh->face_streams.count = num_faces;
+
+    for (int i = 0; i < num_faces * 3; i++)
+    {
+        uint64_t key = ((uint64_t)(uint32_t)corners[i * 2] << 32) | (uint32_t)corners[i * 2 + 1];
+
+        auto found = vertex_lookup.find(key);
+        if (found == vertex_lookup.end())
+        {
+            uint32_t new_vertex = (uint32_t)first_corner_of_vertex.size();
+            found = vertex_lookup.emplace(key, new_vertex).first;
+            first_corner_of_vertex.push_back(i);
+        }
+        mesh->face_streams.indices[i] = found->second;
+    }
+
+    for (int f = 0; f < num_faces; f++)
+    {
+        mesh->face_streams.colors[f] = 0xFFFFFFFF;
+    }
+
+    int num_vertices = (int)first_corner_of_vertex.size();
+    allocate_position_stream(mesh, num_vertices);
+    mesh->vertex_texcoords = (tex2_t*)simd_aligned_alloc(sizeof(tex2_t) * num_vertices);
+
+    for (int v = 0; v < num_vertices; v++)
+    {
+        int corner = first_corner_of_vertex[v];
+        int position_index = corners[corner * 2] - 1;
+        int texcoord_index = corners[corner * 2 + 1] - 1;
+
+        mesh->positions.x[v] = obj_positions[position_index].x;
+        mesh->positions.y[v] = obj_positions[position_index].y;
+        mesh->positions.z[v] = obj_positions[position_index].z;
+
+        // Faces without texture coordinates get (0, 0)
+        tex2_t texcoord = { 0, 0 };
+        if (texcoord_index >= 0 && texcoord_index < (int)obj_texcoords.size())
+        {
+            texcoord = obj_texcoords[texcoord_index];
+        }
+        mesh->vertex_texcoords[v] = texcoord;
+    }
+
+    mesh->layout = MESH_LAYOUT_SOA;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reorder the faces for post-transform vertex reuse, then the vertices for
+// fetch locality, and report the average cache miss ratio before and after
+///////////////////////////////////////////////////////////////////////////////
+static void optimize_mesh_vertex_cache(mesh_t* mesh, const char* obj_filename)
+{
+    face_stream_t* faces = &mesh->face_streams;
+    int num_faces = faces->count;
+    int num_vertices = mesh->positions.count;
+
+    float acmr_before = compute_acmr(faces->indices, num_faces, num_vertices, VERTEX_CACHE_SIZE);
+
+    // Faces: the index buffer and the per-face colors move together
+    std::vector<int> face_order(num_faces);
+    optimize_vertex_cache(faces->indices, num_faces, num_vertices, face_order.data());
+
+    std::vector<uint32_t> old_indices(faces->indices, faces->indices + num_faces * 3);
+    std::vector<uint32_t> old_colors(faces->colors, faces->colors + num_faces);
+    for (int f = 0; f < num_faces; f++)
+    {
+        int source = face_order[f];
+        faces->indices[f * 3 + 0] = old_indices[source * 3 + 0];
+        faces->indices[f * 3 + 1] = old_indices[source * 3 + 1];
+        faces->indices[f * 3 + 2] = old_indices[source * 3 + 2];
+        faces->colors[f] = old_colors[source];
+    }
+
+    // Vertices: positions and texcoords follow the new numbering
+    std::vector<int> vertex_remap(num_vertices);
+    optimize_vertex_fetch(faces->indices, num_faces, num_vertices, vertex_remap.data());
+
+    std::vector<float> old_x(mesh->positions.x, mesh->positions.x + num_vertices);
+    std::vector<float> old_y(mesh->positions.y, mesh->positions.y + num_vertices);
+    std::vector<float> old_z(mesh->positions.z, mesh->positions.z + num_vertices);
+    std::vector<tex2_t> old_texcoords(mesh->vertex_texcoords, mesh->vertex_texcoords + num_vertices);
+    for (int v = 0; v < num_vertices; v++)
+    {
+        int target = vertex_remap[v];
+        if (target < 0)
+        {
+            continue;
+        }
+        mesh->positions.x[target] = old_x[v];
+        mesh->positions.y[target] = old_y[v];
+        mesh->positions.z[target] = old_z[v];
+        mesh->vertex_texcoords[target] = old_texcoords[v];
+    }
 
-    meshes[mesh_count].scale = scale;
-    meshes[mesh_count].translation = translation;
-    meshes[mesh_count].rotation = rotation;
+    float acmr_after = compute_acmr(faces->indices, num_faces, num_vertices, VERTEX_CACHE_SIZE);
 
-    mesh_count++;
+    printf("%s: %d faces, %d vertices, ACMR %.3f -> %.3f\n", obj_filename, num_faces, num_vertices, acmr_before, acmr_after);
 }
 
-void load_mesh_obj_data(mesh_t* mesh, const char* obj_filename)
+void load_mesh_obj_data(mesh_t* mesh, const char* obj_filename, int load_flags)
 {
+    mesh->layout = MESH_LAYOUT_AOS;
+
+    bool indexed = (load_flags & (MESH_LOAD_SOA | MESH_LOAD_OPTIMIZE_VERTEX_CACHE)) != 0;
+
+    std::vector<tex2_t> texcoords;
+    std::vector<int> corners;
+
     FILE* file;
     // Linux:
     // file = fopen(filename, "r");
@@ -30,8 +216,6 @@ void load_mesh_obj_data(mesh_t* mesh, const char* obj_filename)
     {
         char line[1024];
 
-        std::vector<tex2_t> texcoords;
-
         while (fgets(line, 1024, file))
         {
             // Vertex information
@@ -59,6 +243,18 @@ void load_mesh_obj_data(mesh_t* mesh, const char* obj_filename)
                     &vertex_indices[1], &texture_indices[1], &normal_indices[1],
                     &vertex_indices[2], &texture_indices[2], &normal_indices[2]
                 );
+
+                if (indexed)
+                {
+                    // Keep the raw index pairs, the vertex buffer is built once the whole file is read
+                    for (int j = 0; j < 3; j++)
+                    {
+                        corners.push_back(vertex_indices[j]);
+                        corners.push_back(texture_indices[j]);
+                    }
+                    continue;
+                }
+
                 face_t face = {
                     .a = vertex_indices[0],
                     .b = vertex_indices[1],
@@ -74,37 +270,100 @@ void load_mesh_obj_data(mesh_t* mesh, const char* obj_filename)
 
         fclose(file);
     }
+
+    if (indexed)
+    {
+        build_indexed_vertex_buffer(mesh, mesh->vertices, texcoords, corners);
+        std::vector<vec3_t>().swap(mesh->vertices);
+
+        if (load_flags & MESH_LOAD_OPTIMIZE_VERTEX_CACHE)
+        {
+            optimize_mesh_vertex_cache(mesh, obj_filename);
+        }
+    }
+    else
+    {
+        build_position_stream(mesh);
+    }
 }
 
-void load_mesh_png_data(mesh_t* mesh, const char* png_filename)
+lodepng_texture_t* load_png_texture(const char* png_filename, int load_flags)
 {
-    std::vector<unsigned char> image; // The raw pixels, 4 bytes per pixel.
-    unsigned char* png_texture = NULL;
     unsigned texture_width = 64;
     unsigned texture_height = 64;
+    uint32_t* png_texture = NULL;
 
-    unsigned error = lodepng::decode(image, texture_width, texture_height, png_filename);
-
-    mesh->texture = new lodepng_texture_t;
-
-    if (mesh->texture)
+    lodepng::State state;
+    if (load_flags & MESH_LOAD_TRUSTED_TEXTURE)
     {
-        mesh->texture->width = texture_width;
-        mesh->texture->height = texture_height;
+        state.decoder.ignore_crc = 1;
+        state.decoder.zlibsettings.ignore_adler32 = 1;
+    }
 
-        // Convert 4 bytes per pixel into matrix.
-        uint32_t* png_texture = new uint32_t[image.size()];
-        int pointer = 0;
-        for (size_t i = 0; i < image.size()-4 && pointer < image.size(); i+=4)
+    // The texture is decoded straight into its own pixels: the file is read a
+    // piece at a time and every scanline is converted to RGBA as soon as it is
+    // inflated, so besides the texture only a window of about 100KB is used.
+    // Textures up to MAX_THREADED_TEXTURE_BYTES are decoded on all hardware
+    // threads instead, from the whole file in memory: inflate, unfilter and
+    // the conversion overlap, for about twice the texture size in memory
+    // while it lasts. The RGBA bytes of a pixel make the uint32_t
+    // R | G << 8 | B << 16 | A << 24.
+    unsigned width, height;
+    unsigned error = lodepng_inspect_file(&width, &height, &state, png_filename);
+    size_t num_pixels = 0;
+    if (!error)
+    {
+        // A corrupt header must not be able to ask for any amount of memory
+        num_pixels = (size_t)width * height;
+        if (width > MAX_TEXTURE_DIMENSION || height > MAX_TEXTURE_DIMENSION)
+        {
+            error = 92; // too large image
+        }
+        else if (!(png_texture = new (std::nothrow) uint32_t[num_pixels]))
+        {
+            error = 83; // alloc fail
+        }
+    }
+    if (!error)
+    {
+        if (num_pixels * sizeof(uint32_t) <= MAX_THREADED_TEXTURE_BYTES)
         {
-            png_texture[pointer++] = (uint32_t)(
-                (uint32_t)image[i] |
-                (uint32_t)image[i+1] << 8 |
-                (uint32_t)image[i+2] << 16 |
-                (uint32_t)image[i+3] << 24);
+            state.decoder.num_threads = 0;
         }
-        mesh->texture->png_texture = png_texture;
+        error = lodepng_decode_file_into((unsigned char*)png_texture, num_pixels * sizeof(uint32_t), &width, &height, &state, png_filename);
+    }
+
+    if (error)
+    {
+        fprintf(stderr, "Error loading %s: %s\n", png_filename, lodepng_error_text(error));
+        delete[] png_texture;
+        png_texture = new uint32_t[texture_width * texture_height]();
+    }
+    else
+    {
+        texture_width = width;
+        texture_height = height;
+    }
+
+    lodepng_texture_t* texture = new lodepng_texture_t();
+    texture->format = TEXTURE_FORMAT_RGBA32;
+    texture->width = texture_width;
+    texture->height = texture_height;
+    texture->png_texture = png_texture;
+
+    if (!error && (load_flags & MESH_LOAD_COMPRESS_TEXTURE))
+    {
+        size_t rgba_size = get_texture_size(texture);
+        compress_texture(texture);
+        printf("%s: %s, %.2f MB instead of %.2f MB\n", png_filename, (texture->format == TEXTURE_FORMAT_BC1) ? "BC1" : "BC3",
+            get_texture_size(texture) / (1024.0 * 1024.0), rgba_size / (1024.0 * 1024.0));
     }
+    return texture;
+}
+
+void load_mesh_png_data(mesh_t* mesh, const char* png_filename, int load_flags)
+{
+    mesh->texture = load_png_texture(png_filename, load_flags);
 }
 
 int get_num_meshes(void)
@@ -132,12 +391,134 @@ void rotate_mesh_z(int mesh_index, float angle)
     meshes[mesh_index].rotation.z += angle;
 }
 
+static void free_mesh_geometry(mesh_t* mesh)
+{
+    std::vector<face_t>().swap(mesh->faces);
+    std::vector<vec3_t>().swap(mesh->vertices);
+    simd_aligned_free(mesh->positions.x);
+    simd_aligned_free(mesh->positions.y);
+    simd_aligned_free(mesh->positions.z);
+    mesh->positions = { NULL, NULL, NULL, 0 };
+    simd_aligned_free(mesh->vertex_texcoords);
+    mesh->vertex_texcoords = NULL;
+    simd_aligned_free(mesh->face_streams.indices);
+    simd_aligned_free(mesh->face_streams.colors);
+    mesh->face_streams = { NULL, NULL, 0 };
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Swap in geometry and textures loaded somewhere else. Only call these
+// between frames: the geometry stage reads the meshes while it runs.
+///////////////////////////////////////////////////////////////////////////////
+void set_mesh_geometry(int mesh_index, mesh_t* loaded)
+{
+    mesh_t* mesh = &meshes[mesh_index];
+
+    free_mesh_geometry(mesh);
+    mesh->vertices.swap(loaded->vertices);
+    mesh->faces.swap(loaded->faces);
+    mesh->positions = loaded->positions;
+    mesh->vertex_texcoords = loaded->vertex_texcoords;
+    mesh->face_streams = loaded->face_streams;
+    mesh->layout = loaded->layout;
+
+    // loaded is left empty, the streams belong to the mesh now
+    loaded->positions = { NULL, NULL, NULL, 0 };
+    loaded->vertex_texcoords = NULL;
+    loaded->face_streams = { NULL, NULL, 0 };
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A replaced texture may still be sampled by the frame rasterized next,
+// from triangles built before the swap (pipelined frames), so it is only
+// freed at the following swap point, one frame later.
+///////////////////////////////////////////////////////////////////////////////
+static std::vector<lodepng_texture_t*> retired_textures;
+
+void set_mesh_texture(int mesh_index, lodepng_texture_t* texture)
+{
+    if (meshes[mesh_index].texture != NULL && meshes[mesh_index].texture != get_placeholder_texture())
+    {
+        retired_textures.push_back(meshes[mesh_index].texture);
+    }
+    meshes[mesh_index].texture = texture;
+}
+
+void free_retired_mesh_textures(void)
+{
+    for (size_t i = 0; i < retired_textures.size(); i++)
+    {
+        free_texture(retired_textures[i]);
+    }
+    retired_textures.clear();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Texture coordinates, from the faces or the vertex buffer of the layout
+///////////////////////////////////////////////////////////////////////////////
+static bool tex2_in_unit_square(tex2_t uv)
+{
+    return uv.u >= 0.0f && uv.u <= 1.0f && uv.v >= 0.0f && uv.v <= 1.0f;
+}
+
+bool mesh_texcoords_in_unit_square(const mesh_t* mesh)
+{
+    if (mesh->layout == MESH_LAYOUT_SOA)
+    {
+        for (int i = 0; i < mesh->positions.count; i++)
+        {
+            if (!tex2_in_unit_square(mesh->vertex_texcoords[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < mesh->faces.size(); i++)
+    {
+        const face_t* face = &mesh->faces[i];
+        if (!tex2_in_unit_square(face->a_uv) || !tex2_in_unit_square(face->b_uv) || !tex2_in_unit_square(face->c_uv))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// uv * scale + offset, per component
+static void scale_tex2(tex2_t* uv, tex2_t scale, tex2_t offset)
+{
+    uv->u = uv->u * scale.u + offset.u;
+    uv->v = uv->v * scale.v + offset.v;
+}
+
+void transform_mesh_texcoords(mesh_t* mesh, tex2_t scale, tex2_t offset)
+{
+    if (mesh->layout == MESH_LAYOUT_SOA)
+    {
+        for (int i = 0; i < mesh->positions.count; i++)
+        {
+            scale_tex2(&mesh->vertex_texcoords[i], scale, offset);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < mesh->faces.size(); i++)
+    {
+        scale_tex2(&mesh->faces[i].a_uv, scale, offset);
+        scale_tex2(&mesh->faces[i].b_uv, scale, offset);
+        scale_tex2(&mesh->faces[i].c_uv, scale, offset);
+    }
+}
+
 void free_meshes(void)
 {
     for (int i = 0; i < mesh_count; i++) 
     {
         free_texture(meshes[i].texture);
-        meshes[i].faces.clear();
-        meshes[i].vertices.clear();
+        meshes[i].texture = NULL;
+        free_mesh_geometry(&meshes[i]);
     }
-}
\ No newline at end of file
+    free_retired_mesh_textures();
+}
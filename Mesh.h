@@ -2,26 +2,75 @@
 #define MESH_H
 
 #include <stdbool.h>
+#include <vector>
 
 #include "Vector.h"
 #include "Triangle.h"
 #include "Texture.h"
 
+////////////////////////////////////////////////////////////////////////////////
+// Vertex positions as separate aligned x[], y[], z[] streams (SoA) for the
+// batched vertex transforms
+////////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    float* x;
+    float* y;
+    float* z;
+    int count;
+} position_stream_t;
+
+////////////////////////////////////////////////////////////////////////////////
+// Faces as separate aligned streams: the index buffer apart from the attributes
+////////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    uint32_t* indices;  // 3 indices per face into the vertex buffer
+    uint32_t* colors;   // 1 color per face
+    int count;
+} face_stream_t;
+
+// How the mesh keeps its faces in memory
+enum mesh_layout {
+    MESH_LAYOUT_AOS, // faces[] (face_t) and vertices[] (vec3_t)
+    MESH_LAYOUT_SOA  // indexed vertex buffer: positions + vertex_texcoords, and face_streams
+};
+
+// Options for load_mesh(), load_mesh_obj_data() and load_mesh_png_data()
+enum mesh_load_flags {
+    MESH_LOAD_DEFAULT = 0,
+    MESH_LOAD_SOA = 1 << 0,
+    MESH_LOAD_OPTIMIZE_VERTEX_CACHE = 1 << 1, // reorder faces and vertices for reuse, implies MESH_LOAD_SOA
+    MESH_LOAD_TRUSTED_TEXTURE = 1 << 2, // skip the CRC and Adler-32 checks of the PNG, for assets we wrote ourselves
+    MESH_LOAD_COMPRESS_TEXTURE = 1 << 3 // keep the texture block compressed in memory, BC1 or BC3 if it has alpha
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Define a struct for dynamic size meshes, with array of vertices and faces
 ////////////////////////////////////////////////////////////////////////////////
 typedef struct {
     std::vector<vec3_t> vertices; // dynamic array of vertices
     std::vector<face_t> faces;    // dynamic array of faces
+    position_stream_t positions;  // SoA copy of the vertices
+    tex2_t* vertex_texcoords;     // per vertex texture coordinates, used with MESH_LAYOUT_SOA
+    face_stream_t face_streams;   // SoA faces, used with MESH_LAYOUT_SOA
+    int layout;                   // one of mesh_layout
     lodepng_texture_t* texture;    // mesh PNG texture pointer
     vec3_t rotation;  // rotation with x, y, and z values
     vec3_t scale;       // scale with x, y, and z values
     vec3_t translation; // translation with x, y, and z values
 } mesh_t;
 
-void load_mesh(const char* obj_filename, const char* png_filename, vec3_t scale, vec3_t translation, vec3_t rotation);
-void load_mesh_obj_data(mesh_t* mesh, const char* obj_filename);
-void load_mesh_png_data(mesh_t* mesh, const char* png_filename);
+int add_mesh(vec3_t scale, vec3_t translation, vec3_t rotation); // no geometry yet and the placeholder texture, -1 when full
+void load_mesh(const char* obj_filename, const char* png_filename, vec3_t scale, vec3_t translation, vec3_t rotation, int load_flags);
+void load_mesh_obj_data(mesh_t* mesh, const char* obj_filename, int load_flags);
+void load_mesh_png_data(mesh_t* mesh, const char* png_filename, int load_flags);
+lodepng_texture_t* load_png_texture(const char* png_filename, int load_flags);
+
+void set_mesh_geometry(int mesh_index, mesh_t* loaded); // takes over the faces and vertices of loaded
+void set_mesh_texture(int mesh_index, lodepng_texture_t* texture);
+void free_retired_mesh_textures(void); // the textures replaced before the previous frame
+
+bool mesh_texcoords_in_unit_square(const mesh_t* mesh);
+void transform_mesh_texcoords(mesh_t* mesh, tex2_t scale, tex2_t offset); // uv * scale + offset
 
 int get_num_meshes(void);
 mesh_t* get_mesh(int index);
@@ -32,4 +81,48 @@ void rotate_mesh_z(int mesh_index, float angle);
 
 void free_meshes(void);
 
+////////////////////////////////////////////////////////////////////////////////
+// Face accessors for the geometry loop. They only touch the stream asked for,
+// so with MESH_LAYOUT_SOA culled faces never pull their UVs or color in.
+////////////////////////////////////////////////////////////////////////////////
+inline int get_mesh_num_faces(const mesh_t* mesh)
+{
+    return (mesh->layout == MESH_LAYOUT_SOA) ? mesh->face_streams.count : (int)mesh->faces.size();
+}
+
+inline void get_mesh_face_indices(const mesh_t* mesh, int face, int indices[3])
+{
+    if (mesh->layout == MESH_LAYOUT_SOA)
+    {
+        const uint32_t* face_indices = &mesh->face_streams.indices[face * 3];
+        indices[0] = (int)face_indices[0];
+        indices[1] = (int)face_indices[1];
+        indices[2] = (int)face_indices[2];
+        return;
+    }
+    indices[0] = mesh->faces[face].a - 1;
+    indices[1] = mesh->faces[face].b - 1;
+    indices[2] = mesh->faces[face].c - 1;
+}
+
+inline void get_mesh_face_texcoords(const mesh_t* mesh, int face, tex2_t texcoords[3])
+{
+    if (mesh->layout == MESH_LAYOUT_SOA)
+    {
+        const uint32_t* face_indices = &mesh->face_streams.indices[face * 3];
+        texcoords[0] = mesh->vertex_texcoords[face_indices[0]];
+        texcoords[1] = mesh->vertex_texcoords[face_indices[1]];
+        texcoords[2] = mesh->vertex_texcoords[face_indices[2]];
+        return;
+    }
+    texcoords[0] = mesh->faces[face].a_uv;
+    texcoords[1] = mesh->faces[face].b_uv;
+    texcoords[2] = mesh->faces[face].c_uv;
+}
+
+inline uint32_t get_mesh_face_color(const mesh_t* mesh, int face)
+{
+    return (mesh->layout == MESH_LAYOUT_SOA) ? mesh->face_streams.colors[face] : mesh->faces[face].color;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,200 @@
+#include "PngBenchmark.h"
+#include "lodepng.h"
+
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// PNG decoding microbenchmark
+///////////////////////////////////////////////////////////////////////////////
+// Inflate is timed on its own, on the IDAT chunks glued together the way
+// the decoder sees them, and reported as decompressed bytes per second:
+// once with the multi-symbol fast path and once symbol by symbol
+// (disable_fast_inflate), with the speedup against the 2x target.
+// The whole decode (inflate, unfilter, conversion to RGBA) is timed with
+// one thread and with all hardware threads, and once more without the CRC
+// and Adler-32 checks (MESH_LOAD_TRUSTED_TEXTURE). The streamed decode from
+// the file into a preallocated texture, which is what load_png_texture()
+// does for textures too large for the threaded decode, is timed as well. Every figure is the fastest of all iterations,
+// which filters out the noise of other processes.
+///////////////////////////////////////////////////////////////////////////////
+static double seconds_since(uint64_t start)
+{
+    return (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+}
+
+static bool collect_idat_data(const std::vector<unsigned char>& png, std::vector<unsigned char>* zlib_data)
+{
+    const unsigned char* end = png.data() + png.size();
+    const unsigned char* chunk = png.data() + 8; // after the PNG signature
+    while (chunk + 12 <= end)
+    {
+        unsigned length = lodepng_chunk_length(chunk);
+        if (length > (size_t)(end - chunk) - 12)
+        {
+            return false;
+        }
+        if (lodepng_chunk_type_equals(chunk, "IDAT"))
+        {
+            const unsigned char* data = lodepng_chunk_data_const(chunk);
+            zlib_data->insert(zlib_data->end(), data, data + length);
+        }
+        if (lodepng_chunk_type_equals(chunk, "IEND"))
+        {
+            break;
+        }
+        chunk = lodepng_chunk_next_const(chunk, end);
+    }
+    return !zlib_data->empty();
+}
+
+static double time_inflate(const std::vector<unsigned char>& zlib_data, const LodePNGDecompressSettings* settings,
+                           int iterations, size_t* inflated_size)
+{
+    double best = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        unsigned char* inflated = NULL;
+        size_t size = 0;
+        uint64_t start = SDL_GetPerformanceCounter();
+        unsigned error = lodepng_zlib_decompress(&inflated, &size, zlib_data.data(), zlib_data.size(), settings);
+        double seconds = seconds_since(start);
+        free(inflated);
+        if (error)
+        {
+            fprintf(stderr, "Inflate failed: %s\n", lodepng_error_text(error));
+            return -1.0;
+        }
+        *inflated_size = size;
+        if (seconds < best)
+        {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+static double time_decode(const std::vector<unsigned char>& png, unsigned num_threads, bool verify, int iterations)
+{
+    double best = 1e30;
+    for (int i = 0; i < iterations; i++)
+    {
+        std::vector<unsigned char> image;
+        unsigned width, height;
+        lodepng::State state;
+        state.decoder.num_threads = num_threads;
+        state.decoder.ignore_crc = verify ? 0 : 1;
+        state.decoder.zlibsettings.ignore_adler32 = verify ? 0 : 1;
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        unsigned error = lodepng::decode(image, width, height, state, png);
+        double seconds = seconds_since(start);
+        if (error)
+        {
+            fprintf(stderr, "PNG decode failed: %s\n", lodepng_error_text(error));
+            return -1.0;
+        }
+        if (seconds < best)
+        {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+static double time_decode_into(const char* filename, int iterations)
+{
+    double best = 1e30;
+    std::vector<unsigned char> texture;
+    for (int i = 0; i < iterations; i++)
+    {
+        unsigned width, height;
+        lodepng::State state;
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        unsigned error = lodepng_inspect_file(&width, &height, &state, filename);
+        if (!error)
+        {
+            texture.resize(lodepng_get_raw_size(width, height, &state.info_raw));
+            error = lodepng_decode_file_into(texture.data(), texture.size(), &width, &height, &state, filename);
+        }
+        double seconds = seconds_since(start);
+        if (error)
+        {
+            fprintf(stderr, "PNG decode failed: %s\n", lodepng_error_text(error));
+            return -1.0;
+        }
+        if (seconds < best)
+        {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+bool run_png_benchmark(const char* filename, int iterations)
+{
+    std::vector<unsigned char> png;
+    unsigned error = lodepng::load_file(png, filename);
+    if (error)
+    {
+        fprintf(stderr, "Could not read %s: %s\n", filename, lodepng_error_text(error));
+        return false;
+    }
+    if (iterations < 1)
+    {
+        iterations = 1;
+    }
+
+    unsigned width, height;
+    lodepng::State state;
+    error = lodepng_inspect(&width, &height, &state, png.data(), png.size());
+    std::vector<unsigned char> zlib_data;
+    if (error || !collect_idat_data(png, &zlib_data))
+    {
+        fprintf(stderr, "%s is not a valid PNG\n", filename);
+        return false;
+    }
+
+    LodePNGDecompressSettings symbol_by_symbol = lodepng_default_decompress_settings;
+    symbol_by_symbol.disable_fast_inflate = 1;
+    size_t inflated_size = 0;
+    double best_inflate = time_inflate(zlib_data, &lodepng_default_decompress_settings, iterations, &inflated_size);
+    double best_inflate_slow = time_inflate(zlib_data, &symbol_by_symbol, iterations, &inflated_size);
+    if (best_inflate < 0.0 || best_inflate_slow < 0.0)
+    {
+        return false;
+    }
+
+    double best_single = time_decode(png, 1, true, iterations);
+    double best_threaded = time_decode(png, 0, true, iterations);
+    double best_unchecked = time_decode(png, 0, false, iterations);
+    double best_streamed = time_decode_into(filename, iterations);
+    if (best_single < 0.0 || best_threaded < 0.0 || best_unchecked < 0.0 || best_streamed < 0.0)
+    {
+        return false;
+    }
+
+    printf("%s: %ux%u, %zu bytes deflated, %zu bytes inflated, best of %d\n",
+        filename, width, height, zlib_data.size(), inflated_size, iterations);
+    double speedup = best_inflate_slow / best_inflate;
+    printf("  inflate, fast:     %8.3f ms  %8.1f MB/s\n",
+        best_inflate * 1000.0, (double)inflated_size / best_inflate / 1e6);
+    printf("  inflate, symbols:  %8.3f ms  %8.1f MB/s\n",
+        best_inflate_slow * 1000.0, (double)inflated_size / best_inflate_slow / 1e6);
+    if (speedup >= 2.0)
+    {
+        printf("  inflate speedup:   %8.2fx, meets the 2x target\n", speedup);
+    }
+    else
+    {
+        printf("  inflate speedup:   %8.2fx, %.0f%% short of the 2x target\n", speedup, (2.0 - speedup) / 2.0 * 100.0);
+    }
+    printf("  decode, 1 thread:  %8.3f ms\n", best_single * 1000.0);
+    printf("  decode, threaded:  %8.3f ms\n", best_threaded * 1000.0);
+    printf("  without checksums: %8.3f ms\n", best_unchecked * 1000.0);
+    printf("  streamed, file:    %8.3f ms\n", best_streamed * 1000.0);
+    return true;
+}
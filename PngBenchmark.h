@@ -0,0 +1,11 @@
+#ifndef PNG_BENCHMARK_H
+#define PNG_BENCHMARK_H
+
+#include <stdbool.h>
+
+// Decodes the PNG file over and over and prints how fast its zlib stream
+// inflates and how long a whole decode takes, single and multi-threaded,
+// with and without checksum verification.
+bool run_png_benchmark(const char* filename, int iterations);
+
+#endif
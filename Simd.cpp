@@ -0,0 +1,224 @@
+#include "Simd.h"
+
+#include <stdlib.h>
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(SIMD_X86)
+#include <immintrin.h>
+#endif
+
+typedef struct {
+    bool sse2;
+    bool ssse3;
+    bool sse41;
+    bool pclmul;
+    bool avx2;
+    bool avx512f;
+} cpu_features_t;
+
+///////////////////////////////////////////////////////////////////////////////
+// Query CPUID once. AVX and AVX-512 also need the OS to save the wide
+// registers on context switches, which is what XGETBV reports.
+///////////////////////////////////////////////////////////////////////////////
+static cpu_features_t detect_cpu_features(void)
+{
+    cpu_features_t features = { false, false, false, false, false, false };
+
+#if defined(SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool os_saves_ymm = false;
+    bool os_saves_zmm = false;
+    if (info[2] & (1 << 27)) // OSXSAVE
+    {
+        unsigned long long xcr0 = _xgetbv(0);
+        os_saves_ymm = (xcr0 & 0x06) == 0x06;
+        os_saves_zmm = (xcr0 & 0xE6) == 0xE6;
+    }
+    features.sse2 = (info[3] & (1 << 26)) != 0;
+    features.ssse3 = (info[2] & (1 << 9)) != 0;
+    features.sse41 = (info[2] & (1 << 19)) != 0;
+    features.pclmul = (info[2] & (1 << 1)) != 0;
+    bool fma = (info[2] & (1 << 12)) != 0;
+
+    if (max_leaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        features.avx2 = os_saves_ymm && fma && (info[1] & (1 << 5)) != 0;
+        features.avx512f = os_saves_zmm && (info[1] & (1 << 16)) != 0;
+    }
+#elif defined(SIMD_X86)
+    __builtin_cpu_init();
+    features.sse2 = __builtin_cpu_supports("sse2");
+    features.ssse3 = __builtin_cpu_supports("ssse3");
+    features.sse41 = __builtin_cpu_supports("sse4.1");
+    features.pclmul = __builtin_cpu_supports("pclmul");
+    features.avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    features.avx512f = __builtin_cpu_supports("avx512f");
+#endif
+
+    return features;
+}
+
+static const cpu_features_t& get_cpu_features(void)
+{
+    static const cpu_features_t features = detect_cpu_features();
+    return features;
+}
+
+bool cpu_has_sse2(void)
+{
+    return get_cpu_features().sse2;
+}
+
+bool cpu_has_ssse3(void)
+{
+    return get_cpu_features().ssse3;
+}
+
+bool cpu_has_sse41(void)
+{
+    return get_cpu_features().sse41;
+}
+
+bool cpu_has_pclmul(void)
+{
+    return get_cpu_features().pclmul;
+}
+
+bool cpu_has_avx2(void)
+{
+    return get_cpu_features().avx2;
+}
+
+bool cpu_has_avx512f(void)
+{
+    return get_cpu_features().avx512f;
+}
+
+void* simd_aligned_alloc(size_t size)
+{
+    // aligned_alloc() wants the size to be a multiple of the alignment
+    size = (size + SIMD_ALIGNMENT - 1) & ~(size_t)(SIMD_ALIGNMENT - 1);
+    if (size == 0)
+    {
+        size = SIMD_ALIGNMENT;
+    }
+#if defined(_MSC_VER)
+    return _aligned_malloc(size, SIMD_ALIGNMENT);
+#else
+    return aligned_alloc(SIMD_ALIGNMENT, size);
+#endif
+}
+
+void simd_aligned_free(void* ptr)
+{
+#if defined(_MSC_VER)
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Buffer fill with wide stores. Buffers larger than the caches are written
+// with non-temporal (streaming) stores: they go straight to memory without
+// first reading every line into the cache and evicting everything else.
+// Smaller buffers stay with regular stores so the data is still cached.
+///////////////////////////////////////////////////////////////////////////////
+#define STREAMING_FILL_THRESHOLD (4 * 1024 * 1024) // bytes
+
+typedef void (*fill_u32_fn)(uint32_t* dst, uint32_t value, size_t count);
+
+static void fill_u32_scalar(uint32_t* dst, uint32_t value, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        dst[i] = value;
+    }
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("sse2")
+static void fill_u32_sse2(uint32_t* dst, uint32_t value, size_t count)
+{
+    // Scalar head up to the first 16 byte boundary
+    size_t i = 0;
+    for (; i < count && ((uintptr_t)(dst + i) & 15) != 0; i++)
+    {
+        dst[i] = value;
+    }
+
+    __m128i v = _mm_set1_epi32((int)value);
+    bool streaming = count * sizeof(uint32_t) >= STREAMING_FILL_THRESHOLD;
+    if (streaming)
+    {
+        for (; i + 16 <= count; i += 16)
+        {
+            _mm_stream_si128((__m128i*)(dst + i), v);
+            _mm_stream_si128((__m128i*)(dst + i + 4), v);
+            _mm_stream_si128((__m128i*)(dst + i + 8), v);
+            _mm_stream_si128((__m128i*)(dst + i + 12), v);
+        }
+        // Streaming stores are weakly ordered: make them visible before anybody reads the buffer
+        _mm_sfence();
+    }
+    for (; i + 4 <= count; i += 4)
+    {
+        _mm_store_si128((__m128i*)(dst + i), v);
+    }
+    fill_u32_scalar(dst + i, value, count - i);
+}
+
+SIMD_TARGET("avx2")
+static void fill_u32_avx2(uint32_t* dst, uint32_t value, size_t count)
+{
+    // Scalar head up to the first 32 byte boundary
+    size_t i = 0;
+    for (; i < count && ((uintptr_t)(dst + i) & 31) != 0; i++)
+    {
+        dst[i] = value;
+    }
+
+    __m256i v = _mm256_set1_epi32((int)value);
+    bool streaming = count * sizeof(uint32_t) >= STREAMING_FILL_THRESHOLD;
+    if (streaming)
+    {
+        for (; i + 32 <= count; i += 32)
+        {
+            _mm256_stream_si256((__m256i*)(dst + i), v);
+            _mm256_stream_si256((__m256i*)(dst + i + 8), v);
+            _mm256_stream_si256((__m256i*)(dst + i + 16), v);
+            _mm256_stream_si256((__m256i*)(dst + i + 24), v);
+        }
+        _mm_sfence();
+    }
+    for (; i + 8 <= count; i += 8)
+    {
+        _mm256_store_si256((__m256i*)(dst + i), v);
+    }
+    fill_u32_scalar(dst + i, value, count - i);
+}
+
+#endif
+
+static fill_u32_fn select_fill_u32_kernel(void)
+{
+#if defined(SIMD_X86)
+    if (cpu_has_avx2()) return fill_u32_avx2;
+    if (cpu_has_sse2()) return fill_u32_sse2;
+#endif
+    return fill_u32_scalar;
+}
+
+void simd_fill_u32(uint32_t* dst, uint32_t value, size_t count)
+{
+    static const fill_u32_fn kernel = select_fill_u32_kernel();
+    kernel(dst, value, count);
+}
@@ -0,0 +1,44 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#endif
+
+// MSVC lets any function use any intrinsic, GCC and Clang need every function
+// that uses instructions above the baseline target to opt in explicitly.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define SIMD_TARGET(isa)
+#else
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+// Alignment of the buffers handed to the SIMD kernels (one AVX-512 register / one cache line)
+#define SIMD_ALIGNMENT 64
+
+////////////////////////////////////////////////////////////////////////////////
+// Runtime CPU feature detection
+////////////////////////////////////////////////////////////////////////////////
+bool cpu_has_sse2(void);
+bool cpu_has_ssse3(void);
+bool cpu_has_sse41(void);
+bool cpu_has_pclmul(void);
+bool cpu_has_avx2(void);
+bool cpu_has_avx512f(void);
+
+////////////////////////////////////////////////////////////////////////////////
+// Aligned memory for SIMD streams
+////////////////////////////////////////////////////////////////////////////////
+void* simd_aligned_alloc(size_t size);
+void simd_aligned_free(void* ptr);
+
+////////////////////////////////////////////////////////////////////////////////
+// Fill large buffers (framebuffer clears)
+////////////////////////////////////////////////////////////////////////////////
+void simd_fill_u32(uint32_t* dst, uint32_t value, size_t count);
+
+#endif
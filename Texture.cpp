@@ -1,6 +1,7 @@
 #include "Texture.h"
 
 #include <stdlib.h>
+#include <atomic>
 
 tex2_t tex2_clone(tex2_t* t)
 {
@@ -8,8 +9,382 @@ tex2_t tex2_clone(tex2_t* t)
     return result;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// 1x1 opaque grey texture the meshes use until their own one is loaded.
+// It is shared and never freed.
+///////////////////////////////////////////////////////////////////////////////
+static uint32_t placeholder_pixel = 0xFF808080;
+static lodepng_texture_t placeholder_texture = { 1, 1, &placeholder_pixel, TEXTURE_FORMAT_RGBA32, NULL, 0, 0, 0 };
+
+lodepng_texture_t* get_placeholder_texture(void)
+{
+    return &placeholder_texture;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Block compression
+///////////////////////////////////////////////////////////////////////////////
+// The BC formats keep every 4x4 texels in a fixed size block, the layout
+// GPUs sample from:
+//  - the color half is two RGB565 endpoints and a 2-bit index per texel
+//    into the endpoints and two colors in between (8 bytes),
+//  - BC3 adds an alpha half before it: two 8-bit endpoints and a 3-bit
+//    index per texel into them and six values in between (8 bytes).
+// That is 8 times less memory than RGBA32 with BC1 and 4 times less with
+// BC3, and as many times less memory traffic while sampling.
+///////////////////////////////////////////////////////////////////////////////
+thread_local decoded_block_t texture_block_cache[TEXTURE_BLOCK_CACHE_SIZE];
+
+// 0 marks the empty cache entries
+static std::atomic<uint32_t> next_texture_id(1);
+
+static inline uint32_t make_texel(int r, int g, int b, int a)
+{
+    return (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+}
+
+static inline int texel_channel(uint32_t texel, int channel)
+{
+    return (int)((texel >> (channel * 8)) & 0xFF);
+}
+
+static inline uint16_t pack_rgb565(const int rgb[3])
+{
+    return (uint16_t)(((rgb[0] >> 3) << 11) | ((rgb[1] >> 2) << 5) | (rgb[2] >> 3));
+}
+
+static inline void unpack_rgb565(uint16_t color, int rgb[3])
+{
+    int r = (color >> 11) & 31;
+    int g = (color >> 5) & 63;
+    int b = color & 31;
+
+    // Replicate the top bits into the bottom ones, so 31 and 63 become 255
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The 4 colors the indices of a color block select from. BC3 always uses 4
+// colors, BC1 uses 3 and transparent black when the first endpoint is not
+// the larger one.
+///////////////////////////////////////////////////////////////////////////////
+static void decode_color_palette(const uint8_t* block, bool four_colors, uint32_t palette[4])
+{
+    uint16_t color0 = (uint16_t)(block[0] | (block[1] << 8));
+    uint16_t color1 = (uint16_t)(block[2] | (block[3] << 8));
+    int c0[3];
+    int c1[3];
+    unpack_rgb565(color0, c0);
+    unpack_rgb565(color1, c1);
+
+    palette[0] = make_texel(c0[0], c0[1], c0[2], 255);
+    palette[1] = make_texel(c1[0], c1[1], c1[2], 255);
+    if (four_colors || color0 > color1)
+    {
+        palette[2] = make_texel((2 * c0[0] + c1[0]) / 3, (2 * c0[1] + c1[1]) / 3, (2 * c0[2] + c1[2]) / 3, 255);
+        palette[3] = make_texel((c0[0] + 2 * c1[0]) / 3, (c0[1] + 2 * c1[1]) / 3, (c0[2] + 2 * c1[2]) / 3, 255);
+    }
+    else
+    {
+        palette[2] = make_texel((c0[0] + c1[0]) / 2, (c0[1] + c1[1]) / 2, (c0[2] + c1[2]) / 2, 255);
+        palette[3] = 0;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The 8 values the indices of an alpha block select from
+///////////////////////////////////////////////////////////////////////////////
+static void decode_alpha_palette(const uint8_t* block, int palette[8])
+{
+    int a0 = block[0];
+    int a1 = block[1];
+
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1)
+    {
+        for (int i = 1; i < 7; i++)
+        {
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+        }
+    }
+    else
+    {
+        for (int i = 1; i < 5; i++)
+        {
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        }
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+static void decode_color_block(const uint8_t* block, bool four_colors, uint32_t texels[16])
+{
+    uint32_t palette[4];
+    decode_color_palette(block, four_colors, palette);
+
+    uint32_t indices = (uint32_t)block[4] | ((uint32_t)block[5] << 8) | ((uint32_t)block[6] << 16) | ((uint32_t)block[7] << 24);
+    for (int i = 0; i < 16; i++)
+    {
+        texels[i] = palette[(indices >> (i * 2)) & 3];
+    }
+}
+
+static void decode_alpha_block(const uint8_t* block, uint32_t texels[16])
+{
+    int palette[8];
+    decode_alpha_palette(block, palette);
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 6; i++)
+    {
+        indices |= (uint64_t)block[2 + i] << (i * 8);
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        int alpha = palette[(indices >> (i * 3)) & 7];
+        texels[i] = (texels[i] & 0x00FFFFFF) | ((uint32_t)alpha << 24);
+    }
+}
+
+void decode_texture_block(const lodepng_texture_t* t, uint32_t block, decoded_block_t* decoded)
+{
+    if (t->format == TEXTURE_FORMAT_BC1)
+    {
+        decode_color_block(t->blocks + (size_t)block * 8, false, decoded->texels);
+    }
+    else
+    {
+        const uint8_t* data = t->blocks + (size_t)block * 16;
+        decode_color_block(data + 8, true, decoded->texels);
+        decode_alpha_block(data, decoded->texels);
+    }
+    decoded->texture_id = t->id;
+    decoded->block = block;
+}
+
+static inline int color_distance(uint32_t a, uint32_t b)
+{
+    int dr = texel_channel(a, 0) - texel_channel(b, 0);
+    int dg = texel_channel(a, 1) - texel_channel(b, 1);
+    int db = texel_channel(a, 2) - texel_channel(b, 2);
+    return dr * dr + dg * dg + db * db;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Encode the colors of 16 texels. The endpoints are the corners of their
+// bounding box, moved in by 1/16 of the range so that a single outlier
+// does not spread the other colors out. The box diagonal goes the way the
+// colors do: a channel that falls while green rises runs from max to min.
+///////////////////////////////////////////////////////////////////////////////
+static void encode_color_block(const uint32_t texels[16], uint8_t* block)
+{
+    int min[3] = { 255, 255, 255 };
+    int max[3] = { 0, 0, 0 };
+    int sum[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            int value = texel_channel(texels[i], c);
+            min[c] = (value < min[c]) ? value : min[c];
+            max[c] = (value > max[c]) ? value : max[c];
+            sum[c] += value;
+        }
+    }
+
+    // Covariance of red and blue with green, times 16 * 16
+    int covariance[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++)
+    {
+        int green = texel_channel(texels[i], 1) * 16 - sum[1];
+        covariance[0] += (texel_channel(texels[i], 0) * 16 - sum[0]) * green;
+        covariance[2] += (texel_channel(texels[i], 2) * 16 - sum[2]) * green;
+    }
+
+    int end0[3];
+    int end1[3];
+    for (int c = 0; c < 3; c++)
+    {
+        int inset = (max[c] - min[c]) >> 4;
+        end0[c] = max[c] - inset;
+        end1[c] = min[c] + inset;
+        if (covariance[c] < 0)
+        {
+            int swap = end0[c];
+            end0[c] = end1[c];
+            end1[c] = swap;
+        }
+    }
+
+    // Four colors take the larger endpoint first
+    uint16_t color0 = pack_rgb565(end0);
+    uint16_t color1 = pack_rgb565(end1);
+    if (color0 < color1)
+    {
+        uint16_t swap = color0;
+        color0 = color1;
+        color1 = swap;
+    }
+    block[0] = (uint8_t)color0;
+    block[1] = (uint8_t)(color0 >> 8);
+    block[2] = (uint8_t)color1;
+    block[3] = (uint8_t)(color1 >> 8);
+
+    uint32_t palette[4];
+    decode_color_palette(block, true, palette);
+
+    uint32_t indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best = 0;
+        int best_distance = color_distance(texels[i], palette[0]);
+        for (int p = 1; p < 4; p++)
+        {
+            int distance = color_distance(texels[i], palette[p]);
+            if (distance < best_distance)
+            {
+                best = p;
+                best_distance = distance;
+            }
+        }
+        indices |= (uint32_t)best << (i * 2);
+    }
+    block[4] = (uint8_t)indices;
+    block[5] = (uint8_t)(indices >> 8);
+    block[6] = (uint8_t)(indices >> 16);
+    block[7] = (uint8_t)(indices >> 24);
+}
+
+static void encode_alpha_block(const uint32_t texels[16], uint8_t* block)
+{
+    int min = 255;
+    int max = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int alpha = texel_channel(texels[i], 3);
+        min = (alpha < min) ? alpha : min;
+        max = (alpha > max) ? alpha : max;
+    }
+
+    // With the larger endpoint first the six values in between are interpolated
+    block[0] = (uint8_t)max;
+    block[1] = (uint8_t)min;
+
+    int palette[8];
+    decode_alpha_palette(block, palette);
+
+    uint64_t indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int alpha = texel_channel(texels[i], 3);
+        int best = 0;
+        int best_distance = abs(alpha - palette[0]);
+        for (int p = 1; p < 8; p++)
+        {
+            int distance = abs(alpha - palette[p]);
+            if (distance < best_distance)
+            {
+                best = p;
+                best_distance = distance;
+            }
+        }
+        indices |= (uint64_t)best << (i * 3);
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        block[2 + i] = (uint8_t)(indices >> (i * 8));
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Turn an RGBA32 texture into BC1, or into BC3 if any texel is not opaque,
+// and free its RGBA32 texels. Blocks over the right and bottom edges repeat
+// the last column and row.
+///////////////////////////////////////////////////////////////////////////////
+void compress_texture(lodepng_texture_t* t)
+{
+    if (t == NULL || t->format != TEXTURE_FORMAT_RGBA32 || t == &placeholder_texture)
+    {
+        return;
+    }
+
+    size_t num_texels = (size_t)t->width * t->height;
+    bool opaque = true;
+    for (size_t i = 0; i < num_texels && opaque; i++)
+    {
+        opaque = (t->png_texture[i] >> 24) == 0xFF;
+    }
+
+    unsigned int blocks_x = (t->width + 3) / 4;
+    unsigned int blocks_y = (t->height + 3) / 4;
+    size_t block_size = opaque ? 8 : 16;
+    uint8_t* blocks = new uint8_t[(size_t)blocks_x * blocks_y * block_size];
+
+    uint8_t* block = blocks;
+    for (unsigned int block_y = 0; block_y < blocks_y; block_y++)
+    {
+        for (unsigned int block_x = 0; block_x < blocks_x; block_x++)
+        {
+            uint32_t texels[16];
+            for (unsigned int y = 0; y < 4; y++)
+            {
+                unsigned int texel_y = block_y * 4 + y;
+                texel_y = (texel_y < t->height) ? texel_y : t->height - 1;
+                for (unsigned int x = 0; x < 4; x++)
+                {
+                    unsigned int texel_x = block_x * 4 + x;
+                    texel_x = (texel_x < t->width) ? texel_x : t->width - 1;
+                    texels[y * 4 + x] = t->png_texture[(size_t)texel_y * t->width + texel_x];
+                }
+            }
+
+            if (opaque)
+            {
+                encode_color_block(texels, block);
+            }
+            else
+            {
+                encode_alpha_block(texels, block);
+                encode_color_block(texels, block + 8);
+            }
+            block += block_size;
+        }
+    }
+
+    delete[] t->png_texture;
+    t->png_texture = NULL;
+    t->format = opaque ? TEXTURE_FORMAT_BC1 : TEXTURE_FORMAT_BC3;
+    t->blocks = blocks;
+    t->blocks_x = blocks_x;
+    t->id = next_texture_id++;
+}
+
+size_t get_texture_size(const lodepng_texture_t* t)
+{
+    if (t->format == TEXTURE_FORMAT_RGBA32)
+    {
+        return (size_t)t->width * t->height * sizeof(uint32_t);
+    }
+    size_t blocks_y = (t->height + 3) / 4;
+    return (size_t)t->blocks_x * blocks_y * ((t->format == TEXTURE_FORMAT_BC1) ? 8 : 16);
+}
+
 void free_texture(lodepng_texture_t* t)
 {
+    if (t == NULL || t == &placeholder_texture)
+    {
+        return;
+    }
+    if (t->references > 1)
+    {
+        t->references--;
+        return;
+    }
     delete[] t->png_texture;
+    delete[] t->blocks;
     delete t;
-}
\ No newline at end of file
+}
@@ -1,5 +1,6 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
+#include <stddef.h>
 #include <stdint.h>
 #include "lodepng.h"
 
@@ -8,15 +9,76 @@ typedef struct {
     float v;
 } tex2_t;
 
+// How a texture keeps its texels in memory
+enum texture_format {
+    TEXTURE_FORMAT_RGBA32, // png_texture: one R | G << 8 | B << 16 | A << 24 per texel
+    TEXTURE_FORMAT_BC1,    // blocks: 8 bytes per 4x4 texels, opaque
+    TEXTURE_FORMAT_BC3     // blocks: 16 bytes per 4x4 texels, with alpha
+};
+
 typedef struct
 {
     unsigned int width;
     unsigned int height;
-    uint32_t* png_texture;
+    uint32_t* png_texture;  // the texels with TEXTURE_FORMAT_RGBA32, NULL otherwise
+    int format;             // one of texture_format
+    uint8_t* blocks;        // the 4x4 texel blocks row by row with the BC formats, NULL otherwise
+    unsigned int blocks_x;  // blocks per row
+    uint32_t id;            // tells the textures apart in the decoded block caches
+    int references;         // meshes sharing the texture, free_texture() frees it with the last one; 0 counts as 1
 } lodepng_texture_t;
 
 tex2_t tex2_clone(tex2_t* t);
 
+lodepng_texture_t* get_placeholder_texture(void);
+
+void compress_texture(lodepng_texture_t* t);
+size_t get_texture_size(const lodepng_texture_t* t);
+
 void free_texture(lodepng_texture_t* t);
 
-#endif
\ No newline at end of file
+////////////////////////////////////////////////////////////////////////////////
+// Decoded block cache
+////////////////////////////////////////////////////////////////////////////////
+// Every thread keeps the last 4x4 blocks it decoded, mapped by the low bits
+// of their block coordinates: a 32x32 texel window of the texture. The texels
+// a triangle samples are close together, so most samples of a compressed
+// texture are a lookup here and a block is decoded about once per triangle
+// that uses it.
+////////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    uint32_t texture_id; // 0 for an empty entry
+    uint32_t block;      // block index in the texture
+    uint32_t texels[16]; // row by row
+} decoded_block_t;
+
+#define TEXTURE_BLOCK_CACHE_BITS 3
+#define TEXTURE_BLOCK_CACHE_SIZE (1 << (2 * TEXTURE_BLOCK_CACHE_BITS))
+
+extern thread_local decoded_block_t texture_block_cache[TEXTURE_BLOCK_CACHE_SIZE];
+
+void decode_texture_block(const lodepng_texture_t* t, uint32_t block, decoded_block_t* decoded);
+
+////////////////////////////////////////////////////////////////////////////////
+// Texel (x, y) of the texture, 0 <= x < width and 0 <= y < height
+////////////////////////////////////////////////////////////////////////////////
+inline uint32_t sample_texture(const lodepng_texture_t* t, unsigned int x, unsigned int y)
+{
+    if (t->format == TEXTURE_FORMAT_RGBA32)
+    {
+        return t->png_texture[(t->width * y) + x];
+    }
+
+    unsigned int block_x = x >> 2;
+    unsigned int block_y = y >> 2;
+    uint32_t block = (block_y * t->blocks_x) + block_x;
+    unsigned int mask = (1 << TEXTURE_BLOCK_CACHE_BITS) - 1;
+    decoded_block_t* decoded = &texture_block_cache[((block_y & mask) << TEXTURE_BLOCK_CACHE_BITS) | (block_x & mask)];
+    if (decoded->texture_id != t->id || decoded->block != block)
+    {
+        decode_texture_block(t, block, decoded);
+    }
+    return decoded->texels[((y & 3) << 2) | (x & 3)];
+}
+
+#endif
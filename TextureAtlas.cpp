@@ -0,0 +1,197 @@
+#include "TextureAtlas.h"
+#include "Mesh.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Texture atlas
+///////////////////////////////////////////////////////////////////////////////
+// Every mesh samples its own texture, so the triangles of a frame jump
+// between as many textures as there are meshes. build_texture_atlas()
+// copies the small textures into a few shared pages and moves the texture
+// coordinates of their meshes to match: the meshes then sample one page.
+// The pages are filled shelf by shelf, the tallest textures first, and are
+// cut down to the power of two sizes around the area used: with those the
+// scaled coordinates round the same way as the texture's own did, so a
+// coordinate on a texel edge still lands on the same texel. Each texture
+// keeps a border of padding texels repeating its edge, so that coordinates
+// rounded to just outside of it, like u = 1, still read its own texels and
+// not those of a neighbour.
+//
+// Only RGBA32 textures of meshes whose coordinates stay inside [0, 1] go
+// in: the rasterizer repeats a texture outside of it, which a part of a
+// page cannot do.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    int mesh_index;
+    int width;  // with the padding
+    int height;
+    int page;
+    int x;      // of the padded area in the page
+    int y;
+} atlas_entry_t;
+
+typedef struct {
+    int width;  // used so far
+    int height;
+    int shelf_x;
+    int shelf_y;
+    int shelf_height;
+} atlas_page_t;
+
+void init_texture_atlas_settings(texture_atlas_settings_t* settings)
+{
+    settings->page_size = 2048;
+    settings->max_texture_size = 512;
+    settings->padding = 2;
+}
+
+static unsigned int page_dimension(int used, int page_size)
+{
+    unsigned int size = 1;
+    while ((int)size < used)
+    {
+        size *= 2;
+    }
+    return ((int)size < page_size) ? size : (unsigned int)page_size;
+}
+
+static bool can_go_in_atlas(const mesh_t* mesh, const texture_atlas_settings_t* settings)
+{
+    const lodepng_texture_t* texture = mesh->texture;
+    return texture != NULL && texture != get_placeholder_texture() &&
+        texture->format == TEXTURE_FORMAT_RGBA32 && texture->references <= 1 &&
+        (int)texture->width <= settings->max_texture_size &&
+        (int)texture->height <= settings->max_texture_size &&
+        mesh_texcoords_in_unit_square(mesh);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Next fit on shelves: a texture goes to the right of the previous one, or
+// on a new shelf above it, or on a new page
+///////////////////////////////////////////////////////////////////////////////
+static void place_in_pages(std::vector<atlas_entry_t>& entries, std::vector<atlas_page_t>& pages, int page_size)
+{
+    std::stable_sort(entries.begin(), entries.end(), [](const atlas_entry_t& a, const atlas_entry_t& b) {
+        return a.height > b.height;
+    });
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        atlas_entry_t* entry = &entries[i];
+        atlas_page_t* page = pages.empty() ? NULL : &pages.back();
+
+        if (page != NULL && page->shelf_x + entry->width > page_size)
+        {
+            page->shelf_y += page->shelf_height;
+            page->shelf_x = 0;
+            page->shelf_height = 0;
+        }
+        if (page == NULL || page->shelf_y + entry->height > page_size)
+        {
+            pages.push_back({ 0, 0, 0, 0, 0 });
+            page = &pages.back();
+        }
+
+        entry->page = (int)pages.size() - 1;
+        entry->x = page->shelf_x;
+        entry->y = page->shelf_y;
+
+        page->shelf_x += entry->width;
+        page->shelf_height = (entry->height > page->shelf_height) ? entry->height : page->shelf_height;
+        page->width = (page->shelf_x > page->width) ? page->shelf_x : page->width;
+        page->height = (page->shelf_y + page->shelf_height > page->height) ? page->shelf_y + page->shelf_height : page->height;
+    }
+}
+
+// Copy the texture into its padded area, clamping to its edges
+static void copy_into_page(const lodepng_texture_t* texture, const atlas_entry_t* entry, int padding, lodepng_texture_t* page)
+{
+    for (int y = 0; y < entry->height; y++)
+    {
+        int texel_y = y - padding;
+        texel_y = (texel_y < 0) ? 0 : (texel_y >= (int)texture->height) ? (int)texture->height - 1 : texel_y;
+        const uint32_t* row = &texture->png_texture[(size_t)texel_y * texture->width];
+        uint32_t* page_row = &page->png_texture[(size_t)(entry->y + y) * page->width + entry->x];
+
+        for (int x = 0; x < entry->width; x++)
+        {
+            int texel_x = x - padding;
+            texel_x = (texel_x < 0) ? 0 : (texel_x >= (int)texture->width) ? (int)texture->width - 1 : texel_x;
+            page_row[x] = row[texel_x];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pack the textures of the meshes loaded so far into pages. Call it between
+// frames. Returns the number of pages made.
+///////////////////////////////////////////////////////////////////////////////
+int build_texture_atlas(const texture_atlas_settings_t* settings)
+{
+    int padding = (settings->padding > 0) ? settings->padding : 0;
+
+    std::vector<atlas_entry_t> entries;
+    for (int i = 0; i < get_num_meshes(); i++)
+    {
+        const mesh_t* mesh = get_mesh(i);
+        if (can_go_in_atlas(mesh, settings) &&
+            (int)mesh->texture->width + 2 * padding <= settings->page_size &&
+            (int)mesh->texture->height + 2 * padding <= settings->page_size)
+        {
+            entries.push_back({ i, (int)mesh->texture->width + 2 * padding, (int)mesh->texture->height + 2 * padding, 0, 0, 0 });
+        }
+    }
+
+    // One texture alone gains nothing
+    if (entries.size() < 2)
+    {
+        return 0;
+    }
+
+    std::vector<atlas_page_t> pages;
+    place_in_pages(entries, pages, settings->page_size);
+
+    std::vector<lodepng_texture_t*> page_textures;
+    size_t atlas_size = 0;
+    for (size_t p = 0; p < pages.size(); p++)
+    {
+        lodepng_texture_t* page = new lodepng_texture_t();
+        page->format = TEXTURE_FORMAT_RGBA32;
+        page->width = page_dimension(pages[p].width, settings->page_size);
+        page->height = page_dimension(pages[p].height, settings->page_size);
+        page->png_texture = new uint32_t[(size_t)page->width * page->height]();
+        page->references = 0;
+        page_textures.push_back(page);
+        atlas_size += get_texture_size(page);
+    }
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const atlas_entry_t* entry = &entries[i];
+        mesh_t* mesh = get_mesh(entry->mesh_index);
+        lodepng_texture_t* texture = mesh->texture;
+        lodepng_texture_t* page = page_textures[entry->page];
+        copy_into_page(texture, entry, padding, page);
+
+        // Texel (u * width, (1 - v) * height) of the texture, as the
+        // rasterizer flips v, becomes texel (x + u * width, y + (1 - v) * height)
+        // of the page, x and y being where the texture starts
+        float page_width = (float)page->width;
+        float page_height = (float)page->height;
+        float x = (float)(entry->x + padding);
+        float y = (float)(entry->y + padding);
+        tex2_t scale = { texture->width / page_width, texture->height / page_height };
+        tex2_t offset = { x / page_width, 1.0f - (y + texture->height) / page_height };
+        transform_mesh_texcoords(mesh, scale, offset);
+
+        page->references++;
+        set_mesh_texture(entry->mesh_index, page);
+    }
+
+    printf("Texture atlas: %d textures in %d pages, %.2f MB\n",
+        (int)entries.size(), (int)pages.size(), atlas_size / (1024.0 * 1024.0));
+    return (int)pages.size();
+}
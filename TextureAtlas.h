@@ -0,0 +1,13 @@
+#ifndef TEXTURE_ATLAS_H
+#define TEXTURE_ATLAS_H
+
+typedef struct {
+    int page_size;        // largest width and height of a page
+    int max_texture_size; // only textures up to that size both ways go in
+    int padding;          // texels around every texture repeating its edge
+} texture_atlas_settings_t;
+
+void init_texture_atlas_settings(texture_atlas_settings_t* settings);
+int build_texture_atlas(const texture_atlas_settings_t* settings);
+
+#endif
@@ -0,0 +1,261 @@
+#include "ThreadPool.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Work-stealing fork/join pool
+///////////////////////////////////////////////////////////////////////////////
+// thread_pool_parallel_for() splits the task indices into one contiguous
+// range per worker (the calling thread is worker 0). A worker takes tasks
+// from the front of its own range; once that is empty it steals from the
+// back of the others, so uneven tasks (a chunk full of clipped triangles)
+// do not leave the other workers idle. Each range has its own lock, there
+// is no lock shared by all workers on the task path.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    std::mutex lock;
+    int begin;
+    int end;
+} task_range_t;
+
+static std::vector<std::thread> workers;
+static task_range_t* ranges = NULL;
+static int pool_size = 1;
+
+static std::mutex job_lock;
+static std::condition_variable job_started;
+static std::condition_variable job_finished;
+static unsigned job_generation = 0;
+static int workers_busy = 0;
+static bool shutting_down = false;
+
+static thread_pool_task_fn job_task = NULL;
+static void* job_context = NULL;
+
+// Serializes callers of thread_pool_parallel_for() coming from different threads
+static std::mutex caller_lock;
+
+static std::thread background_thread;
+static std::mutex background_lock;
+static std::condition_variable background_changed;
+static background_task_fn background_task = NULL;
+static void* background_context = NULL;
+static bool background_pending = false;
+static bool background_stopping = false;
+
+static bool pop_own_task(int worker_index, int* task_index)
+{
+    task_range_t* range = &ranges[worker_index];
+    std::lock_guard<std::mutex> guard(range->lock);
+    if (range->begin >= range->end)
+    {
+        return false;
+    }
+    *task_index = range->begin++;
+    return true;
+}
+
+static bool steal_task(int worker_index, int* task_index)
+{
+    for (int i = 1; i < pool_size; i++)
+    {
+        task_range_t* victim = &ranges[(worker_index + i) % pool_size];
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (victim->begin < victim->end)
+        {
+            *task_index = --victim->end;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_tasks(int worker_index)
+{
+    int task_index;
+    while (pop_own_task(worker_index, &task_index) || steal_task(worker_index, &task_index))
+    {
+        job_task(job_context, task_index, worker_index);
+    }
+}
+
+static void worker_main(int worker_index)
+{
+    unsigned seen_generation = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> guard(job_lock);
+            job_started.wait(guard, [&] { return shutting_down || job_generation != seen_generation; });
+            if (shutting_down)
+            {
+                return;
+            }
+            seen_generation = job_generation;
+        }
+
+        run_tasks(worker_index);
+
+        {
+            std::lock_guard<std::mutex> guard(job_lock);
+            if (--workers_busy == 0)
+            {
+                job_finished.notify_one();
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start the worker threads. num_threads counts the calling thread as well,
+// 0 picks one thread per hardware thread.
+///////////////////////////////////////////////////////////////////////////////
+void init_thread_pool(int num_threads)
+{
+    if (num_threads <= 0)
+    {
+        num_threads = (int)std::thread::hardware_concurrency();
+    }
+    if (num_threads <= 0)
+    {
+        num_threads = 1;
+    }
+
+    pool_size = num_threads;
+    ranges = new task_range_t[pool_size];
+    for (int i = 1; i < pool_size; i++)
+    {
+        workers.emplace_back(worker_main, i);
+    }
+}
+
+int get_thread_pool_size(void)
+{
+    return pool_size;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Run task(context, i, worker) for every i in [0, num_tasks) and return once
+// all of them are done
+///////////////////////////////////////////////////////////////////////////////
+void thread_pool_parallel_for(int num_tasks, thread_pool_task_fn task, void* context)
+{
+    if (num_tasks <= 0)
+    {
+        return;
+    }
+    if (pool_size == 1 || num_tasks == 1 || ranges == NULL)
+    {
+        for (int i = 0; i < num_tasks; i++)
+        {
+            task(context, i, 0);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> caller_guard(caller_lock);
+
+    for (int w = 0; w < pool_size; w++)
+    {
+        std::lock_guard<std::mutex> guard(ranges[w].lock);
+        ranges[w].begin = (int)((long long)num_tasks * w / pool_size);
+        ranges[w].end = (int)((long long)num_tasks * (w + 1) / pool_size);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(job_lock);
+        job_task = task;
+        job_context = context;
+        workers_busy = pool_size - 1;
+        job_generation++;
+    }
+    job_started.notify_all();
+
+    run_tasks(0);
+
+    std::unique_lock<std::mutex> guard(job_lock);
+    job_finished.wait(guard, [] { return workers_busy == 0; });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Background task: a single long running task (the geometry of the next
+// frame) that overlaps with work on the calling thread. The task may use
+// thread_pool_parallel_for() itself.
+///////////////////////////////////////////////////////////////////////////////
+static void background_main(void)
+{
+    std::unique_lock<std::mutex> guard(background_lock);
+    for (;;)
+    {
+        background_changed.wait(guard, [] { return background_stopping || background_task != NULL; });
+        if (background_task == NULL)
+        {
+            return;
+        }
+
+        background_task_fn task = background_task;
+        void* context = background_context;
+        guard.unlock();
+        task(context);
+        guard.lock();
+
+        background_task = NULL;
+        background_pending = false;
+        background_changed.notify_all();
+    }
+}
+
+void start_background_task(background_task_fn task, void* context)
+{
+    wait_background_task();
+
+    std::lock_guard<std::mutex> guard(background_lock);
+    if (!background_thread.joinable())
+    {
+        background_thread = std::thread(background_main);
+    }
+    background_task = task;
+    background_context = context;
+    background_pending = true;
+    background_changed.notify_all();
+}
+
+void wait_background_task(void)
+{
+    std::unique_lock<std::mutex> guard(background_lock);
+    background_changed.wait(guard, [] { return !background_pending; });
+}
+
+void destroy_thread_pool(void)
+{
+    wait_background_task();
+    {
+        std::lock_guard<std::mutex> guard(background_lock);
+        background_stopping = true;
+        background_changed.notify_all();
+    }
+    if (background_thread.joinable())
+    {
+        background_thread.join();
+    }
+    background_stopping = false;
+
+    {
+        std::lock_guard<std::mutex> guard(job_lock);
+        shutting_down = true;
+    }
+    job_started.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+    workers.clear();
+
+    delete[] ranges;
+    ranges = NULL;
+    pool_size = 1;
+    shutting_down = false;
+}
@@ -0,0 +1,19 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// A task receives the shared context, its index in [0, num_tasks), and the
+// index of the worker running it in [0, get_thread_pool_size()).
+typedef void (*thread_pool_task_fn)(void* context, int task_index, int worker_index);
+
+void init_thread_pool(int num_threads);
+int get_thread_pool_size(void);
+void thread_pool_parallel_for(int num_tasks, thread_pool_task_fn task, void* context);
+void destroy_thread_pool(void);
+
+// One task at a time on a dedicated thread, next to the pool workers
+typedef void (*background_task_fn)(void* context);
+
+void start_background_task(background_task_fn task, void* context);
+void wait_background_task(void);
+
+#endif
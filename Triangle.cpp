@@ -204,12 +204,137 @@ vec3_t barycentric_weights(vec2_t a, vec2_t b, vec2_t c, vec2_t p)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+// Depth conventions. The pixel functions below are instantiated once per
+// depth mode and z-buffer format, so the choice costs nothing per pixel and
+// the modes and formats can be benchmarked against each other.
+///////////////////////////////////////////////////////////////////////////////
+template <int mode>
+struct depth_mode_traits;
+
+template <>
+struct depth_mode_traits<DEPTH_STANDARD>
+{
+    // Adjust 1/w so the pixels that are closer to the camera have smaller values
+    static inline float from_reciprocal_w(float reciprocal_w) { return 1.0f - reciprocal_w; }
+    static inline float from_normalized(float nearness) { return 1.0f - nearness; }
+    template <typename T> static inline bool is_closer(T depth, T stored_depth) { return depth < stored_depth; }
+};
+
+template <>
+struct depth_mode_traits<DEPTH_REVERSED_Z>
+{
+    // 1/w as is: bigger is closer, and float precision is best at the far end where values near zero
+    static inline float from_reciprocal_w(float reciprocal_w) { return reciprocal_w; }
+    static inline float from_normalized(float nearness) { return nearness; }
+    template <typename T> static inline bool is_closer(T depth, T stored_depth) { return depth > stored_depth; }
+};
+
+// 1/w * scale + offset goes from 0 at the far plane to 1 at the near plane, set per triangle for the unorm formats
+static float unorm_depth_scale = 1.0f;
+static float unorm_depth_offset = 0.0f;
+
+static void update_unorm_depth_range(void)
+{
+    float znear, zfar;
+    get_depth_range(&znear, &zfar);
+    unorm_depth_scale = 1.0f / (1.0f / znear - 1.0f / zfar);
+    unorm_depth_offset = -unorm_depth_scale / zfar;
+}
+
+template <int format>
+struct depth_format_traits;
+
+template <>
+struct depth_format_traits<DEPTH_FORMAT_FLOAT32> : depth_format_info<DEPTH_FORMAT_FLOAT32>
+{
+    template <int mode>
+    static inline value_t encode(float reciprocal_w) { return depth_mode_traits<mode>::from_reciprocal_w(reciprocal_w); }
+};
+
+template <int format, uint32_t max_value>
+struct depth_format_unorm_traits : depth_format_info<format>
+{
+    typedef uint32_t value_t;
+
+    template <int mode>
+    static inline value_t encode(float reciprocal_w)
+    {
+        // Clamped, the pixels right at the clipping planes can land a bit outside
+        float nearness = reciprocal_w * unorm_depth_scale + unorm_depth_offset;
+        nearness = (nearness < 0.0f) ? 0.0f : (nearness > 1.0f) ? 1.0f : nearness;
+        return (value_t)(depth_mode_traits<mode>::from_normalized(nearness) * max_value + 0.5f);
+    }
+};
+
+template <>
+struct depth_format_traits<DEPTH_FORMAT_UNORM24> : depth_format_unorm_traits<DEPTH_FORMAT_UNORM24, 0xFFFFFF> {};
+
+template <>
+struct depth_format_traits<DEPTH_FORMAT_UNORM16> : depth_format_unorm_traits<DEPTH_FORMAT_UNORM16, 0xFFFF> {};
+
+///////////////////////////////////////////////////////////////////////////////
+// Scanline spans, straight into the raster target
+///////////////////////////////////////////////////////////////////////////////
+// A span is cut at the tile borders; inside a tile its pixels are
+// consecutive in memory, so the per-pixel work is only the pixel function,
+// on plain pointers. Spans are clipped to the screen before they get here.
+///////////////////////////////////////////////////////////////////////////////
+template <int depth_format, typename pixel_fn>
+static inline void draw_span(raster_target_t* target, int y, int x_start, int x_end, pixel_fn pixel)
+{
+    const int depth_bytes = depth_format_info<depth_format>::bytes;
+
+    int x = x_start;
+    while (x < x_end)
+    {
+        int segment_end = (x | (FRAMEBUFFER_TILE_SIZE - 1)) + 1;
+        if (segment_end > x_end)
+        {
+            segment_end = x_end;
+        }
+
+        int offset = get_tiled_pixel_offset(target->tiles_x, x, y);
+        prepare_raster_tile(target, offset >> (2 * FRAMEBUFFER_TILE_SHIFT));
+
+        uint32_t* color_pixel = target->color + offset;
+        uint8_t* depth_pixel = target->depth + offset * depth_bytes;
+        target->depth_tests += segment_end - x;
+        for (; x < segment_end; x++, color_pixel++, depth_pixel += depth_bytes)
+        {
+            target->depth_writes += pixel(x, color_pixel, depth_pixel);
+        }
+    }
+}
+
+// The scissor: the rows and columns of the screen, set up once per triangle
+typedef struct {
+    int min_y;
+    int max_y;
+    int min_x;
+    int end_x;
+} scissor_t;
+
+static inline scissor_t get_scissor(const raster_target_t* target)
+{
+    scissor_t scissor = { 0, target->height - 1, 0, target->width };
+    return scissor;
+}
+
+static inline void clip_span(const scissor_t* scissor, int* x_start, int* x_end)
+{
+    if (*x_start < scissor->min_x) *x_start = scissor->min_x;
+    if (*x_end > scissor->end_x) *x_end = scissor->end_x;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Function to draw a solid pixel at position (x,y) using depth interpolation
 ///////////////////////////////////////////////////////////////////////////////
-void draw_triangle_pixel(
+template <int depth_mode, int depth_format>
+static inline bool draw_triangle_pixel(
     int x, int y, uint32_t color,
-    vec4_t point_a, vec4_t point_b, vec4_t point_c
+    vec4_t point_a, vec4_t point_b, vec4_t point_c,
+    uint32_t* color_pixel, uint8_t* depth_pixel
 ) {
     // Create three vec2 to find the interpolation
     vec2_t p = { x, y };
@@ -227,17 +352,19 @@ void draw_triangle_pixel(
     // Interpolate the value of 1/w for the current pixel
     float interpolated_reciprocal_w = (1 / point_a.w) * alpha + (1 / point_b.w) * beta + (1 / point_c.w) * gamma;
 
-    // Adjust 1/w so the pixels that are closer to the camera have smaller values
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+    typedef depth_format_traits<depth_format> depth_buffer;
+    typename depth_buffer::value_t depth = depth_buffer::template encode<depth_mode>(interpolated_reciprocal_w);
 
-    // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
-    if (interpolated_reciprocal_w < get_zbuffer_at(x, y)) {
+    // Only draw the pixel if it is closer than the one previously stored in the z-buffer
+    if (depth_mode_traits<depth_mode>::is_closer(depth, load_depth_value<depth_format>(depth_pixel))) {
         // Draw a pixel at position (x,y) with a solid color
-        draw_pixel(x, y, color);
+        *color_pixel = color;
 
-        // Update the z-buffer value with the 1/w of this current pixel
-        update_zbuffer_at(x, y, interpolated_reciprocal_w);
+        // Update the z-buffer value with the depth of this current pixel
+        store_depth_value<depth_format>(depth_pixel, depth);
+        return true;
     }
+    return false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -263,7 +390,8 @@ void draw_triangle_pixel(
 //                         (x2,y2)
 //
 ///////////////////////////////////////////////////////////////////////////////
-void draw_filled_triangle(
+template <int depth_mode, int depth_format>
+static void draw_filled_triangle_depth(
     int x0, int y0, float z0, float w0,
     int x1, int y1, float z1, float w1,
     int x2, int y2, float z2, float w2,
@@ -294,6 +422,13 @@ void draw_filled_triangle(
     vec4_t point_b = { x1, y1, z1, w1 };
     vec4_t point_c = { x2, y2, z2, w2 };
 
+    raster_target_t target = begin_raster_target();
+    scissor_t scissor = get_scissor(&target);
+    auto pixel = [&](int x, int y, uint32_t* color_pixel, uint8_t* depth_pixel) {
+        // Draw our pixel with a solid color
+        return draw_triangle_pixel<depth_mode, depth_format>(x, y, color, point_a, point_b, point_c, color_pixel, depth_pixel);
+    };
+
     ///////////////////////////////////////////////////////
     // Render the upper part of the triangle (flat-bottom)
     ///////////////////////////////////////////////////////
@@ -304,7 +439,7 @@ void draw_filled_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y1 - y0 != 0) {
-        for (int y = y0; y <= y1; y++) {
+        for (int y = (y0 > scissor.min_y) ? y0 : scissor.min_y; y <= y1 && y <= scissor.max_y; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -312,10 +447,10 @@ void draw_filled_triangle(
                 int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
             }
 
-            for (int x = x_start; x < x_end; x++) {
-                // Draw our pixel with a solid color
-                draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
-            }
+            clip_span(&scissor, &x_start, &x_end);
+            draw_span<depth_format>(&target, y, x_start, x_end, [&](int x, uint32_t* color_pixel, uint8_t* depth_pixel) {
+                return pixel(x, y, color_pixel, depth_pixel);
+            });
         }
     }
 
@@ -329,7 +464,7 @@ void draw_filled_triangle(
     if (y2 - y0 != 0) inv_slope_2 = (float)(x2 - x0) / abs(y2 - y0);
 
     if (y2 - y1 != 0) {
-        for (int y = y1; y <= y2; y++) {
+        for (int y = (y1 > scissor.min_y) ? y1 : scissor.min_y; y <= y2 && y <= scissor.max_y; y++) {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
 
@@ -337,21 +472,55 @@ void draw_filled_triangle(
                 int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
             }
 
-            for (int x = x_start; x < x_end; x++) {
-                // Draw our pixel with a solid color
-                draw_triangle_pixel(x, y, color, point_a, point_b, point_c);
-            }
+            clip_span(&scissor, &x_start, &x_end);
+            draw_span<depth_format>(&target, y, x_start, x_end, [&](int x, uint32_t* color_pixel, uint8_t* depth_pixel) {
+                return pixel(x, y, color_pixel, depth_pixel);
+            });
         }
     }
+    end_raster_target(&target);
+}
+
+typedef void (*filled_triangle_fn)(
+    int x0, int y0, float z0, float w0,
+    int x1, int y1, float z1, float w1,
+    int x2, int y2, float z2, float w2,
+    uint32_t color
+);
+
+// Indexed by [depth_mode][depth_format]
+static const filled_triangle_fn filled_triangle_variants[2][NUM_DEPTH_FORMATS] = {
+    {
+        draw_filled_triangle_depth<DEPTH_STANDARD, DEPTH_FORMAT_FLOAT32>,
+        draw_filled_triangle_depth<DEPTH_STANDARD, DEPTH_FORMAT_UNORM24>,
+        draw_filled_triangle_depth<DEPTH_STANDARD, DEPTH_FORMAT_UNORM16>
+    },
+    {
+        draw_filled_triangle_depth<DEPTH_REVERSED_Z, DEPTH_FORMAT_FLOAT32>,
+        draw_filled_triangle_depth<DEPTH_REVERSED_Z, DEPTH_FORMAT_UNORM24>,
+        draw_filled_triangle_depth<DEPTH_REVERSED_Z, DEPTH_FORMAT_UNORM16>
+    }
+};
+
+void draw_filled_triangle(
+    int x0, int y0, float z0, float w0,
+    int x1, int y1, float z1, float w1,
+    int x2, int y2, float z2, float w2,
+    uint32_t color
+) {
+    update_unorm_depth_range();
+    filled_triangle_variants[get_depth_mode()][get_depth_format()](x0, y0, z0, w0, x1, y1, z1, w1, x2, y2, z2, w2, color);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 // Function to draw the textured pixel at position (x,y) using depth interpolation
 ///////////////////////////////////////////////////////////////////////////////
-void draw_triangle_texel(
+template <int depth_mode, int depth_format>
+static inline bool draw_triangle_texel(
     int x, int y, lodepng_texture_t* texture,
     vec4_t point_a, vec4_t point_b, vec4_t point_c,
-    tex2_t a_uv, tex2_t b_uv, tex2_t c_uv
+    tex2_t a_uv, tex2_t b_uv, tex2_t c_uv,
+    uint32_t* color_pixel, uint8_t* depth_pixel
 )
 {
     vec2_t p = { x, y };
@@ -386,18 +555,20 @@ void draw_triangle_texel(
     int tex_x = abs((int)(interpolated_u * texture->width)) % texture->width;
     int tex_y = abs((int)(interpolated_v * texture->height)) % texture->height;
 
-    // Adjust 1/w so the pixels that are closer to the camera have smaller values
-    interpolated_reciprocal_w = 1.0 - interpolated_reciprocal_w;
+    typedef depth_format_traits<depth_format> depth_buffer;
+    typename depth_buffer::value_t depth = depth_buffer::template encode<depth_mode>(interpolated_reciprocal_w);
 
-    // Only draw the pixel if the depth value is less than the one previously stored in the z-buffer
-    if (interpolated_reciprocal_w < get_zbuffer_at(x, y)) 
+    // Only draw the pixel if it is closer than the one previously stored in the z-buffer
+    if (depth_mode_traits<depth_mode>::is_closer(depth, load_depth_value<depth_format>(depth_pixel))) 
     {
         // Draw a pixel at position (x,y) with the color that comes from the mapped texture
-        draw_pixel(x, y, texture->png_texture[(texture->width * tex_y) + tex_x]);
+        *color_pixel = sample_texture(texture, tex_x, tex_y);
 
-        // Update the z-buffer value with the 1/w of this current pixel
-        update_zbuffer_at(x, y, interpolated_reciprocal_w);
+        // Update the z-buffer value with the depth of this current pixel
+        store_depth_value<depth_format>(depth_pixel, depth);
+        return true;
     }
+    return false;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -420,7 +591,8 @@ void draw_triangle_texel(
 //                    v2
 //
 ///////////////////////////////////////////////////////////////////////////////
-void draw_textured_triangle(
+template <int depth_mode, int depth_format>
+static void draw_textured_triangle_depth(
     int x0, int y0, float z0, float w0, float u0, float v0,
     int x1, int y1, float z1, float w1, float u1, float v1,
     int x2, int y2, float z2, float w2, float u2, float v2,
@@ -468,6 +640,13 @@ void draw_textured_triangle(
     tex2_t b_uv = { u1, v1 };
     tex2_t c_uv = { u2, v2 };
 
+    raster_target_t target = begin_raster_target();
+    scissor_t scissor = get_scissor(&target);
+    auto texel = [&](int x, int y, uint32_t* color_pixel, uint8_t* depth_pixel) {
+        // Draw our pixel with the color that comes from the texture
+        return draw_triangle_texel<depth_mode, depth_format>(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv, color_pixel, depth_pixel);
+    };
+
     ///////////////////////////////////////////////////////
     // Render the upper part of the triangle (flat-bottom)
     ///////////////////////////////////////////////////////
@@ -479,7 +658,7 @@ void draw_textured_triangle(
 
     if (y1 - y0 != 0) 
     {
-        for (int y = y0; y <= y1; y++) 
+        for (int y = (y0 > scissor.min_y) ? y0 : scissor.min_y; y <= y1 && y <= scissor.max_y; y++) 
         {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
@@ -489,11 +668,10 @@ void draw_textured_triangle(
                 int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
             }
 
-            for (int x = x_start; x < x_end; x++) 
-            {
-                // Draw our pixel with the color that comes from the texture
-                draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
-            }
+            clip_span(&scissor, &x_start, &x_end);
+            draw_span<depth_format>(&target, y, x_start, x_end, [&](int x, uint32_t* color_pixel, uint8_t* depth_pixel) {
+                return texel(x, y, color_pixel, depth_pixel);
+            });
         }
     }
 
@@ -508,7 +686,7 @@ void draw_textured_triangle(
 
     if (y2 - y1 != 0) 
     {
-        for (int y = y1; y <= y2; y++) 
+        for (int y = (y1 > scissor.min_y) ? y1 : scissor.min_y; y <= y2 && y <= scissor.max_y; y++) 
         {
             int x_start = x1 + (y - y1) * inv_slope_1;
             int x_end = x0 + (y - y0) * inv_slope_2;
@@ -518,11 +696,181 @@ void draw_textured_triangle(
                 int_swap(&x_start, &x_end); // swap if x_start is to the right of x_end
             }
 
-            for (int x = x_start; x < x_end; x++) 
-            {
-                // Draw our pixel with the color that comes from the texture
-                draw_triangle_texel(x, y, texture, point_a, point_b, point_c, a_uv, b_uv, c_uv);
-            }
+            clip_span(&scissor, &x_start, &x_end);
+            draw_span<depth_format>(&target, y, x_start, x_end, [&](int x, uint32_t* color_pixel, uint8_t* depth_pixel) {
+                return texel(x, y, color_pixel, depth_pixel);
+            });
         }
     }
-}
\ No newline at end of file
+    end_raster_target(&target);
+}
+
+typedef void (*textured_triangle_fn)(
+    int x0, int y0, float z0, float w0, float u0, float v0,
+    int x1, int y1, float z1, float w1, float u1, float v1,
+    int x2, int y2, float z2, float w2, float u2, float v2,
+    lodepng_texture_t* texture
+);
+
+// Indexed by [depth_mode][depth_format]
+static const textured_triangle_fn textured_triangle_variants[2][NUM_DEPTH_FORMATS] = {
+    {
+        draw_textured_triangle_depth<DEPTH_STANDARD, DEPTH_FORMAT_FLOAT32>,
+        draw_textured_triangle_depth<DEPTH_STANDARD, DEPTH_FORMAT_UNORM24>,
+        draw_textured_triangle_depth<DEPTH_STANDARD, DEPTH_FORMAT_UNORM16>
+    },
+    {
+        draw_textured_triangle_depth<DEPTH_REVERSED_Z, DEPTH_FORMAT_FLOAT32>,
+        draw_textured_triangle_depth<DEPTH_REVERSED_Z, DEPTH_FORMAT_UNORM24>,
+        draw_textured_triangle_depth<DEPTH_REVERSED_Z, DEPTH_FORMAT_UNORM16>
+    }
+};
+
+void draw_textured_triangle(
+    int x0, int y0, float z0, float w0, float u0, float v0,
+    int x1, int y1, float z1, float w1, float u1, float v1,
+    int x2, int y2, float z2, float w2, float u2, float v2,
+    lodepng_texture_t* texture)
+{
+    update_unorm_depth_range();
+    textured_triangle_variants[get_depth_mode()][get_depth_format()](x0, y0, z0, w0, u0, v0, x1, y1, z1, w1, u1, v1, x2, y2, z2, w2, u2, v2, texture);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Depth-tested overlays: wireframe lines and vertex points
+///////////////////////////////////////////////////////////////////////////////
+// An overlay pixel is drawn when it is not behind what the faces left in
+// the z-buffer; it does not write depth. 1/w is linear in screen space, so
+// it is interpolated along the line like x and y. The edges lie exactly on
+// the faces they outline, so their depth is pulled a bit towards the camera
+// first, or half of their pixels would lose against the faces' own depth.
+///////////////////////////////////////////////////////////////////////////////
+#define OVERLAY_DEPTH_BIAS 0.005f // relative to 1/w, that is to the distance
+
+template <int depth_mode, int depth_format>
+static inline void draw_overlay_pixel(raster_target_t* target, int x, int y, float reciprocal_w, uint32_t color)
+{
+    typedef depth_format_traits<depth_format> depth_buffer;
+
+    int offset = get_tiled_pixel_offset(target->tiles_x, x, y);
+    prepare_raster_tile(target, offset >> (2 * FRAMEBUFFER_TILE_SHIFT));
+
+    typename depth_buffer::value_t depth = depth_buffer::template encode<depth_mode>(reciprocal_w * (1.0f + OVERLAY_DEPTH_BIAS));
+    typename depth_buffer::value_t stored_depth = load_depth_value<depth_format>(target->depth + offset * depth_buffer::bytes);
+    target->depth_tests++;
+    if (!depth_mode_traits<depth_mode>::is_closer(stored_depth, depth))
+    {
+        target->color[offset] = color;
+    }
+}
+
+// Bresenham, like draw_line(), with both endpoints already on the screen
+template <int depth_mode, int depth_format>
+static void draw_depth_tested_line_variant(int x0, int y0, float reciprocal_w0, int x1, int y1, float reciprocal_w1, uint32_t color)
+{
+    raster_target_t target = begin_raster_target();
+
+    int delta_x = abs(x1 - x0);
+    int delta_y = -abs(y1 - y0);
+    int step_x = (x0 < x1) ? 1 : -1;
+    int step_y = (y0 < y1) ? 1 : -1;
+    int error = delta_x + delta_y;
+
+    // Every step moves one pixel along the longer axis
+    int steps = (delta_x > -delta_y) ? delta_x : -delta_y;
+    float reciprocal_w = reciprocal_w0;
+    float reciprocal_w_step = (steps > 0) ? (reciprocal_w1 - reciprocal_w0) / steps : 0.0f;
+
+    for (;;)
+    {
+        draw_overlay_pixel<depth_mode, depth_format>(&target, x0, y0, reciprocal_w, color);
+        if (x0 == x1 && y0 == y1)
+        {
+            break;
+        }
+        int error_2 = 2 * error;
+        if (error_2 >= delta_y)
+        {
+            error += delta_y;
+            x0 += step_x;
+        }
+        if (error_2 <= delta_x)
+        {
+            error += delta_x;
+            y0 += step_y;
+        }
+        reciprocal_w += reciprocal_w_step;
+    }
+
+    end_raster_target(&target);
+}
+
+template <int depth_mode, int depth_format>
+static void draw_depth_tested_rect_variant(int x, int y, float reciprocal_w, int width, int height, uint32_t color)
+{
+    raster_target_t target = begin_raster_target();
+
+    int x_start = (x > 0) ? x : 0;
+    int y_start = (y > 0) ? y : 0;
+    int x_end = (x + width < target.width) ? x + width : target.width;
+    int y_end = (y + height < target.height) ? y + height : target.height;
+
+    for (int current_y = y_start; current_y < y_end; current_y++)
+    {
+        for (int current_x = x_start; current_x < x_end; current_x++)
+        {
+            draw_overlay_pixel<depth_mode, depth_format>(&target, current_x, current_y, reciprocal_w, color);
+        }
+    }
+
+    end_raster_target(&target);
+}
+
+typedef void (*depth_tested_line_fn)(int x0, int y0, float reciprocal_w0, int x1, int y1, float reciprocal_w1, uint32_t color);
+typedef void (*depth_tested_rect_fn)(int x, int y, float reciprocal_w, int width, int height, uint32_t color);
+
+// Indexed by [depth_mode][depth_format]
+static const depth_tested_line_fn depth_tested_line_variants[2][NUM_DEPTH_FORMATS] = {
+    {
+        draw_depth_tested_line_variant<DEPTH_STANDARD, DEPTH_FORMAT_FLOAT32>,
+        draw_depth_tested_line_variant<DEPTH_STANDARD, DEPTH_FORMAT_UNORM24>,
+        draw_depth_tested_line_variant<DEPTH_STANDARD, DEPTH_FORMAT_UNORM16>
+    },
+    {
+        draw_depth_tested_line_variant<DEPTH_REVERSED_Z, DEPTH_FORMAT_FLOAT32>,
+        draw_depth_tested_line_variant<DEPTH_REVERSED_Z, DEPTH_FORMAT_UNORM24>,
+        draw_depth_tested_line_variant<DEPTH_REVERSED_Z, DEPTH_FORMAT_UNORM16>
+    }
+};
+
+static const depth_tested_rect_fn depth_tested_rect_variants[2][NUM_DEPTH_FORMATS] = {
+    {
+        draw_depth_tested_rect_variant<DEPTH_STANDARD, DEPTH_FORMAT_FLOAT32>,
+        draw_depth_tested_rect_variant<DEPTH_STANDARD, DEPTH_FORMAT_UNORM24>,
+        draw_depth_tested_rect_variant<DEPTH_STANDARD, DEPTH_FORMAT_UNORM16>
+    },
+    {
+        draw_depth_tested_rect_variant<DEPTH_REVERSED_Z, DEPTH_FORMAT_FLOAT32>,
+        draw_depth_tested_rect_variant<DEPTH_REVERSED_Z, DEPTH_FORMAT_UNORM24>,
+        draw_depth_tested_rect_variant<DEPTH_REVERSED_Z, DEPTH_FORMAT_UNORM16>
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a line between two points on the screen, hidden where it is behind
+// the z-buffer. The endpoints must be clipped to the screen already.
+///////////////////////////////////////////////////////////////////////////////
+void draw_depth_tested_line(int x0, int y0, float reciprocal_w0, int x1, int y1, float reciprocal_w1, uint32_t color)
+{
+    update_unorm_depth_range();
+    depth_tested_line_variants[get_depth_mode()][get_depth_format()](x0, y0, reciprocal_w0, x1, y1, reciprocal_w1, color);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a rectangle at a single depth, hidden where it is behind the z-buffer
+///////////////////////////////////////////////////////////////////////////////
+void draw_depth_tested_rect(int x, int y, float reciprocal_w, int width, int height, uint32_t color)
+{
+    update_unorm_depth_range();
+    depth_tested_rect_variants[get_depth_mode()][get_depth_format()](x, y, reciprocal_w, width, height, color);
+}
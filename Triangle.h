@@ -47,4 +47,7 @@ void draw_textured_triangle(
     lodepng_texture_t* texture
 );
 
+void draw_depth_tested_line(int x0, int y0, float reciprocal_w0, int x1, int y1, float reciprocal_w1, uint32_t color);
+void draw_depth_tested_rect(int x, int y, float reciprocal_w, int width, int height, uint32_t color);
+
 #endif
@@ -0,0 +1,236 @@
+#include "VertexCache.h"
+
+#include <math.h>
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+// Average cache miss ratio: transformed vertices per triangle with a FIFO
+// cache of the given size. 3.0 means no reuse at all, 0.5 is the best a
+// regular grid can get.
+///////////////////////////////////////////////////////////////////////////////
+float compute_acmr(const uint32_t* indices, int num_faces, int num_vertices, int cache_size)
+{
+    if (num_faces == 0)
+    {
+        return 0;
+    }
+
+    // The time stamp at which each vertex entered the cache
+    std::vector<int> cache_time(num_vertices, -1);
+    int misses = 0;
+
+    for (int i = 0; i < num_faces * 3; i++)
+    {
+        uint32_t v = indices[i];
+        if (cache_time[v] < 0 || misses - cache_time[v] >= cache_size)
+        {
+            cache_time[v] = misses;
+            misses++;
+        }
+    }
+    return (float)misses / (float)num_faces;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+///////////////////////////////////////////////////////////////////////////////
+// Triangles are emitted greedily. Every vertex gets a score from its position
+// in a simulated LRU cache (recently used is good) and from how many not yet
+// emitted triangles still use it (few left is good, it finishes the vertex
+// off). The next triangle is the one with the highest sum of vertex scores
+// among those touching the cache.
+///////////////////////////////////////////////////////////////////////////////
+static const float cache_decay_power = 1.5f;
+static const float last_triangle_score = 0.75f;
+static const float valence_boost_scale = 2.0f;
+static const float valence_boost_power = 0.5f;
+
+static float vertex_score(int cache_position, int remaining_valence)
+{
+    if (remaining_valence == 0)
+    {
+        // No triangle needs this vertex anymore
+        return -1.0f;
+    }
+
+    float score = 0.0f;
+    if (cache_position >= 0)
+    {
+        if (cache_position < 3)
+        {
+            // Used by the triangle just emitted: a fixed score so strips do not get favoured over fans
+            score = last_triangle_score;
+        }
+        else
+        {
+            float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+            score = powf(1.0f - (cache_position - 3) * scaler, cache_decay_power);
+        }
+    }
+
+    score += valence_boost_scale * powf((float)remaining_valence, -valence_boost_power);
+    return score;
+}
+
+void optimize_vertex_cache(const uint32_t* indices, int num_faces, int num_vertices, int* face_order)
+{
+    // Triangles using each vertex, packed as [vertex_offset[v], vertex_offset[v] + valence[v])
+    std::vector<int> valence(num_vertices, 0);
+    for (int i = 0; i < num_faces * 3; i++)
+    {
+        valence[indices[i]]++;
+    }
+    std::vector<int> vertex_offset(num_vertices + 1, 0);
+    for (int v = 0; v < num_vertices; v++)
+    {
+        vertex_offset[v + 1] = vertex_offset[v] + valence[v];
+    }
+    std::vector<int> vertex_triangles(num_faces * 3);
+    std::vector<int> fill(vertex_offset.begin(), vertex_offset.end() - 1);
+    for (int f = 0; f < num_faces; f++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            vertex_triangles[fill[indices[f * 3 + j]]++] = f;
+        }
+    }
+
+    std::vector<int> cache_position(num_vertices, -1);
+    std::vector<float> score(num_vertices);
+    for (int v = 0; v < num_vertices; v++)
+    {
+        score[v] = vertex_score(-1, valence[v]);
+    }
+
+    std::vector<float> triangle_score(num_faces);
+    std::vector<bool> emitted(num_faces, false);
+    for (int f = 0; f < num_faces; f++)
+    {
+        triangle_score[f] = score[indices[f * 3]] + score[indices[f * 3 + 1]] + score[indices[f * 3 + 2]];
+    }
+
+    // Cache holds VERTEX_CACHE_SIZE entries, plus room for the 3 vertices pushed in per triangle
+    int cache[VERTEX_CACHE_SIZE + 3];
+    int cache_count = 0;
+
+    int best_triangle = -1;
+    float best_score = -1.0f;
+    for (int f = 0; f < num_faces; f++)
+    {
+        if (triangle_score[f] > best_score)
+        {
+            best_score = triangle_score[f];
+            best_triangle = f;
+        }
+    }
+
+    int scan_cursor = 0;
+    for (int emitted_count = 0; emitted_count < num_faces; emitted_count++)
+    {
+        if (best_triangle < 0)
+        {
+            // Nothing in the cache is connected to a remaining triangle: take the next one in input order
+            while (emitted[scan_cursor])
+            {
+                scan_cursor++;
+            }
+            best_triangle = scan_cursor;
+        }
+
+        face_order[emitted_count] = best_triangle;
+        emitted[best_triangle] = true;
+
+        // Remove the triangle from its vertices' remaining lists
+        const uint32_t* tri = &indices[best_triangle * 3];
+        for (int j = 0; j < 3; j++)
+        {
+            int v = tri[j];
+            int* begin = &vertex_triangles[vertex_offset[v]];
+            int* end = begin + valence[v];
+            for (int* t = begin; t < end; t++)
+            {
+                if (*t == best_triangle)
+                {
+                    *t = *(end - 1);
+                    break;
+                }
+            }
+            valence[v]--;
+        }
+
+        // Move the triangle's vertices to the front of the LRU cache
+        int new_cache[VERTEX_CACHE_SIZE + 3];
+        int new_count = 0;
+        for (int j = 0; j < 3; j++)
+        {
+            new_cache[new_count++] = tri[j];
+        }
+        for (int c = 0; c < cache_count; c++)
+        {
+            int v = cache[c];
+            if (v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2])
+            {
+                new_cache[new_count++] = v;
+            }
+        }
+
+        // Vertices that fell out of the cache lose their cache score
+        for (int c = VERTEX_CACHE_SIZE; c < new_count; c++)
+        {
+            cache_position[new_cache[c]] = -1;
+            score[new_cache[c]] = vertex_score(-1, valence[new_cache[c]]);
+        }
+        cache_count = (new_count < VERTEX_CACHE_SIZE) ? new_count : VERTEX_CACHE_SIZE;
+
+        // Rescore the cached vertices and their triangles, and pick the best of those
+        best_triangle = -1;
+        best_score = -1.0f;
+        for (int c = 0; c < cache_count; c++)
+        {
+            int v = new_cache[c];
+            cache[c] = v;
+            cache_position[v] = c;
+            score[v] = vertex_score(c, valence[v]);
+        }
+        for (int c = 0; c < cache_count; c++)
+        {
+            int v = cache[c];
+            for (int k = 0; k < valence[v]; k++)
+            {
+                int f = vertex_triangles[vertex_offset[v] + k];
+                triangle_score[f] = score[indices[f * 3]] + score[indices[f * 3 + 1]] + score[indices[f * 3 + 2]];
+                if (triangle_score[f] > best_score)
+                {
+                    best_score = triangle_score[f];
+                    best_triangle = f;
+                }
+            }
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Renumber vertices in the order the (already reordered) faces first use
+// them, so the vertex fetches walk the vertex buffer front to back.
+// vertex_remap[old] receives the new index (-1 for unused vertices), the
+// indices are rewritten in place, and the number of used vertices is returned.
+///////////////////////////////////////////////////////////////////////////////
+int optimize_vertex_fetch(uint32_t* indices, int num_faces, int num_vertices, int* vertex_remap)
+{
+    for (int v = 0; v < num_vertices; v++)
+    {
+        vertex_remap[v] = -1;
+    }
+
+    int next_vertex = 0;
+    for (int i = 0; i < num_faces * 3; i++)
+    {
+        uint32_t v = indices[i];
+        if (vertex_remap[v] < 0)
+        {
+            vertex_remap[v] = next_vertex++;
+        }
+        indices[i] = (uint32_t)vertex_remap[v];
+    }
+    return next_vertex;
+}
@@ -0,0 +1,13 @@
+#ifndef VERTEX_CACHE_H
+#define VERTEX_CACHE_H
+
+#include <stdint.h>
+
+// Number of recently transformed vertices the optimizer and the ACMR measure assume
+#define VERTEX_CACHE_SIZE 32
+
+float compute_acmr(const uint32_t* indices, int num_faces, int num_vertices, int cache_size);
+void optimize_vertex_cache(const uint32_t* indices, int num_faces, int num_vertices, int* face_order);
+int optimize_vertex_fetch(uint32_t* indices, int num_faces, int num_vertices, int* vertex_remap);
+
+#endif
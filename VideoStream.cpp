@@ -0,0 +1,574 @@
+#include "VideoStream.h"
+#include "Display.h"
+#include "Simd.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#if defined(SIMD_X86)
+#include <immintrin.h>
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Raw video stream
+///////////////////////////////////////////////////////////////////////////////
+// Frames go out uncompressed, to a file or to stdout ("-") to be piped
+// into an external encoder:
+//   Renderer --stream - | ffmpeg -f yuv4mpegpipe -i - out.mp4
+//   Renderer --stream - --stream-format rgba | ffmpeg -f rawvideo -pix_fmt rgba -s WxH -r 60 -i - out.mp4
+// When the stream is stdout, everything the renderer prints goes to stderr
+// instead.
+//
+// Double buffered: the render thread copies the finished frame into a free
+// capture buffer and goes on; the writer thread converts the buffers it is
+// handed to the stream format and writes them, oldest first. Rendering
+// never waits for the writes: when both buffers are still waiting for the
+// writer, the frame is dropped and counted.
+///////////////////////////////////////////////////////////////////////////////
+#define NUM_CAPTURE_BUFFERS 2
+
+enum capture_buffer_state {
+    CAPTURE_FREE,
+    CAPTURE_READY,  // holds a frame the writer has not taken yet
+    CAPTURE_WRITING
+};
+
+typedef struct {
+    uint32_t* pixels; // width * height, row-major ARGB
+    int state;
+    uint64_t sequence;
+} capture_buffer_t;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t dropped;
+    uint64_t bytes;
+    uint64_t convert_time; // performance counter ticks
+    uint64_t write_time;
+} video_stream_stats_t;
+
+static FILE* stream_file = NULL;
+static int stream_format = VIDEO_STREAM_Y4M;
+static int stream_width = 0;
+static int stream_height = 0;
+static bool streaming = false;
+static bool stream_failed = false; // the writer hit an error, later frames are dropped
+
+static capture_buffer_t capture_buffers[NUM_CAPTURE_BUFFERS];
+static uint64_t next_sequence = 0;
+static uint8_t* frame_bytes = NULL; // the converted frame, owned by the writer thread
+static size_t frame_size = 0;
+
+static std::thread writer_thread;
+static std::mutex stream_lock;
+static std::condition_variable stream_changed;
+static bool writer_stopping = false;
+
+static video_stream_stats_t stream_stats = { 0, 0, 0, 0, 0 };
+static uint64_t stream_start_time = 0;
+
+///////////////////////////////////////////////////////////////////////////////
+// ARGB to YUV 4:2:0, BT.601 limited range
+///////////////////////////////////////////////////////////////////////////////
+//   Y =  ( 66 R + 129 G +  25 B + 128) / 256 + 16
+//   U =  (-38 R -  74 G + 112 B + 128) / 256 + 128
+//   V =  (112 R -  94 G -  18 B + 128) / 256 + 128
+// U and V take the sum of a 2x2 block of pixels (4 times the average) and
+// divide by 1024 instead. The SIMD kernels do exactly the same integer
+// math as the scalar one, 8 columns of two rows at a time, and leave the
+// right edge and a last odd row to it.
+///////////////////////////////////////////////////////////////////////////////
+static inline uint8_t rgb_to_y(int r, int g, int b)
+{
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+// r, g, b are sums of 4 pixels
+static inline uint8_t rgb_sum_to_u(int r, int g, int b)
+{
+    return (uint8_t)(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+}
+
+static inline uint8_t rgb_sum_to_v(int r, int g, int b)
+{
+    return (uint8_t)(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+}
+
+// Columns [x, width) of two rows; row_1 may be row_0 (odd height), with y_1 NULL
+static void argb_to_yuv420_scalar(const uint32_t* row_0, const uint32_t* row_1, int x, int width,
+    uint8_t* y_0, uint8_t* y_1, uint8_t* u, uint8_t* v)
+{
+    for (; x < width; x += 2)
+    {
+        // An odd width repeats the last column
+        int x_1 = (x + 1 < width) ? x + 1 : x;
+        uint32_t pixels[4] = { row_0[x], row_0[x_1], row_1[x], row_1[x_1] };
+
+        int r = 0, g = 0, b = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            r += (pixels[i] >> 16) & 0xFF;
+            g += (pixels[i] >> 8) & 0xFF;
+            b += pixels[i] & 0xFF;
+        }
+
+        y_0[x] = rgb_to_y((row_0[x] >> 16) & 0xFF, (row_0[x] >> 8) & 0xFF, row_0[x] & 0xFF);
+        if (x + 1 < width)
+        {
+            y_0[x + 1] = rgb_to_y((row_0[x + 1] >> 16) & 0xFF, (row_0[x + 1] >> 8) & 0xFF, row_0[x + 1] & 0xFF);
+        }
+        if (y_1)
+        {
+            y_1[x] = rgb_to_y((row_1[x] >> 16) & 0xFF, (row_1[x] >> 8) & 0xFF, row_1[x] & 0xFF);
+            if (x + 1 < width)
+            {
+                y_1[x + 1] = rgb_to_y((row_1[x + 1] >> 16) & 0xFF, (row_1[x + 1] >> 8) & 0xFF, row_1[x + 1] & 0xFF);
+            }
+        }
+        u[x / 2] = rgb_sum_to_u(r, g, b);
+        v[x / 2] = rgb_sum_to_v(r, g, b);
+    }
+}
+
+// Returns the number of columns converted, the scalar code does the rest
+typedef int (*argb_to_yuv420_fn)(const uint32_t* row_0, const uint32_t* row_1, int width,
+    uint8_t* y_0, uint8_t* y_1, uint8_t* u, uint8_t* v);
+
+static int argb_to_yuv420_none(const uint32_t*, const uint32_t*, int, uint8_t*, uint8_t*, uint8_t*, uint8_t*)
+{
+    return 0;
+}
+
+#if defined(SIMD_X86)
+
+// Weighted sum of the B, G, R bytes of each of 4 ARGB pixels, as 4 int32
+SIMD_TARGET("sse2")
+static inline __m128i weigh_pixels_sse2(__m128i pixels, __m128i weights)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights); // b*wb+g*wg, r*wr for pixels 0,1
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights); // pixels 2,3
+    __m128 lo_ps = _mm_castsi128_ps(lo);
+    __m128 hi_ps = _mm_castsi128_ps(hi);
+    __m128i even = _mm_castps_si128(_mm_shuffle_ps(lo_ps, hi_ps, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd = _mm_castps_si128(_mm_shuffle_ps(lo_ps, hi_ps, _MM_SHUFFLE(3, 1, 3, 1)));
+    return _mm_add_epi32(even, odd);
+}
+
+// Y of 8 pixels (two registers of 4) as 8 bytes in the low half
+SIMD_TARGET("sse2")
+static inline __m128i luma_sse2(__m128i pixels_a, __m128i pixels_b)
+{
+    const __m128i weights = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+    const __m128i rounding = _mm_set1_epi32(128);
+    __m128i a = _mm_srai_epi32(_mm_add_epi32(weigh_pixels_sse2(pixels_a, weights), rounding), 8);
+    __m128i b = _mm_srai_epi32(_mm_add_epi32(weigh_pixels_sse2(pixels_b, weights), rounding), 8);
+    __m128i y = _mm_add_epi16(_mm_packs_epi32(a, b), _mm_set1_epi16(16));
+    return _mm_packus_epi16(y, y);
+}
+
+// Sums of the 2x2 blocks of 4 columns of two rows, as 2 pixels of 16-bit B, G, R, A
+SIMD_TARGET("sse2")
+static inline __m128i sum_blocks_sse2(__m128i row_0, __m128i row_1)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row_0, zero), _mm_unpacklo_epi8(row_1, zero)); // columns 0,1
+    __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row_0, zero), _mm_unpackhi_epi8(row_1, zero)); // columns 2,3
+    lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+    hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    return _mm_unpacklo_epi64(lo, hi);
+}
+
+// One chroma plane for 4 blocks (two registers of 2 block sums), 4 bytes in the low lane
+SIMD_TARGET("sse2")
+static inline __m128i chroma_sse2(__m128i sums_a, __m128i sums_b, __m128i weights)
+{
+    __m128i a = _mm_madd_epi16(sums_a, weights);
+    __m128i b = _mm_madd_epi16(sums_b, weights);
+    __m128 a_ps = _mm_castsi128_ps(a);
+    __m128 b_ps = _mm_castsi128_ps(b);
+    __m128i even = _mm_castps_si128(_mm_shuffle_ps(a_ps, b_ps, _MM_SHUFFLE(2, 0, 2, 0)));
+    __m128i odd = _mm_castps_si128(_mm_shuffle_ps(a_ps, b_ps, _MM_SHUFFLE(3, 1, 3, 1)));
+    __m128i c = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(even, odd), _mm_set1_epi32(512)), 10);
+    c = _mm_add_epi16(_mm_packs_epi32(c, c), _mm_set1_epi16(128));
+    return _mm_packus_epi16(c, c);
+}
+
+SIMD_TARGET("sse2")
+static int argb_to_yuv420_sse2(const uint32_t* row_0, const uint32_t* row_1, int width,
+    uint8_t* y_0, uint8_t* y_1, uint8_t* u, uint8_t* v)
+{
+    const __m128i u_weights = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+    const __m128i v_weights = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i a_0 = _mm_loadu_si128((const __m128i*)(row_0 + x));
+        __m128i b_0 = _mm_loadu_si128((const __m128i*)(row_0 + x + 4));
+        __m128i a_1 = _mm_loadu_si128((const __m128i*)(row_1 + x));
+        __m128i b_1 = _mm_loadu_si128((const __m128i*)(row_1 + x + 4));
+
+        _mm_storel_epi64((__m128i*)(y_0 + x), luma_sse2(a_0, b_0));
+        if (y_1)
+        {
+            _mm_storel_epi64((__m128i*)(y_1 + x), luma_sse2(a_1, b_1));
+        }
+
+        __m128i sums_a = sum_blocks_sse2(a_0, a_1);
+        __m128i sums_b = sum_blocks_sse2(b_0, b_1);
+        int u_bytes = _mm_cvtsi128_si32(chroma_sse2(sums_a, sums_b, u_weights));
+        int v_bytes = _mm_cvtsi128_si32(chroma_sse2(sums_a, sums_b, v_weights));
+        memcpy(u + x / 2, &u_bytes, 4);
+        memcpy(v + x / 2, &v_bytes, 4);
+    }
+    return x;
+}
+
+#endif
+
+static argb_to_yuv420_fn select_argb_to_yuv420_kernel(void)
+{
+#if defined(SIMD_X86)
+    if (cpu_has_sse2()) return argb_to_yuv420_sse2;
+#endif
+    return argb_to_yuv420_none;
+}
+
+// Planes Y (width x height), U and V ((width+1)/2 x (height+1)/2), one after the other
+static void convert_frame_to_yuv420(const uint32_t* pixels, uint8_t* out)
+{
+    static const argb_to_yuv420_fn kernel = select_argb_to_yuv420_kernel();
+
+    int chroma_width = (stream_width + 1) / 2;
+    int chroma_height = (stream_height + 1) / 2;
+    uint8_t* y_plane = out;
+    uint8_t* u_plane = y_plane + (size_t)stream_width * stream_height;
+    uint8_t* v_plane = u_plane + (size_t)chroma_width * chroma_height;
+
+    for (int y = 0; y < stream_height; y += 2)
+    {
+        bool odd_row = y + 1 >= stream_height;
+        const uint32_t* row_0 = pixels + (size_t)y * stream_width;
+        const uint32_t* row_1 = odd_row ? row_0 : row_0 + stream_width;
+        uint8_t* y_0 = y_plane + (size_t)y * stream_width;
+        uint8_t* y_1 = odd_row ? NULL : y_0 + stream_width;
+        uint8_t* u = u_plane + (size_t)(y / 2) * chroma_width;
+        uint8_t* v = v_plane + (size_t)(y / 2) * chroma_width;
+
+        int x = kernel(row_0, row_1, stream_width, y_0, y_1, u, v);
+        argb_to_yuv420_scalar(row_0, row_1, x, stream_width, y_0, y_1, u, v);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// ARGB words (bytes B, G, R, A in memory) to R, G, B, A bytes. The alpha of
+// the color buffer is whatever the shading left there, the frames go out
+// opaque.
+///////////////////////////////////////////////////////////////////////////////
+typedef size_t (*argb_to_rgba_fn)(const uint32_t* pixels, uint8_t* out, size_t count);
+
+static size_t argb_to_rgba_none(const uint32_t*, uint8_t*, size_t)
+{
+    return 0;
+}
+
+#if defined(SIMD_X86)
+
+SIMD_TARGET("ssse3")
+static size_t argb_to_rgba_ssse3(const uint32_t* pixels, uint8_t* out, size_t count)
+{
+    const __m128i swap_red_blue = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m128i opaque = _mm_set1_epi32((int)0xFF000000);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i p = _mm_loadu_si128((const __m128i*)(pixels + i));
+        _mm_storeu_si128((__m128i*)(out + i * 4), _mm_or_si128(_mm_shuffle_epi8(p, swap_red_blue), opaque));
+    }
+    return i;
+}
+
+#endif
+
+static argb_to_rgba_fn select_argb_to_rgba_kernel(void)
+{
+#if defined(SIMD_X86)
+    if (cpu_has_ssse3()) return argb_to_rgba_ssse3;
+#endif
+    return argb_to_rgba_none;
+}
+
+static void convert_frame_to_rgba(const uint32_t* pixels, uint8_t* out)
+{
+    static const argb_to_rgba_fn kernel = select_argb_to_rgba_kernel();
+
+    size_t count = (size_t)stream_width * stream_height;
+    for (size_t i = kernel(pixels, out, count); i < count; i++)
+    {
+        out[i * 4 + 0] = (uint8_t)(pixels[i] >> 16);
+        out[i * 4 + 1] = (uint8_t)(pixels[i] >> 8);
+        out[i * 4 + 2] = (uint8_t)pixels[i];
+        out[i * 4 + 3] = 0xFF;
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Writer thread
+///////////////////////////////////////////////////////////////////////////////
+static void report_stream_stats(void)
+{
+    double seconds = (double)(SDL_GetPerformanceCounter() - stream_start_time) / SDL_GetPerformanceFrequency();
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    uint64_t frames = (stream_stats.frames > 0) ? stream_stats.frames : 1;
+    printf("Stream: %llu frames, %llu dropped, %.1f MB/s, %.2f ms convert, %.2f ms write per frame\n",
+        (unsigned long long)stream_stats.frames, (unsigned long long)stream_stats.dropped,
+        (seconds > 0.0) ? stream_stats.bytes / (1024.0 * 1024.0) / seconds : 0.0,
+        stream_stats.convert_time * 1000.0 / frequency / frames,
+        stream_stats.write_time * 1000.0 / frequency / frames);
+}
+
+static void writer_main(void)
+{
+    uint32_t report_ticks = SDL_GetTicks();
+
+    std::unique_lock<std::mutex> guard(stream_lock);
+    for (;;)
+    {
+        // The oldest frame waiting
+        capture_buffer_t* buffer = NULL;
+        stream_changed.wait(guard, [&] {
+            buffer = NULL;
+            for (int i = 0; i < NUM_CAPTURE_BUFFERS; i++)
+            {
+                capture_buffer_t* candidate = &capture_buffers[i];
+                if (candidate->state == CAPTURE_READY && (buffer == NULL || candidate->sequence < buffer->sequence))
+                {
+                    buffer = candidate;
+                }
+            }
+            return buffer != NULL || writer_stopping;
+        });
+        if (buffer == NULL)
+        {
+            return;
+        }
+        buffer->state = CAPTURE_WRITING;
+        guard.unlock();
+
+        uint64_t start = SDL_GetPerformanceCounter();
+        if (stream_format == VIDEO_STREAM_Y4M)
+        {
+            convert_frame_to_yuv420(buffer->pixels, frame_bytes);
+        }
+        else
+        {
+            convert_frame_to_rgba(buffer->pixels, frame_bytes);
+        }
+        uint64_t converted = SDL_GetPerformanceCounter();
+
+        bool written = true;
+        if (stream_format == VIDEO_STREAM_Y4M)
+        {
+            written = fputs("FRAME\n", stream_file) >= 0;
+        }
+        written = written && fwrite(frame_bytes, 1, frame_size, stream_file) == frame_size;
+        uint64_t finished = SDL_GetPerformanceCounter();
+
+        guard.lock();
+        buffer->state = CAPTURE_FREE;
+        if (!written)
+        {
+            fprintf(stderr, "Error writing the video stream, stopping it.\n");
+            stream_failed = true;
+        }
+        else
+        {
+            stream_stats.frames++;
+            stream_stats.bytes += frame_size;
+            stream_stats.convert_time += converted - start;
+            stream_stats.write_time += finished - converted;
+        }
+
+        if (SDL_GetTicks() - report_ticks >= 1000)
+        {
+            report_ticks = SDL_GetTicks();
+            report_stream_stats();
+        }
+    }
+}
+
+// Close the stream file and free the buffers, also after a failed start
+static void free_stream_buffers(void)
+{
+    fclose(stream_file);
+    stream_file = NULL;
+    for (int i = 0; i < NUM_CAPTURE_BUFFERS; i++)
+    {
+        simd_aligned_free(capture_buffers[i].pixels);
+        capture_buffers[i].pixels = NULL;
+    }
+    simd_aligned_free(frame_bytes);
+    frame_bytes = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Start streaming the frames passed to stream_video_frame() to path, "-"
+// for stdout
+///////////////////////////////////////////////////////////////////////////////
+bool start_video_stream(const char* path, int format, int fps)
+{
+    if (streaming)
+    {
+        stop_video_stream();
+    }
+
+    if (strcmp(path, "-") == 0)
+    {
+        // Keep stdout for the frames and send all the other output to stderr
+        fflush(stdout);
+#if defined(_WIN32)
+        int fd = _dup(_fileno(stdout));
+        _dup2(_fileno(stderr), _fileno(stdout));
+        _setmode(fd, _O_BINARY);
+        stream_file = (fd >= 0) ? _fdopen(fd, "wb") : NULL;
+#else
+        int fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+        stream_file = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+#endif
+    }
+    else
+    {
+        stream_file = fopen(path, "wb");
+    }
+    if (!stream_file)
+    {
+        fprintf(stderr, "Error opening the video stream %s.\n", path);
+        return false;
+    }
+
+#if !defined(_WIN32)
+    // A closed pipe should fail the write, not kill the renderer
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    stream_format = format;
+    stream_width = get_window_width();
+    stream_height = get_window_height();
+
+    if (format == VIDEO_STREAM_Y4M)
+    {
+        // C420jpeg: the chroma sample sits in the middle of its 2x2 block, which is what the block average gives
+        fprintf(stream_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", stream_width, stream_height, fps);
+        frame_size = (size_t)stream_width * stream_height + 2 * (size_t)((stream_width + 1) / 2) * ((stream_height + 1) / 2);
+    }
+    else
+    {
+        frame_size = (size_t)stream_width * stream_height * 4;
+    }
+
+    frame_bytes = (uint8_t*)simd_aligned_alloc(frame_size);
+    bool allocated = (frame_bytes != NULL);
+    for (int i = 0; i < NUM_CAPTURE_BUFFERS; i++)
+    {
+        capture_buffers[i].pixels = (uint32_t*)simd_aligned_alloc((size_t)stream_width * stream_height * sizeof(uint32_t));
+        capture_buffers[i].state = CAPTURE_FREE;
+        capture_buffers[i].sequence = 0;
+        allocated = allocated && (capture_buffers[i].pixels != NULL);
+    }
+    if (!allocated)
+    {
+        fprintf(stderr, "Error allocating the video stream buffers.\n");
+        free_stream_buffers();
+        return false;
+    }
+    next_sequence = 0;
+    stream_failed = false;
+    writer_stopping = false;
+    stream_stats = { 0, 0, 0, 0, 0 };
+    stream_start_time = SDL_GetPerformanceCounter();
+
+    writer_thread = std::thread(writer_main);
+    streaming = true;
+    return true;
+}
+
+bool is_streaming_video(void)
+{
+    return streaming;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Hand the frame drawn so far to the writer. Call it before
+// render_color_buffer(); never waits for the writer.
+///////////////////////////////////////////////////////////////////////////////
+void stream_video_frame(void)
+{
+    if (!streaming)
+    {
+        return;
+    }
+
+    capture_buffer_t* buffer = NULL;
+    {
+        std::lock_guard<std::mutex> guard(stream_lock);
+        for (int i = 0; i < NUM_CAPTURE_BUFFERS && buffer == NULL; i++)
+        {
+            if (capture_buffers[i].state == CAPTURE_FREE)
+            {
+                buffer = &capture_buffers[i];
+            }
+        }
+        if (buffer == NULL || stream_failed)
+        {
+            stream_stats.dropped++;
+            return;
+        }
+    }
+
+    // Free buffers belong to the render thread until they are marked ready
+    read_color_buffer(buffer->pixels, stream_width * sizeof(uint32_t));
+
+    {
+        std::lock_guard<std::mutex> guard(stream_lock);
+        buffer->sequence = next_sequence++;
+        buffer->state = CAPTURE_READY;
+    }
+    stream_changed.notify_one();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Write out the frames still waiting and close the stream
+///////////////////////////////////////////////////////////////////////////////
+void stop_video_stream(void)
+{
+    if (!streaming)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(stream_lock);
+        writer_stopping = true;
+    }
+    stream_changed.notify_one();
+    writer_thread.join();
+
+    free_stream_buffers();
+    streaming = false;
+
+    report_stream_stats();
+}
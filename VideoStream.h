@@ -0,0 +1,16 @@
+#ifndef VIDEO_STREAM_H
+#define VIDEO_STREAM_H
+
+#include <stdbool.h>
+
+enum video_stream_format {
+    VIDEO_STREAM_Y4M, // YUV4MPEG2, 4:2:0 BT.601 limited range
+    VIDEO_STREAM_RGBA // headerless 8-bit RGBA frames, one after the other
+};
+
+bool start_video_stream(const char* path, int format, int fps);
+bool is_streaming_video(void);
+void stream_video_frame(void);
+void stop_video_stream(void);
+
+#endif
@@ -0,0 +1,210 @@
+#include "Wireframe.h"
+#include "Clipping.h"
+#include "Display.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+///////////////////////////////////////////////////////////////////////////////
+// Edge set
+///////////////////////////////////////////////////////////////////////////////
+// Neighbouring triangles of a mesh share their edges, so drawing three
+// lines per triangle draws most lines twice. Every edge that survives
+// clipping is packed into a 64-bit key of its two on-screen endpoints and
+// looked up in an open addressing hash set; only the first occurrence is
+// drawn. The endpoints are put in a fixed order before clipping, so both
+// copies of a shared edge clip to the same key. The vertex points reuse
+// the set, keyed by their screen position.
+//
+// Each slot carries the generation of the draw call that filled it, and a
+// slot from an older generation counts as empty, so starting a new set is
+// one increment instead of clearing the table. The table is sized for the
+// largest recent call: it grows when needed and shrinks when it is far too
+// big, and only then is it cleared.
+///////////////////////////////////////////////////////////////////////////////
+typedef struct {
+    uint64_t key;
+    uint32_t generation;
+} edge_slot_t;
+
+static edge_slot_t* edge_slots = NULL;
+static size_t edge_capacity = 0; // power of two, 0 when the table could not be allocated
+static uint32_t edge_generation = 0;
+
+static void reset_edge_set(int max_edges)
+{
+    size_t capacity = 1024;
+    while (capacity < (size_t)max_edges * 2)
+    {
+        capacity *= 2;
+    }
+    if (capacity > edge_capacity || capacity * 16 < edge_capacity)
+    {
+        free(edge_slots);
+        edge_slots = (edge_slot_t*)calloc(capacity, sizeof(edge_slot_t));
+        if (!edge_slots)
+        {
+            // Every edge is drawn then, shared or not
+            fprintf(stderr, "Error allocating the wireframe edge set.\n");
+            edge_capacity = 0;
+            return;
+        }
+        edge_capacity = capacity;
+        edge_generation = 0;
+    }
+
+    // The zeroed slots are generation 0, so that one is never used
+    if (++edge_generation == 0)
+    {
+        memset(edge_slots, 0, edge_capacity * sizeof(edge_slot_t));
+        edge_generation = 1;
+    }
+}
+
+// Returns true if the edge was not in the set yet
+static bool insert_edge(uint64_t key)
+{
+    if (edge_capacity == 0)
+    {
+        return true;
+    }
+    size_t mask = edge_capacity - 1;
+    size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+    for (;;)
+    {
+        edge_slot_t* entry = &edge_slots[slot];
+        if (entry->generation != edge_generation)
+        {
+            entry->key = key;
+            entry->generation = edge_generation;
+            return true;
+        }
+        if (entry->key == key)
+        {
+            return false;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+// 1/w at a point of the line from (x0,y0) to (x1,y1), measured along its longer axis
+static float interpolate_reciprocal_w(int x0, int y0, float reciprocal_w0, int x1, int y1, float reciprocal_w1, int x, int y)
+{
+    int delta_x = x1 - x0;
+    int delta_y = y1 - y0;
+    float t = 0.0f;
+    if (abs(delta_x) >= abs(delta_y))
+    {
+        t = (delta_x != 0) ? (float)(x - x0) / delta_x : 0.0f;
+    }
+    else
+    {
+        t = (float)(y - y0) / delta_y;
+    }
+    return reciprocal_w0 + (reciprocal_w1 - reciprocal_w0) * t;
+}
+
+static void draw_edge(vec4_t a, vec4_t b, int max_x, int max_y, bool depth_tested, uint32_t color)
+{
+    // Same order for both triangles sharing the edge
+    if ((int)b.y < (int)a.y || ((int)b.y == (int)a.y && (int)b.x < (int)a.x))
+    {
+        vec4_t point = a; a = b; b = point;
+    }
+    int x0 = (int)a.x, y0 = (int)a.y;
+    int x1 = (int)b.x, y1 = (int)b.y;
+    if (!clip_line_to_rect(&x0, &y0, &x1, &y1, 0, 0, max_x, max_y))
+    {
+        return;
+    }
+
+    uint64_t key = (uint64_t)(uint16_t)x0 | ((uint64_t)(uint16_t)y0 << 16) |
+        ((uint64_t)(uint16_t)x1 << 32) | ((uint64_t)(uint16_t)y1 << 48);
+    if (!insert_edge(key))
+    {
+        return;
+    }
+
+    if (depth_tested)
+    {
+        // The clipped endpoints take their 1/w from where they are on the original line
+        float reciprocal_w0 = interpolate_reciprocal_w((int)a.x, (int)a.y, 1.0f / a.w, (int)b.x, (int)b.y, 1.0f / b.w, x0, y0);
+        float reciprocal_w1 = interpolate_reciprocal_w((int)a.x, (int)a.y, 1.0f / a.w, (int)b.x, (int)b.y, 1.0f / b.w, x1, y1);
+        draw_depth_tested_line(x0, y0, reciprocal_w0, x1, y1, reciprocal_w1, color);
+    }
+    else
+    {
+        draw_line(x0, y0, x1, y1, color);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw the edges of all triangles, each shared edge only once. Depth tested
+// edges are hidden behind the faces already in the z-buffer.
+///////////////////////////////////////////////////////////////////////////////
+void draw_wireframe(const triangle_t* triangles, int num_triangles, bool depth_tested, uint32_t color)
+{
+    int max_x = get_window_width() - 1;
+    int max_y = get_window_height() - 1;
+
+    reset_edge_set(num_triangles * 3);
+
+    for (int i = 0; i < num_triangles; i++)
+    {
+        const vec4_t* points = triangles[i].points;
+        draw_edge(points[0], points[1], max_x, max_y, depth_tested, color);
+        draw_edge(points[1], points[2], max_x, max_y, depth_tested, color);
+        draw_edge(points[2], points[0], max_x, max_y, depth_tested, color);
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Draw a size x size point at every vertex, each shared vertex only once
+///////////////////////////////////////////////////////////////////////////////
+// The vertices go through the same set as the edges, keyed by their screen
+// position; points entirely off the screen are skipped before that.
+///////////////////////////////////////////////////////////////////////////////
+void draw_wireframe_vertices(const triangle_t* triangles, int num_triangles, int size, bool depth_tested, uint32_t color)
+{
+    int width = get_window_width();
+    int height = get_window_height();
+
+    reset_edge_set(num_triangles * 3);
+
+    for (int i = 0; i < num_triangles; i++)
+    {
+        for (int j = 0; j < 3; j++)
+        {
+            vec4_t point = triangles[i].points[j];
+            int x = (int)point.x;
+            int y = (int)point.y;
+            if (x <= -size || x >= width || y <= -size || y >= height)
+            {
+                continue;
+            }
+
+            uint64_t key = (uint64_t)(uint32_t)(x + size) | ((uint64_t)(uint32_t)(y + size) << 32);
+            if (!insert_edge(key))
+            {
+                continue;
+            }
+
+            if (depth_tested)
+            {
+                draw_depth_tested_rect(x, y, 1.0f / point.w, size, size, color);
+            }
+            else
+            {
+                draw_rect(x, y, size, size, color);
+            }
+        }
+    }
+}
+
+void free_wireframe_buffers(void)
+{
+    free(edge_slots);
+    edge_slots = NULL;
+    edge_capacity = 0;
+    edge_generation = 0;
+}
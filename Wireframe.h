@@ -0,0 +1,12 @@
+#ifndef WIREFRAME_H
+#define WIREFRAME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "Triangle.h"
+
+void draw_wireframe(const triangle_t* triangles, int num_triangles, bool depth_tested, uint32_t color);
+void draw_wireframe_vertices(const triangle_t* triangles, int num_triangles, int size, bool depth_tested, uint32_t color);
+void free_wireframe_buffers(void);
+
+#endif
@@ -39,6 +39,20 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdlib.h> /* allocations */
 #endif /* LODEPNG_COMPILE_ALLOCATORS */
 
+#ifdef LODEPNG_COMPILE_SIMD
+#ifdef _MSC_VER
+#include <intrin.h> /* __cpuid */
+#endif
+#include <immintrin.h>
+#endif /* LODEPNG_COMPILE_SIMD */
+
+#ifdef LODEPNG_COMPILE_THREADS
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#endif /* LODEPNG_COMPILE_THREADS */
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -142,6 +156,58 @@ static size_t lodepng_strlen(const char* a) {
 #define LODEPNG_MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define LODEPNG_ABS(x) ((x) < 0 ? -(x) : (x))
 
+#ifdef LODEPNG_COMPILE_SIMD
+/*GCC and Clang only emit instructions above the target of the build in functions that ask for them,
+MSVC lets every function use every instruction set*/
+#if defined(_MSC_VER) && !defined(__clang__)
+#define LODEPNG_TARGET(isa)
+#else
+#define LODEPNG_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/*instruction sets that the CPU and OS support, the SIMD code paths are picked from these at runtime*/
+typedef struct LodePNGCPUFeatures {
+  unsigned sse2;
+  unsigned ssse3;
+  unsigned pclmul;
+  unsigned avx2;
+} LodePNGCPUFeatures;
+
+static LodePNGCPUFeatures lodepng_detect_cpu_features(void) {
+  LodePNGCPUFeatures features = {0, 0, 0, 0};
+#ifdef _MSC_VER
+  int info[4];
+  int max_leaf;
+  unsigned os_saves_ymm = 0;
+  __cpuid(info, 0);
+  max_leaf = info[0];
+  __cpuid(info, 1);
+  /*AVX registers are only usable if the OS saves them on context switches (OSXSAVE and XCR0)*/
+  if(info[2] & (1 << 27)) os_saves_ymm = (_xgetbv(0) & 6) == 6;
+  features.sse2 = (info[3] & (1 << 26)) != 0;
+  features.ssse3 = (info[2] & (1 << 9)) != 0;
+  features.pclmul = (info[2] & (1 << 1)) != 0;
+  if(max_leaf >= 7) {
+    __cpuidex(info, 7, 0);
+    features.avx2 = os_saves_ymm && (info[1] & (1 << 5)) != 0;
+  }
+#else
+  __builtin_cpu_init();
+  features.sse2 = __builtin_cpu_supports("sse2") != 0;
+  features.ssse3 = __builtin_cpu_supports("ssse3") != 0;
+  features.pclmul = __builtin_cpu_supports("pclmul") != 0;
+  features.avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+  return features;
+}
+
+/*detected once on first use, the decoding threads may race to it but a static local is initialized once*/
+static const LodePNGCPUFeatures* lodepng_cpu_features(void) {
+  static const LodePNGCPUFeatures features = lodepng_detect_cpu_features();
+  return &features;
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
 #if defined(LODEPNG_COMPILE_PNG) || defined(LODEPNG_COMPILE_DECODER)
 /* Safely check if adding two integers will overflow (no undefined
 behavior, compiler removing the code, etc...) and output result. */
@@ -1092,6 +1158,102 @@ static unsigned huffmanDecodeSymbol(LodePNGBitReader* reader, const HuffmanTree*
 /* / Inflator (Decompressor)                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+/*
+Streamed inflate: instead of all the compressed data up front and all the decompressed data at the end, the
+input comes a piece at a time from a read callback, and the output goes to a write callback as it is produced.
+The bit reader then holds a window of the input, which inflateStreamSync refills, and out a window of the
+output: the 32K that LZ77 matches can refer back to, and what the writer did not use yet. inflateStreamSync is
+called at the start of every block and between the symbols that are decoded one by one, the fast path stops at
+flush_size so that it comes back there in time. Without a stream (NULL) nothing changes.
+*/
+
+/*the farthest back a match can refer to, the part of the output that is always kept*/
+#define INFLATE_STREAM_WINDOW 32768u
+/*the input is refilled once less is left than this, which is more than the longest dynamic block header*/
+#define INFLATE_STREAM_INPUT_LOW 1024u
+
+typedef struct InflateStream {
+  /*gives up to capacity more bytes of compressed data, *size 0 means the end of the data*/
+  unsigned (*read)(unsigned char* buffer, size_t capacity, size_t* size, void* context);
+  /*gets the decompressed bytes that were not used yet, sets *used to how many of them it used. The others are
+  given again with the next ones*/
+  unsigned (*write)(const unsigned char* data, size_t size, size_t* used, void* context);
+  void* context;
+
+  unsigned char* in; /*the input window the bit reader reads from*/
+  size_t in_capacity;
+  unsigned in_done; /*read returned the end of the data*/
+
+  size_t flush_size; /*size of out at which the writer gets the new bytes and out is compacted*/
+  size_t used; /*bytes at the start of out the writer used*/
+  size_t dropped; /*bytes that were removed from the start of out, the offset of out in the whole output*/
+
+  unsigned check_adler; /*keep the Adler-32 of the output, the writer may see bytes twice so it can't*/
+  unsigned adler;
+  size_t summed; /*bytes at the start of out that are in adler*/
+} InflateStream;
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len);
+
+/*like memmove towards a lower address: the ranges may overlap as long as dst is before src*/
+static void lodepng_memmove_down(unsigned char* dst, const unsigned char* src, size_t size) {
+  size_t i;
+  for(i = 0; i < size; i++) dst[i] = src[i];
+}
+
+/*gives the new bytes of out to the writer, then, unless this is the last time, drops what is not needed anymore
+from the start of out: what the writer used, except the last INFLATE_STREAM_WINDOW bytes*/
+static unsigned inflateStreamFlush(InflateStream* stream, ucvector* out, unsigned final) {
+  size_t used = 0, drop = 0;
+  unsigned error;
+  if(stream->check_adler && out->size > stream->summed) {
+    stream->adler = update_adler32(stream->adler, out->data + stream->summed, (unsigned)(out->size - stream->summed));
+    stream->summed = out->size;
+  }
+  error = stream->write(out->data + stream->used, out->size - stream->used, &used, stream->context);
+  if(error) return error;
+  stream->used += used;
+  if(final) return 0;
+
+  if(out->size > INFLATE_STREAM_WINDOW) drop = LODEPNG_MIN(stream->used, out->size - INFLATE_STREAM_WINDOW);
+  if(drop) {
+    lodepng_memmove_down(out->data, out->data + drop, out->size - drop);
+    out->size -= drop;
+    stream->used -= drop;
+    stream->summed -= drop;
+    stream->dropped += drop;
+  }
+  return 0;
+}
+
+/*moves the unread bytes of the input window to its start and fills the rest of it, once less than
+INFLATE_STREAM_INPUT_LOW bytes are left*/
+static unsigned inflateStreamRefill(InflateStream* stream, LodePNGBitReader* reader) {
+  size_t start = LODEPNG_MIN(reader->bp >> 3u, reader->size);
+  size_t size = reader->size - start, more = 0;
+  unsigned error;
+  if(stream->in_done || size >= INFLATE_STREAM_INPUT_LOW) return 0;
+  lodepng_memmove_down(stream->in, stream->in + start, size);
+  reader->bp -= start << 3u;
+  error = stream->read(stream->in + size, stream->in_capacity - size, &more, stream->context);
+  if(error) return error;
+  if(!more) stream->in_done = 1;
+  reader->data = stream->in;
+  reader->size = size + more;
+  reader->bitsize = reader->size << 3u;
+  return 0;
+}
+
+/*see InflateStream: flushes out once it holds flush_size bytes, and refills the input window*/
+static unsigned inflateStreamSync(InflateStream* stream, ucvector* out, LodePNGBitReader* reader) {
+  if(!stream) return 0;
+  if(out->size >= stream->flush_size) {
+    unsigned error = inflateStreamFlush(stream, out, 0);
+    if(error) return error;
+  }
+  return inflateStreamRefill(stream, reader);
+}
+
 /*get the tree of a deflated block with fixed tree, as specified in the deflate specification
 Returns error code.*/
 static unsigned getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d) {
@@ -1234,14 +1396,252 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2.*/
+/*
+Fast path of inflateHuffmanBlock, used everywhere except near the end of the input and of the output buffer:
+-the bits come from a 64-bit buffer that one unaligned load refills to at least 56 bits, enough for a whole
+ length/distance pair with all its extra bits, so there is one refill per symbol instead of several
+-literal/length codes are decoded with one lookup in a table of INFLATE_FAST_BITS bits whose entries hold
+ up to two literals, or a length code with its base length and extra bits, see buildFastTable
+-the bytes of a length/distance pair are copied 8 or 16 at a time, which may write up to 15 bytes past its end
+*/
+
+#define INFLATE_FAST_BITS 11u
+/*kinds of entries in the fast table*/
+#define INFLATE_FAST_SLOW 0u /*longer than INFLATE_FAST_BITS or invalid: decode with the HuffmanTree*/
+#define INFLATE_FAST_LITERAL 1u /*one literal*/
+#define INFLATE_FAST_LITERALS 2u /*two literals*/
+#define INFLATE_FAST_LENGTH 3u /*a length code*/
+#define INFLATE_FAST_END 4u /*the end code*/
+/*room the fast path needs in the input for one refill, and in the output for a longest match and the
+overshoot of its 8 byte copies*/
+#define INFLATE_FAST_INPUT_MARGIN 8u
+#define INFLATE_FAST_OUTPUT_MARGIN (258u + 16u)
+
+/*fast table entry: bits of the code(s) (bits 0-7), kind (8-11), extra bits of a length (12-15), and the
+literal, the two literals (first one in the low byte) or the base length (16-31)*/
+static LODEPNG_INLINE unsigned makeFastEntry(unsigned nbits, unsigned kind, unsigned extra, unsigned value) {
+  return nbits | (kind << 8u) | (extra << 12u) | (value << 16u);
+}
+
+/*the symbol of the code in the low bits of code, of which only nbits are known, and the length of the code.
+Returns INVALIDSYMBOL if more bits would be needed.*/
+static unsigned huffmanPeekSymbol(const HuffmanTree* tree, unsigned code, unsigned nbits, unsigned* len) {
+  unsigned l = tree->table_len[code & ((1u << FIRSTBITS) - 1u)];
+  unsigned value = tree->table_value[code & ((1u << FIRSTBITS) - 1u)];
+  if(l > FIRSTBITS) {
+    value += (code >> FIRSTBITS) & ((1u << (l - FIRSTBITS)) - 1u);
+    l = tree->table_len[value];
+    value = tree->table_value[value];
+  }
+  *len = l;
+  return l <= nbits ? value : INVALIDSYMBOL;
+}
+
+static void buildFastTable(unsigned* fast, const HuffmanTree* tree_ll) {
+  unsigned i;
+  for(i = 0; i != (1u << INFLATE_FAST_BITS); ++i) {
+    unsigned len, len2;
+    unsigned symbol = huffmanPeekSymbol(tree_ll, i, INFLATE_FAST_BITS, &len);
+    if(symbol <= 255) {
+      /*the bits left after the first literal may hold a second one*/
+      unsigned symbol2 = huffmanPeekSymbol(tree_ll, i >> len, INFLATE_FAST_BITS - len, &len2);
+      if(symbol2 <= 255) fast[i] = makeFastEntry(len + len2, INFLATE_FAST_LITERALS, 0, symbol | (symbol2 << 8u));
+      else fast[i] = makeFastEntry(len, INFLATE_FAST_LITERAL, 0, symbol);
+    } else if(symbol == 256) {
+      fast[i] = makeFastEntry(len, INFLATE_FAST_END, 0, 0);
+    } else if(symbol >= FIRST_LENGTH_CODE_INDEX && symbol <= LAST_LENGTH_CODE_INDEX) {
+      fast[i] = makeFastEntry(len, INFLATE_FAST_LENGTH, LENGTHEXTRA[symbol - FIRST_LENGTH_CODE_INDEX],
+                              LENGTHBASE[symbol - FIRST_LENGTH_CODE_INDEX]);
+    } else {
+      fast[i] = makeFastEntry(0, INFLATE_FAST_SLOW, 0, 0);
+    }
+  }
+}
+
+/*little endian 64-bit load, there must be 8 bytes*/
+static LODEPNG_INLINE unsigned long long readFast64(const unsigned char* p) {
+#ifdef LODEPNG_COMPILE_SIMD
+  unsigned long long value; /*x86 is little endian and loads unaligned*/
+  memcpy(&value, p, 8);
+  return value;
+#else
+  unsigned long long value = 0;
+  unsigned i;
+  for(i = 0; i != 8; ++i) value |= (unsigned long long)p[i] << (8u * i);
+  return value;
+#endif
+}
+
+/*huffmanDecodeSymbol on the 64-bit buffer of the fast path*/
+static LODEPNG_INLINE unsigned huffmanDecodeSymbolFast(unsigned long long* bits, unsigned* count,
+                                                       const HuffmanTree* tree) {
+  unsigned code = (unsigned)*bits & ((1u << FIRSTBITS) - 1u);
+  unsigned l = tree->table_len[code];
+  unsigned value = tree->table_value[code];
+  if(l > FIRSTBITS) {
+    value += ((unsigned)*bits >> FIRSTBITS) & ((1u << (l - FIRSTBITS)) - 1u);
+    l = tree->table_len[value];
+    value = tree->table_value[value];
+  }
+  *bits >>= l;
+  *count -= l;
+  return value;
+}
+
+/*copies a length/distance pair, if it overlaps itself 16 or 8 bytes at a time, writing up to 15 bytes past the end*/
+static LODEPNG_INLINE void copyMatchFast(unsigned char* out, size_t distance, size_t length) {
+  const unsigned char* src = out - distance;
+  unsigned char* end = out + length;
+  if(distance >= length) {
+    memcpy(out, src, length); /*no overlap*/
+  } else if(distance >= 16) {
+    /*every 16 bytes read were written before, also when the match overlaps itself*/
+    do {
+      memcpy(out, src, 16);
+      out += 16;
+      src += 16;
+    } while(out < end);
+  } else if(distance == 1) {
+    unsigned long long run = 0x0101010101010101ull * src[0];
+    do {
+      memcpy(out, &run, 8);
+      memcpy(out + 8, &run, 8);
+      out += 16;
+    } while(out < end);
+  } else {
+    if(distance < 8) {
+      /*a short repeating pattern: write it byte by byte until a whole number of repetitions spans 8 bytes,
+      from there on it can be copied from that far back*/
+      size_t step = distance;
+      unsigned char* pattern_end;
+      while(step < 8) step += distance;
+      pattern_end = out + step;
+      do *out++ = *src++; while(out < end && out < pattern_end);
+      src = out - step;
+    }
+    while(out < end) {
+      memcpy(out, src, 8);
+      out += 8;
+      src += 8;
+    }
+  }
+}
+
+/*decodes symbols of a block until its end code, or until there is not enough room left in the input or the output
+for the fast path, after which the caller continues symbol by symbol. *done is set at the end code. With a
+stop_size other than 0, it also stops once out holds that many bytes.*/
+static unsigned inflateHuffmanBlockFast(ucvector* out, LodePNGBitReader* reader, const unsigned* fast,
+                                        const HuffmanTree* tree_ll, const HuffmanTree* tree_d,
+                                        size_t max_output_size, size_t stop_size, int* done) {
+  const unsigned char* in;
+  const unsigned char* in_end;
+  unsigned char* begin = out->data;
+  unsigned char* pos;
+  unsigned char* pos_end;
+  unsigned long long bits = 0;
+  unsigned count = 0, error = 0;
+
+  if(reader->size < INFLATE_FAST_INPUT_MARGIN || out->allocsize < out->size + INFLATE_FAST_OUTPUT_MARGIN) return 0;
+  in = reader->data + (reader->bp >> 3u);
+  in_end = reader->data + reader->size - INFLATE_FAST_INPUT_MARGIN;
+  pos = begin + out->size;
+  pos_end = begin + out->allocsize - INFLATE_FAST_OUTPUT_MARGIN;
+  /*stopping at the max size, instead of past it, keeps the output buffer from being reallocated before error 109*/
+  if(max_output_size && max_output_size < (size_t)(pos_end - begin)) pos_end = begin + max_output_size;
+  if(stop_size && stop_size < (size_t)(pos_end - begin)) pos_end = begin + stop_size;
+  if(in > in_end || pos > pos_end) return 0;
+
+  /*the first refill starts at the byte of bp, drop the bits of it that were already read*/
+  bits = readFast64(in);
+  in += 7;
+  count = 56;
+  bits >>= (reader->bp & 7u);
+  count -= (reader->bp & 7u);
+
+  while(in <= in_end && pos <= pos_end) {
+    unsigned entry, kind;
+    size_t length, distance;
+    unsigned code_d;
+
+    /*load 8 bytes, keep the whole bytes that fit in the buffer: after this at least 56 bits are available*/
+    bits |= readFast64(in) << count;
+    in += (63u - count) >> 3u;
+    count |= 56u;
+
+    entry = fast[bits & ((1u << INFLATE_FAST_BITS) - 1u)];
+    kind = (entry >> 8u) & 15u;
+    if(kind == INFLATE_FAST_LITERAL || kind == INFLATE_FAST_LITERALS) {
+      bits >>= (entry & 255u);
+      count -= (entry & 255u);
+      /*always write both, there is room, and only advance past the second one if it is a literal*/
+      pos[0] = (unsigned char)(entry >> 16u);
+      pos[1] = (unsigned char)(entry >> 24u);
+      pos += kind;
+      continue;
+    } else if(kind == INFLATE_FAST_LENGTH) {
+      unsigned extra = (entry >> 12u) & 15u;
+      bits >>= (entry & 255u);
+      count -= (entry & 255u);
+      length = (entry >> 16u) + ((unsigned)bits & ((1u << extra) - 1u));
+      bits >>= extra;
+      count -= extra;
+    } else if(kind == INFLATE_FAST_END) {
+      bits >>= (entry & 255u);
+      count -= (entry & 255u);
+      *done = 1;
+      break;
+    } else {
+      /*a code longer than the fast table, or an invalid one*/
+      unsigned code_ll = huffmanDecodeSymbolFast(&bits, &count, tree_ll);
+      if(code_ll <= 255) {
+        *pos++ = (unsigned char)code_ll;
+        continue;
+      } else if(code_ll == 256) {
+        *done = 1;
+        break;
+      } else if(code_ll < FIRST_LENGTH_CODE_INDEX || code_ll > LAST_LENGTH_CODE_INDEX) {
+        ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
+      } else {
+        unsigned extra = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
+        length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX] + ((unsigned)bits & ((1u << extra) - 1u));
+        bits >>= extra;
+        count -= extra;
+      }
+    }
+
+    code_d = huffmanDecodeSymbolFast(&bits, &count, tree_d);
+    if(code_d > 29) {
+      if(code_d <= 31) {
+        ERROR_BREAK(18); /*error: invalid distance code (30-31 are never used)*/
+      } else /* if(code_d == INVALIDSYMBOL) */{
+        ERROR_BREAK(16); /*error: tried to read disallowed huffman symbol*/
+      }
+    }
+    distance = DISTANCEBASE[code_d] + ((unsigned)bits & ((1u << DISTANCEEXTRA[code_d]) - 1u));
+    bits >>= DISTANCEEXTRA[code_d];
+    count -= DISTANCEEXTRA[code_d];
+    if(distance > (size_t)(pos - begin)) ERROR_BREAK(52); /*too long backward distance*/
+
+    copyMatchFast(pos, distance, length);
+    pos += length;
+  }
+
+  /*the bits still in the buffer are given back*/
+  reader->bp = ((size_t)(in - reader->data) << 3u) - count;
+  out->size = (size_t)(pos - begin);
+  if(!error && max_output_size && out->size > max_output_size) error = 109; /*error, larger than max size*/
+  return error;
+}
+
+/*inflate a block with dynamic of fixed Huffman tree. btype must be 1 or 2. use_fast 0 skips the fast path.*/
 static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
-                                    unsigned btype, size_t max_output_size) {
+                                    unsigned btype, size_t max_output_size, int use_fast, InflateStream* stream) {
   unsigned error = 0;
   HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
   HuffmanTree tree_d; /*the huffman tree for distance codes*/
   const size_t reserved_size = 260; /* must be at least 258 for max length, and a few extra for adding a few extra literals */
   int done = 0;
+  unsigned fast[1u << INFLATE_FAST_BITS]; /*table for inflateHuffmanBlockFast*/
 
   if(!ucvector_reserve(out, out->size + reserved_size)) return 83; /*alloc fail*/
 
@@ -1251,10 +1651,23 @@ static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
   if(btype == 1) error = getTreeInflateFixed(&tree_ll, &tree_d);
   else /*if(btype == 2)*/ error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
 
+  if(!error && use_fast) buildFastTable(fast, &tree_ll);
 
   while(!error && !done) /*decode all symbols until end reached, breaks at end code*/ {
     /*code_ll is literal, length or end code*/
     unsigned code_ll;
+    /*most of the block goes through the fast path, this loop only decodes the symbols near the end of the
+    input or output, one at a time, and reserves more output*/
+    if(use_fast) {
+      error = inflateHuffmanBlockFast(out, reader, fast, &tree_ll, &tree_d, max_output_size,
+                                      stream ? stream->flush_size : 0, &done);
+      if(error || done) break;
+    }
+    error = inflateStreamSync(stream, out, reader);
+    if(error) break;
+    if(out->allocsize - out->size < reserved_size) {
+      if(!ucvector_reserve(out, out->size + reserved_size)) ERROR_BREAK(83); /*alloc fail*/
+    }
     /* ensure enough bits for 2 huffman code reads (15 bits each): if the first is a literal, a second literal is read at once. This
     appears to be slightly faster, than ensuring 20 bits here for 1 huffman symbol and the potential 5 extra bits for the length symbol.*/
     ensureBits32(reader, 30);
@@ -1344,16 +1757,15 @@ static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
 }
 
 static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
-                                     const LodePNGDecompressSettings* settings) {
+                                     const LodePNGDecompressSettings* settings, InflateStream* stream) {
   size_t bytepos;
-  size_t size = reader->size;
   unsigned LEN, NLEN, error = 0;
 
   /*go to first boundary of byte*/
   bytepos = (reader->bp + 7u) >> 3u;
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
-  if(bytepos + 4 >= size) return 52; /*error, bit pointer will jump past memory*/
+  if(bytepos + 4 >= reader->size) return 52; /*error, bit pointer will jump past memory*/
   LEN = (unsigned)reader->data[bytepos] + ((unsigned)reader->data[bytepos + 1] << 8u); bytepos += 2;
   NLEN = (unsigned)reader->data[bytepos] + ((unsigned)reader->data[bytepos + 1] << 8u); bytepos += 2;
 
@@ -1362,45 +1774,70 @@ static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader,
     return 21; /*error: NLEN is not one's complement of LEN*/
   }
 
-  if(!ucvector_resize(out, out->size + LEN)) return 83; /*alloc fail*/
+  /*checked before the resize, so that a reserved output buffer is never moved for a block that is too big anyway*/
+  if(settings->max_output_size && out->size + LEN > settings->max_output_size) return 109;
 
-  /*read the literal data: LEN bytes are now stored in the out buffer*/
-  if(bytepos + LEN > size) return 23; /*error: reading outside of in buffer*/
-
-  lodepng_memcpy(out->data + out->size - LEN, reader->data + bytepos, LEN);
-  bytepos += LEN;
+  /*read the literal data: LEN bytes are now stored in the out buffer. A stream may have only part of them in
+  its input window, those are copied a window at a time*/
+  while(LEN) {
+    size_t count = LODEPNG_MIN((size_t)LEN, reader->size - bytepos);
+    if(!stream && count != LEN) return 23; /*error: reading outside of in buffer*/
+    if(!ucvector_resize(out, out->size + count)) return 83; /*alloc fail*/
+    lodepng_memcpy(out->data + out->size - count, reader->data + bytepos, count);
+    bytepos += count;
+    LEN -= (unsigned)count;
+    reader->bp = bytepos << 3u;
+    if(stream && LEN) {
+      error = inflateStreamSync(stream, out, reader);
+      if(error) return error;
+      bytepos = reader->bp >> 3u;
+      if(bytepos >= reader->size) return 23; /*error: reading outside of in buffer*/
+    }
+  }
 
   reader->bp = bytepos << 3u;
 
   return error;
 }
 
-static unsigned lodepng_inflatev(ucvector* out,
-                                 const unsigned char* in, size_t insize,
-                                 const LodePNGDecompressSettings* settings) {
+/*inflates the deflate blocks from the reader until the final one, see InflateStream for stream*/
+static unsigned inflateBlocks(ucvector* out, LodePNGBitReader* reader,
+                              const LodePNGDecompressSettings* settings, InflateStream* stream) {
   unsigned BFINAL = 0;
-  LodePNGBitReader reader;
-  unsigned error = LodePNGBitReader_init(&reader, in, insize);
-
-  if(error) return error;
+  unsigned error = 0;
 
   while(!BFINAL) {
     unsigned BTYPE;
-    if(reader.bitsize - reader.bp < 3) return 52; /*error, bit pointer will jump past memory*/
-    ensureBits9(&reader, 3);
-    BFINAL = readBits(&reader, 1);
-    BTYPE = readBits(&reader, 2);
+    error = inflateStreamSync(stream, out, reader);
+    if(error) break;
+    if(reader->bitsize - reader->bp < 3) return 52; /*error, bit pointer will jump past memory*/
+    ensureBits9(reader, 3);
+    BFINAL = readBits(reader, 1);
+    BTYPE = readBits(reader, 2);
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, &reader, settings); /*no compression*/
-    else error = inflateHuffmanBlock(out, &reader, BTYPE, settings->max_output_size); /*compression, BTYPE 01 or 10*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, reader, settings, stream); /*no compression*/
+    else error = inflateHuffmanBlock(out, reader, BTYPE, settings->max_output_size,
+                                     !settings->disable_fast_inflate, stream); /*compression, BTYPE 01 or 10*/
     if(!error && settings->max_output_size && out->size > settings->max_output_size) error = 109;
     if(error) break;
+    if(settings->progress) {
+      settings->progress((stream ? stream->dropped : 0) + out->size, settings->progress_context);
+    }
   }
 
   return error;
 }
 
+static unsigned lodepng_inflatev(ucvector* out,
+                                 const unsigned char* in, size_t insize,
+                                 const LodePNGDecompressSettings* settings) {
+  LodePNGBitReader reader;
+  unsigned error = LodePNGBitReader_init(&reader, in, insize);
+  if(error) return error;
+  return inflateBlocks(out, &reader, settings, 0);
+}
+
 unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGDecompressSettings* settings) {
@@ -2131,9 +2568,109 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
+#ifdef LODEPNG_COMPILE_SIMD
+/*
+Adler-32 of whole blocks of 32 bytes, after Chromium's adler32_simd. Per block, s1 grows by the sum of the
+bytes (psadbw) and s2 by 32 times s1 before the block plus the bytes weighted 32 down to 1 (pmaddubsw).
+The s1 before every block is summed up in ps and multiplied by 32 at the end. At most 5552 bytes are summed
+before the modulo, like in the scalar code. Returns the Adler-32 after len / 32 * 32 bytes.
+*/
+static LODEPNG_TARGET("ssse3") unsigned update_adler32_ssse3(unsigned adler, const unsigned char* data,
+                                                           unsigned len) {
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  unsigned s1 = adler & 0xffffu;
+  unsigned s2 = (adler >> 16u) & 0xffffu;
+  unsigned blocks = len / 32u;
+
+  while(blocks != 0u) {
+    unsigned n = blocks > 5552u / 32u ? 5552u / 32u : blocks;
+    __m128i v_ps = _mm_cvtsi32_si128((int)(s1 * n));
+    __m128i v_s2 = _mm_cvtsi32_si128((int)s2);
+    __m128i v_s1 = _mm_setzero_si128();
+    blocks -= n;
+    do {
+      __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+      __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+      data += 32;
+    } while(--n);
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+    /*horizontal sums of the four 32-bit lanes*/
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(v_s1)) % 65521u;
+    s2 = (unsigned)_mm_cvtsi128_si32(v_s2) % 65521u;
+  }
+
+  return (s2 << 16u) | s1;
+}
+
+/*update_adler32_ssse3 with one 32-byte block per 256-bit register*/
+static LODEPNG_TARGET("avx2") unsigned update_adler32_avx2(unsigned adler, const unsigned char* data,
+                                                         unsigned len) {
+  const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                       16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
   unsigned s1 = adler & 0xffffu;
   unsigned s2 = (adler >> 16u) & 0xffffu;
+  unsigned blocks = len / 32u;
+
+  while(blocks != 0u) {
+    unsigned n = blocks > 5552u / 32u ? 5552u / 32u : blocks;
+    __m256i v_ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s1 = _mm256_setzero_si256();
+    __m128i s1_sum, s2_sum;
+    blocks -= n;
+    do {
+      __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+      v_ps = _mm256_add_epi32(v_ps, v_s1);
+      v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+      v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+      data += 32;
+    } while(--n);
+    v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+    /*horizontal sums of the eight 32-bit lanes*/
+    s1_sum = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+    s2_sum = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+    s1_sum = _mm_add_epi32(s1_sum, _mm_shuffle_epi32(s1_sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    s1_sum = _mm_add_epi32(s1_sum, _mm_shuffle_epi32(s1_sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    s2_sum = _mm_add_epi32(s2_sum, _mm_shuffle_epi32(s2_sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    s2_sum = _mm_add_epi32(s2_sum, _mm_shuffle_epi32(s2_sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(s1_sum)) % 65521u;
+    s2 = (unsigned)_mm_cvtsi128_si32(s2_sum) % 65521u;
+  }
+
+  return (s2 << 16u) | s1;
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len) {
+  unsigned s1, s2;
+#ifdef LODEPNG_COMPILE_SIMD
+  /*the vector versions do the whole blocks of 32 bytes, the loop below the rest*/
+  if(len >= 64u) {
+    const LodePNGCPUFeatures* cpu = lodepng_cpu_features();
+    unsigned blocks_len = len & ~31u;
+    if(cpu->avx2 || cpu->ssse3) {
+      adler = cpu->avx2 ? update_adler32_avx2(adler, data, blocks_len) : update_adler32_ssse3(adler, data, blocks_len);
+      data += blocks_len;
+      len -= blocks_len;
+    }
+  }
+#endif /*LODEPNG_COMPILE_SIMD*/
+  s1 = adler & 0xffffu;
+  s2 = (adler >> 16u) & 0xffffu;
 
   while(len != 0u) {
     unsigned i;
@@ -2162,10 +2699,8 @@ static unsigned adler32(const unsigned char* data, unsigned len) {
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-static unsigned lodepng_zlib_decompressv(ucvector* out,
-                                         const unsigned char* in, size_t insize,
-                                         const LodePNGDecompressSettings* settings) {
-  unsigned error = 0;
+/*checks the 2 byte zlib header at the start of in, returns error code*/
+static unsigned checkZlibHeader(const unsigned char* in, size_t insize) {
   unsigned CM, CINFO, FDICT;
 
   if(insize < 2) return 53; /*error, size of zlib data too small*/
@@ -2190,6 +2725,14 @@ static unsigned lodepng_zlib_decompressv(ucvector* out,
       "The additional flags shall not specify a preset dictionary."*/
     return 26;
   }
+  return 0;
+}
+
+static unsigned lodepng_zlib_decompressv(ucvector* out,
+                                         const unsigned char* in, size_t insize,
+                                         const LodePNGDecompressSettings* settings) {
+  unsigned error = checkZlibHeader(in, insize);
+  if(error) return error;
 
   error = inflatev(out, in + 2, insize - 2, settings);
   if(error) return error;
@@ -2239,6 +2782,67 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, size_t exp
   return error;
 }
 
+#ifdef LODEPNG_COMPILE_DISK
+/*
+Decompresses zlib data with the read and write callbacks and the context the caller set in stream, see
+InflateStream. Besides what the callbacks use, the memory used is an input window of in_capacity bytes and an
+output window of about flush_size bytes, which must be more than INFLATE_STREAM_WINDOW, whatever the size of
+the data. *total is set to the size of all the decompressed data. The custom_zlib, custom_inflate and
+max_output_size settings are not used, the writer sees all the data and can stop it.
+*/
+static unsigned zlibDecompressStreamed(InflateStream* stream, size_t in_capacity, size_t flush_size,
+                                       size_t* total, const LodePNGDecompressSettings* settings) {
+  ucvector out = ucvector_init(NULL, 0);
+  LodePNGDecompressSettings blocksettings = *settings;
+  LodePNGBitReader reader;
+  unsigned error = 0;
+
+  *total = 0;
+  stream->in = (unsigned char*)lodepng_malloc(in_capacity);
+  stream->in_capacity = in_capacity;
+  stream->in_done = 0;
+  stream->flush_size = flush_size;
+  stream->used = 0;
+  stream->dropped = 0;
+  stream->check_adler = !settings->ignore_adler32;
+  stream->adler = 1u;
+  stream->summed = 0;
+  blocksettings.max_output_size = 0; /*out only holds the window, not all the data*/
+
+  /*room for flush_size plus what the fast path and inflateHuffmanBlock keep past the end, so that out never grows*/
+  if(!stream->in || !ucvector_reserve(&out, flush_size + INFLATE_FAST_OUTPUT_MARGIN + 260u)) error = 83; /*alloc fail*/
+
+  if(!error) {
+    reader.data = stream->in;
+    reader.size = reader.bitsize = reader.bp = 0;
+    reader.buffer = 0;
+    error = inflateStreamRefill(stream, &reader);
+  }
+  if(!error) error = checkZlibHeader(reader.data, reader.size);
+  if(!error) {
+    reader.bp = 16;
+    error = inflateBlocks(&out, &reader, &blocksettings, stream);
+  }
+  if(!error) error = inflateStreamFlush(stream, &out, 1);
+  if(!error) *total = stream->dropped + out.size;
+
+  if(!error && stream->check_adler) {
+    /*the Adler-32 follows the deflate data, from the next byte boundary on*/
+    reader.bp = (reader.bp + 7u) & ~(size_t)7u;
+    error = inflateStreamRefill(stream, &reader);
+    if(!error && (reader.bp >> 3u) + 4u > reader.size) error = 53; /*error, size of zlib data too small*/
+    if(!error && lodepng_read32bitInt(&reader.data[reader.bp >> 3u]) != stream->adler) {
+      error = 58; /*error, adler checksum not correct, data must be corrupted*/
+    }
+  }
+
+  lodepng_free(out.data);
+  lodepng_free(stream->in);
+  stream->in = 0;
+  return error;
+}
+#endif /*LODEPNG_COMPILE_DISK*/
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -2345,14 +2949,18 @@ const LodePNGCompressSettings lodepng_default_compress_settings = {2, 1, DEFAULT
 void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings) {
   settings->ignore_adler32 = 0;
   settings->ignore_nlen = 0;
+  settings->disable_fast_inflate = 0;
   settings->max_output_size = 0;
 
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+
+  settings->progress = 0;
+  settings->progress_context = 0;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 0, 0, 0, 0, 0};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -2406,14 +3014,154 @@ static unsigned lodepng_crc32_table[256] = {
   3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
 };
 
-/*Return the CRC of the bytes buf[0..len-1].*/
-unsigned lodepng_crc32(const unsigned char* data, size_t length) {
-  unsigned r = 0xffffffffu;
+#ifdef __cplusplus
+/*
+Slicing-by-8: tables[k][i] is the CRC register after byte i followed by k zero bytes, so that 8 bytes can be
+processed with 8 independent lookups instead of 8 dependent ones. tables[0] is lodepng_crc32_table.
+*/
+typedef struct LodePNGCRC32Tables {
+  unsigned tables[8][256];
+} LodePNGCRC32Tables;
+
+static LodePNGCRC32Tables lodepng_make_crc32_tables(void) {
+  LodePNGCRC32Tables result;
+  unsigned i, k;
+  for(i = 0; i != 256; ++i) result.tables[0][i] = lodepng_crc32_table[i];
+  for(k = 1; k != 8; ++k) {
+    for(i = 0; i != 256; ++i) {
+      unsigned r = result.tables[k - 1][i];
+      result.tables[k][i] = lodepng_crc32_table[r & 0xffu] ^ (r >> 8u);
+    }
+  }
+  return result;
+}
+
+/*built on first use, thread safe as a static local*/
+static const LodePNGCRC32Tables* lodepng_crc32_tables(void) {
+  static const LodePNGCRC32Tables tables = lodepng_make_crc32_tables();
+  return &tables;
+}
+#endif /*__cplusplus*/
+
+#ifdef LODEPNG_COMPILE_SIMD
+/*
+CRC-32 by folding with carry-less multiplication, after Chromium's crc32_sse42_simd_ and Intel's paper "Fast
+CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction": four 128-bit accumulators are folded
+64 bytes ahead at a time, then into one, then reduced to 64 and with a Barrett reduction to 32 bits.
+crc is the CRC register (not inverted at the end), len must be a multiple of 16 and at least 64.
+*/
+static LODEPNG_TARGET("pclmul,sse2") unsigned lodepng_crc32_pclmul(unsigned crc, const unsigned char* data,
+                                                                   size_t len) {
+  /*the bit reflected constants k1..k5 and the CRC-32 and Barrett polynomials of the paper*/
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+  const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+  const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+  __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_loadu_si128((const __m128i*)(data + 0x00));
+  x2 = _mm_loadu_si128((const __m128i*)(data + 0x10));
+  x3 = _mm_loadu_si128((const __m128i*)(data + 0x20));
+  x4 = _mm_loadu_si128((const __m128i*)(data + 0x30));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+  data += 64;
+  len -= 64;
+
+  /*fold the four accumulators 64 bytes ahead*/
+  x0 = k1k2;
+  while(len >= 64) {
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(data + 0x00)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(data + 0x10)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(data + 0x20)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(data + 0x30)));
+    data += 64;
+    len -= 64;
+  }
+
+  /*fold them into one, then the remaining blocks of 16 bytes into that*/
+  x0 = k3k4;
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+  while(len >= 16) {
+    x2 = _mm_loadu_si128((const __m128i*)data);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    data += 16;
+    len -= 16;
+  }
+
+  /*fold 128 bits to 64*/
+  x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /*Barrett reduction to 32 bits*/
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  return (unsigned)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
+/*Updates the CRC r, before its final inversion, with the bytes data[0..length-1]. Starting from 0xffffffff, this
+can go over data that comes a piece at a time.*/
+static unsigned lodepng_crc32_update(unsigned r, const unsigned char* data, size_t length) {
   size_t i;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(length >= 64 && lodepng_cpu_features()->pclmul) {
+    size_t folded = length & ~(size_t)15u;
+    r = lodepng_crc32_pclmul(r, data, folded);
+    data += folded;
+    length -= folded;
+  }
+#endif /*LODEPNG_COMPILE_SIMD*/
+#ifdef __cplusplus
+  if(length >= 16) {
+    const LodePNGCRC32Tables* t = lodepng_crc32_tables();
+    for(; length >= 8; data += 8, length -= 8) {
+      unsigned lo = r ^ ((unsigned)data[0] | ((unsigned)data[1] << 8u) |
+                         ((unsigned)data[2] << 16u) | ((unsigned)data[3] << 24u));
+      unsigned hi = (unsigned)data[4] | ((unsigned)data[5] << 8u) |
+                    ((unsigned)data[6] << 16u) | ((unsigned)data[7] << 24u);
+      r = t->tables[7][lo & 0xffu] ^ t->tables[6][(lo >> 8u) & 0xffu] ^
+          t->tables[5][(lo >> 16u) & 0xffu] ^ t->tables[4][lo >> 24u] ^
+          t->tables[3][hi & 0xffu] ^ t->tables[2][(hi >> 8u) & 0xffu] ^
+          t->tables[1][(hi >> 16u) & 0xffu] ^ t->tables[0][hi >> 24u];
+    }
+  }
+#endif /*__cplusplus*/
   for(i = 0; i < length; ++i) {
     r = lodepng_crc32_table[(r ^ data[i]) & 0xffu] ^ (r >> 8u);
   }
-  return r ^ 0xffffffffu;
+  return r;
+}
+
+/*Return the CRC of the bytes buf[0..len-1].*/
+unsigned lodepng_crc32(const unsigned char* data, size_t length) {
+  return lodepng_crc32_update(0xffffffffu, data, length) ^ 0xffffffffu;
 }
 #else /* !LODEPNG_NO_COMPILE_CRC */
 unsigned lodepng_crc32(const unsigned char* data, size_t length);
@@ -4089,6 +4837,173 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_COMPILE_SIMD
+/*
+SIMD versions of the filters of unfilterScanline, after libpng's intel filter code. Up works on 16 or 32
+bytes at once. Sub, Average and Paeth depend on the pixel to the left, so with 3 or 4 bytes per pixel these
+work on one whole pixel per step instead of one byte, and Sub with 4 bytes per pixel on 4 pixels at once.
+Paeth computes in 16 bits per channel. All of them require precon and a length that is a multiple of
+bytewidth, which are always 3 or 4 (Up excepted).
+*/
+
+static LODEPNG_INLINE unsigned readPixel(const unsigned char* p, size_t bytewidth) {
+  unsigned value = (unsigned)p[0] | ((unsigned)p[1] << 8u) | ((unsigned)p[2] << 16u);
+  if(bytewidth == 4) value |= (unsigned)p[3] << 24u;
+  return value;
+}
+
+static LODEPNG_INLINE void writePixel(unsigned char* p, unsigned value, size_t bytewidth) {
+  p[0] = (unsigned char)value;
+  p[1] = (unsigned char)(value >> 8u);
+  p[2] = (unsigned char)(value >> 16u);
+  if(bytewidth == 4) p[3] = (unsigned char)(value >> 24u);
+}
+
+static LODEPNG_TARGET("sse2") void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline,
+                                                   size_t bytewidth, size_t length) {
+  __m128i a = _mm_setzero_si128(); /*the pixel to the left, in the lowest bytes*/
+  size_t i = 0;
+  if(bytewidth == 4) {
+    /*prefix sum of 4 pixels: add the register shifted by one pixel, then by two, then the pixel before*/
+    for(; i + 16 <= length; i += 16) {
+      __m128i d = _mm_loadu_si128((const __m128i*)&scanline[i]);
+      d = _mm_add_epi8(d, _mm_slli_si128(d, 4));
+      d = _mm_add_epi8(d, _mm_slli_si128(d, 8));
+      d = _mm_add_epi8(d, a);
+      a = _mm_shuffle_epi32(d, _MM_SHUFFLE(3, 3, 3, 3));
+      _mm_storeu_si128((__m128i*)&recon[i], d);
+    }
+  }
+  for(; i != length; i += bytewidth) {
+    a = _mm_add_epi8(a, _mm_cvtsi32_si128((int)readPixel(&scanline[i], bytewidth)));
+    writePixel(&recon[i], (unsigned)_mm_cvtsi128_si32(a), bytewidth);
+  }
+}
+
+static LODEPNG_TARGET("sse2") void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline,
+                                                  const unsigned char* precon, size_t length) {
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16) {
+    __m128i s = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i p = _mm_loadu_si128((const __m128i*)&precon[i]);
+    _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(s, p));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+static LODEPNG_TARGET("avx2") void unfilterUpAVX2(unsigned char* recon, const unsigned char* scanline,
+                                                  const unsigned char* precon, size_t length) {
+  size_t i = 0;
+  for(; i + 32 <= length; i += 32) {
+    __m256i s = _mm256_loadu_si256((const __m256i*)&scanline[i]);
+    __m256i p = _mm256_loadu_si256((const __m256i*)&precon[i]);
+    _mm256_storeu_si256((__m256i*)&recon[i], _mm256_add_epi8(s, p));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+static LODEPNG_TARGET("sse2") void unfilterAverageSSE2(unsigned char* recon, const unsigned char* scanline,
+                                                       const unsigned char* precon, size_t bytewidth,
+                                                       size_t length) {
+  const __m128i ones = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = _mm_cvtsi32_si128((int)readPixel(&precon[i], bytewidth));
+    __m128i d = _mm_cvtsi32_si128((int)readPixel(&scanline[i], bytewidth));
+    /*_mm_avg_epu8 rounds up, (a + b) >> 1 rounds down: subtract the lowest bit of a + b*/
+    __m128i avg = _mm_avg_epu8(a, b);
+    avg = _mm_sub_epi8(avg, _mm_and_si128(_mm_xor_si128(a, b), ones));
+    a = _mm_add_epi8(d, avg);
+    writePixel(&recon[i], (unsigned)_mm_cvtsi128_si32(a), bytewidth);
+  }
+}
+
+/*(mask & a) | (~mask & b)*/
+static LODEPNG_INLINE LODEPNG_TARGET("sse2") __m128i selectSSE2(__m128i mask, __m128i a, __m128i b) {
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*the value of a, b or c that paethPredictor picks, given the absolute differences pa, pb and pc*/
+static LODEPNG_INLINE LODEPNG_TARGET("sse2") __m128i paethNearestSSE2(__m128i a, __m128i b, __m128i c,
+                                                                    __m128i pa, __m128i pb, __m128i pc) {
+  __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+  return selectSSE2(_mm_cmpeq_epi16(pa, smallest), a,
+                    selectSSE2(_mm_cmpeq_epi16(pb, smallest), b, c));
+}
+
+static LODEPNG_TARGET("sse2") void unfilterPaethSSE2(unsigned char* recon, const unsigned char* scanline,
+                                                     const unsigned char* precon, size_t bytewidth,
+                                                     size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero; /*left and upper left pixel, widened to 16 bits per channel*/
+  size_t i;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)readPixel(&precon[i], bytewidth)), zero);
+    __m128i d = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)readPixel(&scanline[i], bytewidth)), zero);
+    __m128i pa = _mm_sub_epi16(b, c); /*p - a, with p = a + b - c*/
+    __m128i pb = _mm_sub_epi16(a, c); /*p - b*/
+    __m128i pc = _mm_add_epi16(pa, pb); /*p - c*/
+    /*no _mm_abs_epi16 before SSSE3: max(x, -x)*/
+    pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+    pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+    pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+    /*the high bytes are all 0, so adding the bytes wraps each channel around at 256*/
+    a = _mm_add_epi8(d, paethNearestSSE2(a, b, c, pa, pb, pc));
+    c = b;
+    writePixel(&recon[i], (unsigned)_mm_cvtsi128_si32(_mm_packus_epi16(a, a)), bytewidth);
+  }
+}
+
+static LODEPNG_TARGET("ssse3") void unfilterPaethSSSE3(unsigned char* recon, const unsigned char* scanline,
+                                                       const unsigned char* precon, size_t bytewidth,
+                                                       size_t length) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i != length; i += bytewidth) {
+    __m128i b = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)readPixel(&precon[i], bytewidth)), zero);
+    __m128i d = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)readPixel(&scanline[i], bytewidth)), zero);
+    __m128i pa = _mm_sub_epi16(b, c);
+    __m128i pb = _mm_sub_epi16(a, c);
+    __m128i pc = _mm_add_epi16(pa, pb);
+    a = _mm_add_epi8(d, paethNearestSSE2(a, b, c, _mm_abs_epi16(pa), _mm_abs_epi16(pb), _mm_abs_epi16(pc)));
+    c = b;
+    writePixel(&recon[i], (unsigned)_mm_cvtsi128_si32(_mm_packus_epi16(a, a)), bytewidth);
+  }
+}
+
+/*unfilters the scanline with the best SIMD version the CPU supports, returns 0 if there is none for it*/
+static unsigned unfilterScanlineSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                     size_t bytewidth, unsigned char filterType, size_t length) {
+  const LodePNGCPUFeatures* cpu = lodepng_cpu_features();
+  unsigned pixels = (bytewidth == 3 || bytewidth == 4) && length % bytewidth == 0;
+  switch(filterType) {
+    case 1:
+      if(!pixels || !cpu->sse2) return 0;
+      unfilterSubSSE2(recon, scanline, bytewidth, length);
+      return 1;
+    case 2:
+      if(!precon) return 0;
+      if(cpu->avx2) unfilterUpAVX2(recon, scanline, precon, length);
+      else if(cpu->sse2) unfilterUpSSE2(recon, scanline, precon, length);
+      else return 0;
+      return 1;
+    case 3:
+      if(!precon || !pixels || !cpu->sse2) return 0;
+      unfilterAverageSSE2(recon, scanline, precon, bytewidth, length);
+      return 1;
+    case 4:
+      if(!precon || !pixels) return 0;
+      if(cpu->ssse3) unfilterPaethSSSE3(recon, scanline, precon, bytewidth, length);
+      else if(cpu->sse2) unfilterPaethSSE2(recon, scanline, precon, bytewidth, length);
+      else return 0;
+      return 1;
+    default: return 0;
+  }
+}
+#endif /*LODEPNG_COMPILE_SIMD*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length) {
   /*
@@ -4101,6 +5016,9 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+#ifdef LODEPNG_COMPILE_SIMD
+  if(unfilterScanlineSIMD(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+#endif /*LODEPNG_COMPILE_SIMD*/
   switch(filterType) {
     case 0:
       for(i = 0; i != length; ++i) recon[i] = scanline[i];
@@ -4777,9 +5695,239 @@ unsigned lodepng_inspect_chunk(LodePNGState* state, size_t pos,
   return error;
 }
 
-/*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
+#if defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ZLIB)
+
+/*images with less decompressed data than this are decoded on the calling thread: starting the threads costs more*/
+#define THREADED_DECODE_MIN_SIZE 65536u
+/*bytes of converted output per strip of scanlines handed to a conversion thread*/
+#define THREADED_DECODE_STRIP_SIZE 65536u
+/*slack behind the expected inflate output: inflateHuffmanBlock keeps 260 bytes reserved past the end and stops with
+error 109 at most 258 bytes past max_output_size, so with this much the reserved buffer is never reallocated*/
+#define THREADED_DECODE_SLACK 1024u
+
+/*
+Decoding of a non-interlaced image in three stages that overlap:
+-the calling thread inflates the IDAT data, and publishes how far it got after every deflate block
+-an unfilter thread unfilters every scanline as soon as its bytes are inflated. This cannot happen in place
+ like in postProcessScanlines: inflate still reads back up to 32K of its output for the LZ77 matches.
+-conversion threads take strips of unfiltered scanlines, in order, and convert them to the raw color mode.
+ Without conversion the scanlines are unfiltered into the output directly and there is no third stage.
+All shared state is behind one mutex, every change of it is signaled on one condition variable.
+*/
+typedef struct ThreadedDecode {
+  std::mutex mutex;
+  std::condition_variable changed;
+
+  const unsigned char* scanlines; /*the inflate output, reserved up front so that it never moves*/
+  size_t inflated; /*bytes of scanlines that are ready*/
+  unsigned inflate_done;
+
+  unsigned char* unfiltered; /*the unfiltered scanlines, the output itself if there is no conversion*/
+  unsigned unfiltered_rows; /*scanlines that are ready in unfiltered*/
+  unsigned unfilter_done;
+
+  unsigned next_strip_row; /*first scanline of the next strip a conversion thread can take*/
+  unsigned error; /*first error of the unfilter or conversion threads, stops all stages*/
+
+  unsigned w, h, bpp;
+  size_t linebytes; /*unfiltered bytes per scanline, without the filter type byte*/
+
+  unsigned char* out; /*the converted image*/
+  const LodePNGColorMode* mode_out;
+  const LodePNGColorMode* mode_in;
+  size_t out_linebytes;
+  unsigned strip_rows;
+
+  const LodePNGDecompressSettings* settings; /*the settings of the user, to pass their progress callback on*/
+} ThreadedDecode;
+
+static void threadedDecodeSetError(ThreadedDecode* decode, unsigned error) {
+  {
+    std::lock_guard<std::mutex> guard(decode->mutex);
+    if(!decode->error) decode->error = error;
+  }
+  decode->changed.notify_all();
+}
+
+static void threadedDecodeProgress(size_t size, const void* context) {
+  ThreadedDecode* decode = (ThreadedDecode*)context;
+  {
+    std::lock_guard<std::mutex> guard(decode->mutex);
+    decode->inflated = size;
+  }
+  decode->changed.notify_all();
+  if(decode->settings->progress) decode->settings->progress(size, decode->settings->progress_context);
+}
+
+static void threadedDecodeUnfilter(ThreadedDecode* decode) {
+  size_t bytewidth = (decode->bpp + 7u) / 8u;
+  unsigned y = 0;
+  for(;;) {
+    unsigned ready;
+    {
+      std::unique_lock<std::mutex> guard(decode->mutex);
+      decode->changed.wait(guard, [decode, y] {
+        return decode->error || decode->inflate_done || decode->inflated / (decode->linebytes + 1u) > y;
+      });
+      if(decode->error) break;
+      ready = (unsigned)LODEPNG_MIN(decode->inflated / (decode->linebytes + 1u), (size_t)decode->h);
+      if(ready == y) break; /*inflate is done and this scanline never came: the main thread reports that*/
+    }
+
+    for(; y < ready; ++y) {
+      const unsigned char* in = &decode->scanlines[(decode->linebytes + 1u) * y];
+      unsigned char* recon = &decode->unfiltered[decode->linebytes * y];
+      const unsigned char* precon = y ? recon - decode->linebytes : 0;
+      unsigned error = unfilterScanline(recon, in + 1, precon, bytewidth, in[0], decode->linebytes);
+      if(error) {
+        threadedDecodeSetError(decode, error);
+        return;
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(decode->mutex);
+      decode->unfiltered_rows = y;
+    }
+    decode->changed.notify_all();
+    if(y == decode->h) break;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(decode->mutex);
+    decode->unfilter_done = 1;
+  }
+  decode->changed.notify_all();
+}
+
+static void threadedDecodeConvert(ThreadedDecode* decode) {
+  for(;;) {
+    unsigned first, end, error;
+    {
+      std::unique_lock<std::mutex> guard(decode->mutex);
+      if(decode->error || decode->next_strip_row >= decode->h) break;
+      first = decode->next_strip_row;
+      end = first + LODEPNG_MIN(decode->strip_rows, decode->h - first);
+      decode->next_strip_row = end;
+      decode->changed.wait(guard, [decode, end] {
+        return decode->error || decode->unfilter_done || decode->unfiltered_rows >= end;
+      });
+      if(decode->error || decode->unfiltered_rows < end) break;
+    }
+
+    error = lodepng_convert(&decode->out[decode->out_linebytes * first], &decode->unfiltered[decode->linebytes * first],
+                            decode->mode_out, decode->mode_in, decode->w, end - first);
+    if(error) {
+      threadedDecodeSetError(decode, error);
+      break;
+    }
+  }
+}
+
+/*whether decodeThreaded can decode this image, convert_to is the raw color mode or NULL if there is no conversion*/
+static unsigned canDecodeThreaded(unsigned w, const LodePNGState* state, size_t expected_size,
+                                  const LodePNGColorMode* convert_to) {
+  const LodePNGDecoderSettings* decoder = &state->decoder;
+  size_t bpp = lodepng_get_bpp(&state->info_png.color);
+  unsigned num_threads = decoder->num_threads ? decoder->num_threads : std::thread::hardware_concurrency();
+  if(num_threads <= 1 || expected_size < THREADED_DECODE_MIN_SIZE) return 0;
+  if(decoder->zlibsettings.custom_zlib || decoder->zlibsettings.custom_inflate) return 0;
+  if(state->info_png.interlace_method != 0) return 0;
+  /*scanlines with padding bits go through removePaddingBits afterwards, they can't be handed on one by one*/
+  if(bpp == 0 || (w * bpp) % 8u != 0) return 0;
+  if(convert_to && (w * (size_t)lodepng_get_bpp(convert_to)) % 8u != 0) return 0;
+  return 1;
+}
+
+/*decodes the zlib compressed scanlines into *out on several threads, see ThreadedDecode.
+*out becomes the image in the convert_to color mode, or in the PNG color mode if convert_to is NULL*/
+static unsigned decodeThreaded(unsigned char** out, unsigned w, unsigned h, const LodePNGState* state,
+                               const unsigned char* idat, size_t idatsize, size_t expected_size,
+                               const LodePNGColorMode* convert_to) {
+  ThreadedDecode decode;
+  LodePNGDecompressSettings settings = state->decoder.zlibsettings;
+  std::vector<std::thread> threads;
+  unsigned num_threads = state->decoder.num_threads;
+  unsigned error, i;
+  ucvector v = ucvector_init(NULL, 0);
+  size_t outsize;
+
+  if(num_threads == 0) num_threads = std::thread::hardware_concurrency();
+  /*the calling thread inflates, one thread unfilters and the rest converts*/
+  unsigned num_converters = convert_to ? (num_threads > 3 ? num_threads - 2 : 1) : 0;
+
+  if(!ucvector_reserve(&v, expected_size + THREADED_DECODE_SLACK)) return 83; /*alloc fail*/
+  outsize = convert_to ? lodepng_get_raw_size(w, h, convert_to) : expected_size - h;
+  *out = (unsigned char*)lodepng_malloc(outsize);
+  decode.unfiltered = convert_to ? (unsigned char*)lodepng_malloc(expected_size - h) : *out;
+  if(!*out || !decode.unfiltered) {
+    if(decode.unfiltered != *out) lodepng_free(decode.unfiltered);
+    lodepng_free(*out);
+    *out = 0;
+    lodepng_free(v.data);
+    return 83; /*alloc fail*/
+  }
+
+  decode.scanlines = v.data;
+  decode.inflated = 0;
+  decode.inflate_done = 0;
+  decode.unfiltered_rows = 0;
+  decode.unfilter_done = 0;
+  decode.next_strip_row = 0;
+  decode.error = 0;
+  decode.w = w;
+  decode.h = h;
+  decode.bpp = lodepng_get_bpp(&state->info_png.color);
+  decode.linebytes = expected_size / h - 1u;
+  decode.out = *out;
+  decode.mode_out = convert_to;
+  decode.mode_in = &state->info_png.color;
+  decode.out_linebytes = convert_to ? outsize / h : 0;
+  decode.strip_rows = convert_to ? (unsigned)LODEPNG_MAX(THREADED_DECODE_STRIP_SIZE / LODEPNG_MAX(outsize / h, 1), 1) : 0;
+  decode.settings = &state->decoder.zlibsettings;
+
+  /*inflate must not write past the reserved buffer, which it could only do for a corrupt image anyway*/
+  if(!settings.max_output_size || settings.max_output_size > expected_size) settings.max_output_size = expected_size;
+  settings.progress = threadedDecodeProgress;
+  settings.progress_context = &decode;
+
+  try {
+    threads.emplace_back(threadedDecodeUnfilter, &decode);
+    for(i = 0; i != num_converters; ++i) threads.emplace_back(threadedDecodeConvert, &decode);
+    error = lodepng_zlib_decompressv(&v, idat, idatsize, &settings);
+  } catch(...) {
+    error = 83; /*could not start a thread*/
+  }
+  /*decompressing more than predicted is reported like decompressing less, unless it broke the limit of the user*/
+  if(error == 109 && settings.max_output_size != state->decoder.zlibsettings.max_output_size) error = 91;
+  if(!error && v.size != expected_size) error = 91; /*decompressed size doesn't match prediction*/
+
+  {
+    std::lock_guard<std::mutex> guard(decode.mutex);
+    decode.inflated = v.size;
+    decode.inflate_done = 1;
+    if(error) decode.error = error;
+  }
+  decode.changed.notify_all();
+  for(i = 0; i != threads.size(); ++i) threads[i].join();
+
+  if(!error) error = decode.error;
+  if(decode.unfiltered != *out) lodepng_free(decode.unfiltered);
+  lodepng_free(v.data);
+  if(error) {
+    lodepng_free(*out);
+    *out = 0;
+  }
+  return error;
+}
+
+#endif /*LODEPNG_COMPILE_THREADS && LODEPNG_COMPILE_ZLIB*/
+
+/*read a PNG, the result will be in the same color type as the PNG (hence "generic"). If convert_to is
+given and the image could be decoded on several threads, it was converted to that color mode on the
+way, which is returned in *converted*/
+static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h, unsigned* converted,
+                          LodePNGState* state, const LodePNGColorMode* convert_to,
                           const unsigned char* in, size_t insize) {
   unsigned char IEND = 0;
   const unsigned char* chunk;
@@ -4799,6 +5947,7 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   /* safe output values in case error happens */
   *out = 0;
   *w = *h = 0;
+  *converted = 0;
 
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
@@ -4955,6 +6104,16 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
       expected_size += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, bpp);
     }
 
+#if defined(LODEPNG_COMPILE_THREADS) && defined(LODEPNG_COMPILE_ZLIB)
+    if(convert_to && lodepng_color_mode_equal(convert_to, &state->info_png.color)) convert_to = 0;
+    if(canDecodeThreaded(*w, state, expected_size, convert_to)) {
+      state->error = decodeThreaded(out, *w, *h, state, idat, idatsize, expected_size, convert_to);
+      lodepng_free(idat);
+      if(!state->error && convert_to) *converted = 1;
+      return;
+    }
+#endif /*LODEPNG_COMPILE_THREADS && LODEPNG_COMPILE_ZLIB*/
+
     state->error = zlib_decompress(&scanlines, &scanlines_size, expected_size, idat, idatsize, &state->decoder.zlibsettings);
   }
   if(!state->error && scanlines_size != expected_size) state->error = 91; /*decompressed size doesn't match prediction*/
@@ -4975,9 +6134,15 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize) {
+  unsigned converted;
+  /*the conversion can be done by the decoding threads only if it is one that is supported, see below*/
+  const LodePNGColorMode* convert_to = state->decoder.color_convert
+      && (state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA || state->info_raw.bitdepth == 8)
+      ? &state->info_raw : 0;
   *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
+  decodeGeneric(out, w, h, &converted, state, convert_to, in, insize);
   if(state->error) return state->error;
+  if(converted) return 0; /*already converted to info_raw by the decoding threads*/
   if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color)) {
     /*same color type, no copying or converting of data needed*/
     /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
@@ -5056,6 +6221,304 @@ unsigned lodepng_decode32_file(unsigned char** out, unsigned* w, unsigned* h, co
 unsigned lodepng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, const char* filename) {
   return lodepng_decode_file(out, w, h, filename, LCT_RGB, 8);
 }
+
+unsigned lodepng_inspect_file(unsigned* w, unsigned* h, LodePNGState* state, const char* filename) {
+  unsigned char header[33];
+  size_t size;
+  FILE* file = fopen(filename, "rb");
+  if(!file) return 78;
+  size = fread(header, 1, sizeof(header), file);
+  fclose(file);
+  return lodepng_inspect(w, h, state, header, size);
+}
+
+/*decodes the whole file in memory and copies the image into out, for the images decodeStreamed can't do*/
+static unsigned decodeFileIntoWhole(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                                    LodePNGState* state, const char* filename) {
+  unsigned char* buffer = 0;
+  unsigned char* image = 0;
+  size_t buffersize, imagesize = 0;
+  unsigned error = lodepng_load_file(&buffer, &buffersize, filename);
+  if(!error) error = lodepng_decode(&image, w, h, state, buffer, buffersize);
+  if(!error) imagesize = lodepng_get_raw_size(*w, *h, &state->info_raw);
+  if(!error && imagesize > outsize) error = 114; /*output buffer too small for the image*/
+  if(!error) lodepng_memcpy(out, image, imagesize);
+  lodepng_free(image);
+  lodepng_free(buffer);
+  return error;
+}
+
+#if defined(LODEPNG_COMPILE_ZLIB) && !defined(LODEPNG_NO_COMPILE_CRC)
+
+/*bytes of the file that the input window of the inflate stream holds*/
+#define STREAM_DECODE_INPUT_SIZE 65536u
+
+/*
+Decoding of a non-interlaced image for lodepng_decode_file_into. The data of the IDAT chunks is read from the
+file straight into the input window of an InflateStream, and its writer unfilters every scanline as soon as it
+is complete: into out directly if there is no color conversion, else into one of two scanline buffers, the
+current and the previous one, from where it is converted into out. The other chunks are read one at a time.
+*/
+typedef struct StreamDecode {
+  FILE* file;
+  const LodePNGDecoderSettings* settings;
+  unsigned char next[8]; /*length and type of the chunk that is read next, or of the IDAT chunk being read*/
+  size_t idat_left; /*bytes of the IDAT chunk being read that are not read yet*/
+  unsigned crc; /*CRC of the IDAT chunk being read so far*/
+  unsigned idat_done; /*the chunk after the IDAT chunks was reached, or the end of the file with ignore_end*/
+  unsigned end_of_file;
+
+  unsigned w, h, y; /*y is the next scanline*/
+  size_t bytewidth, linebytes; /*linebytes: unfiltered bytes per scanline, without the filter type byte*/
+  unsigned char* lines; /*the two unfiltered scanlines, if there is a conversion*/
+  unsigned char* out;
+  size_t out_linebytes;
+  const LodePNGColorMode* mode_out; /*NULL if the image is output in the color mode of the PNG*/
+  const LodePNGColorMode* mode_in;
+} StreamDecode;
+
+/*InflateStream read callback: the data of the IDAT chunks, the CRC of each chunk is checked at its end*/
+static unsigned streamDecodeRead(unsigned char* buffer, size_t capacity, size_t* size, void* context) {
+  StreamDecode* decode = (StreamDecode*)context;
+  *size = 0;
+  while(*size < capacity && !decode->idat_done) {
+    size_t count;
+    if(!decode->idat_left) {
+      unsigned char crc[4];
+      if(fread(crc, 1, 4, decode->file) != 4) return 30; /*error: chunk broken off at end of file*/
+      if(!decode->settings->ignore_crc && lodepng_read32bitInt(crc) != (decode->crc ^ 0xffffffffu)) {
+        return 57; /*invalid CRC*/
+      }
+      if(fread(decode->next, 1, 8, decode->file) != 8) {
+        if(!decode->settings->ignore_end) return 30;
+        decode->idat_done = decode->end_of_file = 1;
+      } else if(!lodepng_chunk_type_equals(decode->next, "IDAT")) {
+        decode->idat_done = 1;
+      } else {
+        if(lodepng_chunk_length(decode->next) > 2147483647) return 63;
+        decode->idat_left = lodepng_chunk_length(decode->next);
+        decode->crc = lodepng_crc32_update(0xffffffffu, &decode->next[4], 4);
+      }
+      continue;
+    }
+    count = LODEPNG_MIN(capacity - *size, decode->idat_left);
+    if(fread(buffer + *size, 1, count, decode->file) != count) return 30; /*error: chunk broken off at end of file*/
+    decode->crc = lodepng_crc32_update(decode->crc, buffer + *size, count);
+    decode->idat_left -= count;
+    *size += count;
+  }
+  return 0;
+}
+
+/*InflateStream write callback: unfilters, and converts, the complete scanlines at the start of data*/
+static unsigned streamDecodeWrite(const unsigned char* data, size_t size, size_t* used, void* context) {
+  StreamDecode* decode = (StreamDecode*)context;
+  size_t rowsize = decode->linebytes + 1u;
+  for(*used = 0; size - *used >= rowsize; *used += rowsize, ++decode->y) {
+    const unsigned char* scanline = &data[*used];
+    unsigned char* recon;
+    const unsigned char* precon;
+    unsigned error;
+    if(decode->y == decode->h) return 91; /*more data than the scanlines of the image*/
+    if(decode->mode_out) {
+      recon = &decode->lines[(decode->y & 1u) * decode->linebytes];
+      precon = decode->y ? &decode->lines[((decode->y + 1u) & 1u) * decode->linebytes] : 0;
+    } else {
+      recon = &decode->out[(size_t)decode->y * decode->linebytes];
+      precon = decode->y ? recon - decode->linebytes : 0;
+    }
+    error = unfilterScanline(recon, scanline + 1, precon, decode->bytewidth, scanline[0], decode->linebytes);
+    if(!error && decode->mode_out) {
+      error = lodepng_convert(&decode->out[(size_t)decode->y * decode->out_linebytes], recon,
+                              decode->mode_out, decode->mode_in, decode->w, 1);
+    }
+    if(error) return error;
+  }
+  return 0;
+}
+
+/*inflates the IDAT data that starts with the IDAT chunk in decode->next into the scanlines of out*/
+static unsigned streamDecodeScanlines(StreamDecode* decode, const LodePNGState* state) {
+  InflateStream stream;
+  size_t expected_size = lodepng_get_raw_size_idat(decode->w, decode->h, lodepng_get_bpp(decode->mode_in));
+  size_t total;
+  unsigned error;
+
+  if(decode->mode_in->colortype == LCT_PALETTE && !decode->mode_in->palette) {
+    return 106; /* error: PNG file must have PLTE chunk if color type is palette */
+  }
+  if(decode->mode_out) {
+    decode->lines = (unsigned char*)lodepng_malloc(decode->linebytes * 2u);
+    if(!decode->lines) return 83; /*alloc fail*/
+  }
+
+  stream.read = streamDecodeRead;
+  stream.write = streamDecodeWrite;
+  stream.context = decode;
+  /*the window, and room for a couple of scanlines more so that every flush has a whole one*/
+  error = zlibDecompressStreamed(&stream, STREAM_DECODE_INPUT_SIZE, 3u * INFLATE_STREAM_WINDOW + 2u * (decode->linebytes + 1u),
+                                 &total, &state->decoder.zlibsettings);
+  if(!error && (total != expected_size || decode->y != decode->h)) error = 91; /*decompressed size doesn't match prediction*/
+
+  lodepng_free(decode->lines);
+  decode->lines = 0;
+  return error;
+}
+
+/*the chunk loop of lodepng_decode_file_into, after the header, see StreamDecode*/
+static unsigned decodeStreamed(StreamDecode* decode, LodePNGState* state, size_t filesize) {
+  unsigned char* chunk = 0;
+  unsigned IEND = 0, inflated = 0, have_next = 0;
+  unsigned error = 0;
+
+  while(!IEND && !error) {
+    unsigned length;
+    if(!have_next && fread(decode->next, 1, 8, decode->file) != 8) {
+      if(state->decoder.ignore_end) break; /*other errors may still happen though*/
+      error = 30; /*error: chunk broken off at end of file*/
+      break;
+    }
+    have_next = 0;
+
+    length = lodepng_chunk_length(decode->next);
+    if(length > 2147483647) {
+      if(state->decoder.ignore_end) break; /*other errors may still happen though*/
+      error = 63; /*error: chunk length larger than the max PNG chunk size*/
+      break;
+    }
+
+    if(lodepng_chunk_type_equals(decode->next, "IDAT")) {
+      decode->idat_left = length;
+      decode->crc = lodepng_crc32_update(0xffffffffu, &decode->next[4], 4);
+      decode->idat_done = 0;
+      if(!inflated) {
+        error = streamDecodeScanlines(decode, state);
+        inflated = 1;
+      }
+      /*what follows the zlib data in the IDAT chunks, and IDAT chunks after other chunks, is skipped*/
+      while(!error && !decode->idat_done) {
+        unsigned char skipped[4096];
+        size_t size;
+        error = streamDecodeRead(skipped, sizeof(skipped), &size, decode);
+      }
+      if(decode->end_of_file) break;
+      have_next = 1; /*the chunk after the IDAT chunks*/
+      continue;
+    }
+
+    if((size_t)length + 12u > filesize) {
+      error = 30; /*error: chunk broken off at end of file*/
+      break;
+    }
+    chunk = (unsigned char*)lodepng_malloc((size_t)length + 12u);
+    if(!chunk) {
+      error = 83; /*alloc fail*/
+      break;
+    }
+    lodepng_memcpy(chunk, decode->next, 8);
+    if(fread(&chunk[8], 1, (size_t)length + 4u, decode->file) != (size_t)length + 4u) {
+      error = 30; /*error: chunk broken off at end of file*/
+    } else if(lodepng_chunk_type_equals(chunk, "IEND")) {
+      IEND = 1;
+      if(!state->decoder.ignore_crc && lodepng_chunk_check_crc(chunk)) error = 57; /*invalid CRC*/
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+    } else if(!state->decoder.read_text_chunks && (lodepng_chunk_type_equals(chunk, "tEXt")
+              || lodepng_chunk_type_equals(chunk, "zTXt") || lodepng_chunk_type_equals(chunk, "iTXt"))) {
+      /*text chunks are skipped*/
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+    } else if(!lodepng_chunk_ancillary(chunk) && !lodepng_chunk_type_equals(chunk, "PLTE")) {
+      /*error: unknown critical chunk (5th bit of first byte of chunk type is 0)*/
+      if(!state->decoder.ignore_critical) error = 69;
+    } else {
+      /*PLTE, tRNS and the metadata chunks, ignores the other ancillary chunks*/
+      error = lodepng_inspect_chunk(state, 0, chunk, (size_t)length + 12u);
+    }
+    lodepng_free(chunk);
+    chunk = 0;
+  }
+
+  if(!error && !inflated) error = 53; /*error: no IDAT chunk, the zlib data is empty*/
+  return error;
+}
+
+/*whether decodeStreamed can decode this image into out*/
+static unsigned canDecodeStreamed(unsigned w, const LodePNGState* state) {
+  const LodePNGColorMode* mode_out = state->decoder.color_convert ? &state->info_raw : &state->info_png.color;
+  if(state->decoder.zlibsettings.custom_zlib || state->decoder.zlibsettings.custom_inflate) return 0;
+  if(state->info_png.interlace_method != 0) return 0;
+#ifdef LODEPNG_COMPILE_THREADS
+  if(state->decoder.num_threads != 1) return 0; /*only the whole decode runs on several threads*/
+#endif /*LODEPNG_COMPILE_THREADS*/
+#ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
+  if(state->decoder.remember_unknown_chunks) return 0;
+#endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
+  /*the scanlines are output one at a time, each one has to start on a byte boundary in out*/
+  if((w * (size_t)lodepng_get_bpp(mode_out)) % 8u != 0) return 0;
+  return 1;
+}
+
+#endif /*LODEPNG_COMPILE_ZLIB && !LODEPNG_NO_COMPILE_CRC*/
+
+unsigned lodepng_decode_file_into(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                                  LodePNGState* state, const char* filename) {
+  const LodePNGColorMode* mode_out;
+  unsigned error;
+  *w = *h = 0;
+
+  error = lodepng_inspect_file(w, h, state, filename);
+  if(error) return error;
+  if(lodepng_pixel_overflow(*w, *h, &state->info_png.color, &state->info_raw)) {
+    CERROR_RETURN_ERROR(state->error, 92); /*overflow possible due to amount of pixels*/
+  }
+  mode_out = state->decoder.color_convert ? &state->info_raw : &state->info_png.color;
+  if(lodepng_get_raw_size(*w, *h, mode_out) > outsize) {
+    CERROR_RETURN_ERROR(state->error, 114); /*output buffer too small for the image*/
+  }
+  if(state->decoder.color_convert && !lodepng_color_mode_equal(&state->info_raw, &state->info_png.color)
+     && !(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
+     && !(state->info_raw.bitdepth == 8)) {
+    CERROR_RETURN_ERROR(state->error, 56); /*unsupported color mode conversion*/
+  }
+
+#if defined(LODEPNG_COMPILE_ZLIB) && !defined(LODEPNG_NO_COMPILE_CRC)
+  if(canDecodeStreamed(*w, state)) {
+    StreamDecode decode;
+    long filesize = lodepng_filesize(filename);
+    size_t bpp = lodepng_get_bpp(&state->info_png.color);
+    decode.file = fopen(filename, "rb");
+    if(filesize < 0 || !decode.file) {
+      if(decode.file) fclose(decode.file);
+      CERROR_RETURN_ERROR(state->error, 78);
+    }
+    decode.settings = &state->decoder;
+    decode.idat_left = 0;
+    decode.idat_done = 1;
+    decode.end_of_file = 0;
+    decode.w = *w;
+    decode.h = *h;
+    decode.y = 0;
+    decode.bytewidth = (bpp + 7u) / 8u;
+    decode.linebytes = (*w * bpp + 7u) / 8u;
+    decode.lines = 0;
+    decode.out = out;
+    decode.out_linebytes = lodepng_get_raw_size(*w, 1, mode_out);
+    decode.mode_out = lodepng_color_mode_equal(mode_out, &state->info_png.color) ? 0 : mode_out;
+    decode.mode_in = &state->info_png.color;
+
+    /*the header was checked by lodepng_inspect_file*/
+    if(fseek(decode.file, 33, SEEK_SET) != 0) state->error = 78;
+    else state->error = decodeStreamed(&decode, state, (size_t)filesize);
+    fclose(decode.file);
+    if(!state->error && !state->decoder.color_convert) {
+      state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+    }
+    return state->error;
+  }
+#endif /*LODEPNG_COMPILE_ZLIB && !LODEPNG_NO_COMPILE_CRC*/
+
+  state->error = decodeFileIntoWhole(out, outsize, w, h, state, filename);
+  return state->error;
+}
 #endif /*LODEPNG_COMPILE_DISK*/
 
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings) {
@@ -5069,6 +6532,7 @@ void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings) {
   settings->ignore_crc = 0;
   settings->ignore_critical = 0;
   settings->ignore_end = 0;
+  settings->num_threads = 1;
   lodepng_decompress_settings_init(&settings->zlibsettings);
 }
 
@@ -6282,6 +7746,8 @@ const char* lodepng_error_text(unsigned code) {
     /*max ICC size limit can be configured in LodePNGDecoderSettings. This error prevents
     unreasonable memory consumption when decoding due to impossibly large ICC profile*/
     case 113: return "ICC profile unreasonably large";
+    /*lodepng_decode_file_into decodes into a buffer of the caller*/
+    case 114: return "output buffer too small for the image";
   }
   return "unknown error code";
 }
@@ -94,6 +94,20 @@ source files with custom allocators.*/
 #include <string>
 #endif /*LODEPNG_COMPILE_CPP*/
 
+/*compile the SSE2/SSSE3/AVX2 versions of the hot decoding loops, used when the CPU supports them (x86 and x64)*/
+#if defined(__cplusplus) && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#ifndef LODEPNG_NO_COMPILE_SIMD
+#define LODEPNG_COMPILE_SIMD
+#endif
+#endif
+
+/*compile the multi-threaded decoding (uses C++11 threads, see LodePNGDecoderSettings::num_threads)*/
+#ifdef __cplusplus
+#ifndef LODEPNG_NO_COMPILE_THREADS
+#define LODEPNG_COMPILE_THREADS
+#endif
+#endif
+
 #ifdef LODEPNG_COMPILE_PNG
 /*The PNG color types (also used for raw image).*/
 typedef enum LodePNGColorType {
@@ -293,6 +307,9 @@ struct LodePNGDecompressSettings {
   /* Check LodePNGDecoderSettings for more ignorable errors such as ignore_crc */
   unsigned ignore_adler32; /*if 1, continue and don't give an error message if the Adler32 checksum is corrupted*/
   unsigned ignore_nlen; /*ignore complement of len checksum in uncompressed blocks*/
+  /*if 1, decode Huffman blocks one symbol at a time only, without the multi-symbol fast path (default: 0).
+  The output is the same, it is only there to measure the fast path against.*/
+  unsigned disable_fast_inflate;
 
   /*Maximum decompressed size, beyond this the decoder may (and is encouraged to) stop decoding,
   return an error, output a data size > max_output_size and all the data up to that point. This is
@@ -314,6 +331,11 @@ struct LodePNGDecompressSettings {
                              const LodePNGDecompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*called by the built in inflate after every deflate block with the amount of bytes decompressed so far
+  (default: null). Lets the PNG decoder work on the scanlines while the rest is still being inflated.*/
+  void (*progress)(size_t, const void*);
+  const void* progress_context; /*passed to progress*/
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -676,6 +698,13 @@ typedef struct LodePNGDecoderSettings {
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*threads used to decode non-interlaced images. Default: 1, everything on the calling thread. With more,
+  the scanlines are unfiltered on a second thread while the calling thread is still inflating, and the
+  color conversion runs on the others, in strips of scanlines, as soon as those are unfiltered. 0 picks
+  one thread per hardware thread. Ignored without LODEPNG_COMPILE_THREADS, with custom_zlib or
+  custom_inflate, and for interlaced images or scanlines that do not end on a byte boundary.*/
+  unsigned num_threads;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
 
@@ -821,6 +850,28 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+#ifdef LODEPNG_COMPILE_DISK
+/*Same as lodepng_inspect, but reads only the header of the file with given name.*/
+unsigned lodepng_inspect_file(unsigned* w, unsigned* h,
+                              LodePNGState* state, const char* filename);
+
+/*
+Decodes the PNG file with given name into out, a buffer of outsize bytes of the caller such as a
+texture, instead of into a buffer it allocates. Use lodepng_inspect_file first to know the size:
+out must hold lodepng_get_raw_size(w, h, &state->info_raw) bytes, or the size in the color mode of
+the PNG, state->info_png.color, if color_convert is off. Returns error 114 if it is too small.
+The memory used besides out does not grow with the image: the file is read a piece at a time, the
+zlib data is inflated through a window of about 100KB, and every scanline is unfiltered and
+converted into out as soon as it is complete. This is done on the calling thread.
+Interlaced images, images whose scanlines don't start on a byte boundary in out, and decoding with
+custom_zlib, custom_inflate, remember_unknown_chunks or num_threads other than 1, are decoded in
+memory as a whole like lodepng_decode does, and then copied into out. That is faster on several
+threads, but holds the file, the inflated scanlines and the image besides out.
+*/
+unsigned lodepng_decode_file_into(unsigned char* out, size_t outsize, unsigned* w, unsigned* h,
+                                  LodePNGState* state, const char* filename);
+#endif /*LODEPNG_COMPILE_DISK*/
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 /*
@@ -1802,6 +1853,7 @@ state.decoder.ignore_crc: ignore CRC checksums
 state.decoder.ignore_critical: ignore unknown critical chunks
 state.decoder.ignore_end: ignore missing IEND chunk. May fail if this corruption causes other errors
 state.decoder.color_convert: convert internal PNG color to chosen one
+state.decoder.num_threads: decode on several threads (non-interlaced images), 0 for all hardware threads
 state.decoder.read_text_chunks: whether to read in text metadata chunks
 state.decoder.remember_unknown_chunks: whether to read in unknown chunks
 state.info_raw.colortype: desired color type for decoded image